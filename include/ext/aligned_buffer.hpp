@@ -0,0 +1,97 @@
+/*
+ * Copyright 2017 Mahdi Khanalizadeh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HEADER_EXT_ALIGNED_BUFFER_HPP_INCLUDED
+#define HEADER_EXT_ALIGNED_BUFFER_HPP_INCLUDED
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+
+#include <memory>
+#include <system_error>
+
+#include <sys/uio.h>
+
+namespace ext
+{
+
+	namespace detail
+	{
+
+		struct FreeDeleter
+		{
+			void operator()(void* const pointer) const noexcept { ::free(pointer); }
+		};
+
+		inline char* allocate_aligned(::std::size_t const size, ::std::size_t const alignment)
+		{
+			void* memory;
+			int const ret = ::posix_memalign(&memory, alignment, size);
+			if (ret)
+				throw ::std::system_error{ret, ::std::system_category(), u8"posix_memalign"};
+			return static_cast<char*>(memory);
+		}
+
+		inline bool is_aligned(::std::uintmax_t const value, ::std::size_t const alignment) noexcept
+		{
+			return value % alignment == 0;
+		}
+
+		inline ::std::size_t align_up(::std::size_t const value, ::std::size_t const alignment) noexcept
+		{
+			return (value + alignment - 1) / alignment * alignment;
+		}
+
+	} // namespace detail
+
+	// Heap buffer whose address and size are multiples of alignment (a power of two), as O_DIRECT transfers and
+	// registered io_uring buffers require. The size is rounded up.
+	class AlignedBuffer
+	{
+	public:
+		AlignedBuffer() = default;
+
+		explicit AlignedBuffer(::std::size_t const size, ::std::size_t const alignment = 4096) :
+			m_data{detail::allocate_aligned(detail::align_up(size, alignment), alignment)},
+			m_size{detail::align_up(size, alignment)},
+			m_alignment{alignment}
+		{
+			assert(alignment && !(alignment & (alignment - 1)));
+		}
+
+		AlignedBuffer(AlignedBuffer&&) noexcept = default;
+		AlignedBuffer& operator=(AlignedBuffer&&) noexcept = default;
+
+		char* data() noexcept { return m_data.get(); }
+		char const* data() const noexcept { return m_data.get(); }
+		::std::size_t size() const noexcept { return m_size; }
+		::std::size_t alignment() const noexcept { return m_alignment; }
+		explicit operator bool() const noexcept { return !!m_data; }
+
+		// For readv/writev and AsyncIo::register_buffers().
+		::iovec iov() const noexcept { return {m_data.get(), m_size}; }
+
+	private:
+		::std::unique_ptr<char, detail::FreeDeleter> m_data;
+		::std::size_t m_size = 0;
+		::std::size_t m_alignment = 1;
+	};
+
+} // namespace ext
+
+#endif // !HEADER_EXT_ALIGNED_BUFFER_HPP_INCLUDED
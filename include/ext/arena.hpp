@@ -0,0 +1,272 @@
+/*
+ * Copyright 2017 Mahdi Khanalizadeh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef HEADER_EXT_ARENA_HPP_INCLUDED
+#define HEADER_EXT_ARENA_HPP_INCLUDED
+
+#include "aligned_buffer.hpp"
+#include "memory_map.hpp"
+
+#include <cassert>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <system_error>
+
+#include <sys/mman.h>
+
+namespace ext
+{
+
+	namespace detail
+	{
+
+		// PMD size on x86-64 and 4 KiB page arm64, the size transparent and default explicit huge pages have.
+		constexpr ::std::size_t huge_page_size = 2 * 1024 * 1024;
+
+		// Address space reserved with PROT_NONE and committed front to back with mprotect(), so that untouched
+		// capacity costs neither memory nor commit charge. Huge pages commit in whole huge pages from a huge page
+		// aligned base.
+		class LazyRegion
+		{
+		public:
+			LazyRegion(::std::size_t const reserve, HugePages const huge_pages) :
+				m_granule{huge_pages == HugePages::None ? ::std::max<::std::size_t>(page_size(), 64 * 1024) : huge_page_size}
+			{
+				::std::size_t const length = align_up(::std::max<::std::size_t>(reserve, 1), m_granule);
+				int const flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+				if (huge_pages == HugePages::Explicit || huge_pages == HugePages::Preferred)
+				{
+					::std::error_code ec;
+					m_map->map(nullptr, length, PROT_NONE, flags | MemoryMap::huge_page_flags(), -1, 0, ec);
+					if (ec && huge_pages == HugePages::Explicit)
+						throw ::std::system_error{ec, u8"mmap(MAP_HUGETLB)"};
+					if (!ec)
+					{
+						m_base = static_cast<char*>(m_map->data());
+						m_reserved = length;
+						return;
+					}
+				}
+
+				// Over-reserve by a granule so the base can be aligned for transparent huge pages.
+				m_map->map(nullptr, length + m_granule, PROT_NONE, flags, -1, 0);
+				m_base = reinterpret_cast<char*>(align_up(reinterpret_cast<::std::uintptr_t>(m_map->data()), m_granule));
+				m_reserved = length;
+				if (huge_pages != HugePages::None && ::madvise(m_base, m_reserved, MADV_HUGEPAGE) == -1)
+					throw ::std::system_error{errno, ::std::system_category(), u8"madvise(MADV_HUGEPAGE)"};
+			}
+
+			char* data() const noexcept { return m_base; }
+			::std::size_t reserved() const noexcept { return m_reserved; }
+			::std::size_t committed() const noexcept { return m_committed; }
+
+			// Makes at least [0, size) accessible, growing by at least half of what is committed.
+			void commit(::std::size_t const size)
+			{
+				if (size <= m_committed)
+					return;
+				if (size > m_reserved)
+					throw ::std::system_error{ENOMEM, ::std::system_category(), u8"reservation exhausted"};
+
+				::std::size_t const target = ::std::min(align_up(::std::max(size, m_committed + m_committed / 2), m_granule), m_reserved);
+				if (::mprotect(m_base + m_committed, target - m_committed, PROT_READ | PROT_WRITE) == -1)
+					throw ::std::system_error{errno, ::std::system_category(), u8"mprotect"};
+				m_committed = target;
+			}
+
+			// Returns the memory behind [keep, committed()) to the kernel. The range stays committed and reads back as
+			// zeros, so reusing it costs page faults but no syscalls.
+			void release(::std::size_t keep)
+			{
+				keep = align_up(keep, m_granule);
+				if (keep < m_committed && ::madvise(m_base + keep, m_committed - keep, MADV_DONTNEED) == -1)
+					throw ::std::system_error{errno, ::std::system_category(), u8"madvise(MADV_DONTNEED)"};
+			}
+
+		private:
+			::std::size_t const m_granule;
+			MemoryMapPtr m_map;
+			char* m_base;
+			::std::size_t m_reserved;
+			::std::size_t m_committed = 0;
+		};
+
+	} // namespace detail
+
+	// Bump allocator for short-lived data such as per-frame scratch buffers: allocation is a pointer increment,
+	// deallocation is a no-op and reset() frees everything at once. Memory comes from a reservation of reserve bytes
+	// that is committed lazily and never moves. Not thread safe; use one arena per thread.
+	class Arena
+	{
+	public:
+		using Marker = ::std::size_t;
+
+		explicit Arena(::std::size_t const reserve, HugePages const huge_pages = HugePages::None) :
+			m_region{reserve, huge_pages}
+		{
+		}
+
+		Arena(Arena const&) = delete;
+		Arena& operator=(Arena const&) = delete;
+
+		// alignment must be a power of two. Throws ENOMEM once the reservation is exhausted.
+		void* allocate(::std::size_t const size, ::std::size_t const alignment = alignof(::std::max_align_t))
+		{
+			assert(alignment && !(alignment & (alignment - 1)));
+
+			::std::size_t const offset = detail::align_up(m_used, alignment);
+			if (offset > m_region.reserved() || size > m_region.reserved() - offset)
+				throw ::std::system_error{ENOMEM, ::std::system_category(), u8"Arena: reservation exhausted"};
+			m_region.commit(offset + size);
+			m_used = offset + size;
+			return m_region.data() + offset;
+		}
+
+		template <typename T>
+		T* allocate_array(::std::size_t const count)
+		{
+			assert(count <= SIZE_MAX / sizeof(T));
+
+			return static_cast<T*>(allocate(count * sizeof(T), alignof(T)));
+		}
+
+		// Scoped release: everything allocated after mark() is freed by rewind().
+		Marker mark() const noexcept { return m_used; }
+
+		void rewind(Marker const marker) noexcept
+		{
+			assert(marker <= m_used);
+
+			m_used = marker;
+		}
+
+		// Frees every allocation, typically at the end of a frame. Committed memory is kept for the next frame.
+		void reset() noexcept { m_used = 0; }
+
+		// Gives committed memory beyond max(used(), keep) back to the kernel, e.g. after a spike.
+		void trim(::std::size_t const keep = 0) { m_region.release(::std::max(m_used, keep)); }
+
+		::std::size_t used() const noexcept { return m_used; }
+		::std::size_t committed() const noexcept { return m_region.committed(); }
+		::std::size_t reserved() const noexcept { return m_region.reserved(); }
+
+		bool owns(void const* const pointer) const noexcept
+		{
+			auto const* const p = static_cast<char const*>(pointer);
+			return p >= m_region.data() && p < m_region.data() + m_region.reserved();
+		}
+
+	private:
+		detail::LazyRegion m_region;
+		::std::size_t m_used = 0;
+	};
+
+	// Allocator for blocks of one size, e.g. the nodes of a list or map. Freed blocks go to an intrusive free list and
+	// are reused before new memory is committed. Not thread safe.
+	class Pool
+	{
+	public:
+		// alignment must be a power of two.
+		Pool(::std::size_t const block_size, ::std::size_t const reserve, HugePages const huge_pages = HugePages::None, ::std::size_t const alignment = alignof(::std::max_align_t)) :
+			m_block_size{detail::align_up(::std::max(block_size, sizeof(void*)), ::std::max(alignment, alignof(void*)))},
+			m_alignment{::std::max(alignment, alignof(void*))},
+			m_region{reserve, huge_pages}
+		{
+			assert(alignment && !(alignment & (alignment - 1)));
+		}
+
+		Pool(Pool const&) = delete;
+		Pool& operator=(Pool const&) = delete;
+
+		::std::size_t block_size() const noexcept { return m_block_size; }
+		::std::size_t alignment() const noexcept { return m_alignment; }
+
+		// Throws ENOMEM once the reservation is exhausted.
+		void* allocate()
+		{
+			++m_live;
+			if (m_free)
+			{
+				void* const block = m_free;
+				m_free = *static_cast<void**>(m_free);
+				return block;
+			}
+
+			if (m_block_size > m_region.reserved() - m_used)
+			{
+				--m_live;
+				throw ::std::system_error{ENOMEM, ::std::system_category(), u8"Pool: reservation exhausted"};
+			}
+			m_region.commit(m_used + m_block_size);
+			void* const block = m_region.data() + m_used;
+			m_used += m_block_size;
+			return block;
+		}
+
+		void deallocate(void* const block) noexcept
+		{
+			assert(owns(block));
+			assert(m_live);
+
+			*static_cast<void**>(block) = m_free;
+			m_free = block;
+			--m_live;
+		}
+
+		// Frees every block at once.
+		void reset() noexcept
+		{
+			m_free = nullptr;
+			m_used = 0;
+			m_live = 0;
+		}
+
+		// Gives committed memory that no block ever used back to the kernel. Freed blocks are scattered over the
+		// free list, so only an empty pool can release them; it is reset first.
+		void trim()
+		{
+			if (!m_live)
+				reset();
+			m_region.release(m_used);
+		}
+
+		// Number of blocks handed out and not deallocated.
+		::std::size_t live() const noexcept { return m_live; }
+		::std::size_t committed() const noexcept { return m_region.committed(); }
+		::std::size_t reserved() const noexcept { return m_region.reserved(); }
+
+		bool owns(void const* const pointer) const noexcept
+		{
+			auto const* const p = static_cast<char const*>(pointer);
+			return p >= m_region.data() && p < m_region.data() + m_used;
+		}
+
+	private:
+		::std::size_t const m_block_size;
+		::std::size_t const m_alignment;
+		detail::LazyRegion m_region;
+		void* m_free = nullptr;
+		::std::size_t m_used = 0;
+		::std::size_t m_live = 0;
+	};
+
+} // namespace ext
+
+#endif // !HEADER_EXT_ARENA_HPP_INCLUDED
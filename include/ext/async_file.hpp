@@ -0,0 +1,170 @@
+/*
+ * Copyright 2017 Mahdi Khanalizadeh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HEADER_EXT_ASYNC_FILE_HPP_INCLUDED
+#define HEADER_EXT_ASYNC_FILE_HPP_INCLUDED
+
+#include "file.hpp"
+#include "io_uring.hpp"
+#include "thread_pool.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+namespace ext
+{
+
+	enum class AsyncBackend
+	{
+		Auto, // io_uring if the kernel allows it and can probe for IORING_OP_READ/IORING_OP_WRITE (5.6+), threads otherwise
+		IoUring, // throws ENOSYS where Auto would pick threads
+		Threads,
+	};
+
+	struct AsyncCompletion
+	{
+		::std::uint64_t user_data;
+		long result; // bytes transferred or -errno
+	};
+
+	// Index into the table passed to AsyncIo::register_files().
+	struct RegisteredFile
+	{
+		unsigned int index;
+	};
+
+	// Batches file operations: requests are queued locally, submit() hands all of them to the kernel with one
+	// io_uring_enter and wait()/poll() harvest completions in batches. Where io_uring is unavailable (old kernels,
+	// seccomp filters, io_uring_disabled) the same interface is served by a small thread pool issuing pread/pwrite.
+	// Not thread safe; use one instance per thread.
+	class AsyncIo
+	{
+	public:
+		explicit AsyncIo(unsigned int queue_depth = 256, AsyncBackend backend = AsyncBackend::Auto);
+		~AsyncIo() noexcept;
+
+		AsyncIo(AsyncIo const&) = delete;
+		AsyncIo& operator=(AsyncIo const&) = delete;
+
+		bool uses_io_uring() const noexcept { return !!m_ring; }
+		unsigned int queue_depth() const noexcept { return m_depth; }
+
+		// Number of queued plus submitted operations whose completion was not harvested yet.
+		unsigned int in_flight() const noexcept { return m_queued + m_submitted; }
+
+		// The queueing functions return false if queue_depth() operations are in flight; harvest completions first.
+		bool read(int fd, void* buffer, ::std::size_t count, ::off_t offset, ::std::uint64_t user_data) { return enqueue({Read, fd, false, buffer, count, offset, -1, user_data}); }
+		bool write(int fd, void const* buffer, ::std::size_t count, ::off_t offset, ::std::uint64_t user_data) { return enqueue({Write, fd, false, const_cast<void*>(buffer), count, offset, -1, user_data}); }
+		bool fsync(int fd, bool data_only, ::std::uint64_t user_data) { return enqueue({data_only ? DataSync : Sync, fd, false, nullptr, 0, 0, -1, user_data}); }
+		bool read(RegisteredFile file, void* buffer, ::std::size_t count, ::off_t offset, ::std::uint64_t user_data) { return enqueue({Read, static_cast<int>(file.index), true, buffer, count, offset, -1, user_data}); }
+		bool write(RegisteredFile file, void const* buffer, ::std::size_t count, ::off_t offset, ::std::uint64_t user_data) { return enqueue({Write, static_cast<int>(file.index), true, const_cast<void*>(buffer), count, offset, -1, user_data}); }
+
+		// buffer must lie inside the registered buffer with index buffer_index.
+		bool read_fixed(int fd, void* buffer, ::std::size_t count, ::off_t offset, unsigned int buffer_index, ::std::uint64_t user_data) { return enqueue({Read, fd, false, buffer, count, offset, static_cast<int>(buffer_index), user_data}); }
+		bool write_fixed(int fd, void const* buffer, ::std::size_t count, ::off_t offset, unsigned int buffer_index, ::std::uint64_t user_data) { return enqueue({Write, fd, false, const_cast<void*>(buffer), count, offset, static_cast<int>(buffer_index), user_data}); }
+
+		// Pins buffers (and their page references) in the kernel so fixed reads and writes skip the per-request
+		// page lookup. Must not be called while operations are in flight.
+		void register_buffers(::iovec const* buffers, unsigned int count);
+		void unregister_buffers();
+
+		// Registers descriptors so requests using RegisteredFile skip the per-request fd table lookup.
+		void register_files(int const* fds, unsigned int count);
+		void unregister_files();
+
+		// Submits queued operations. Returns how many were submitted; if the kernel takes fewer than were queued, the
+		// rest stays queued and goes with the next submit(), wait() or poll().
+		unsigned int submit();
+
+		// Submits queued operations and waits until at least min_complete completions are available, then stores up to
+		// max of them in completions. Returns the number stored.
+		unsigned int wait(AsyncCompletion* completions, unsigned int max, unsigned int min_complete = 1);
+
+		// Like wait() but never blocks.
+		unsigned int poll(AsyncCompletion* completions, unsigned int max);
+
+	private:
+		enum Opcode : unsigned char
+		{
+			Read,
+			Write,
+			Sync,
+			DataSync,
+		};
+
+		struct Operation
+		{
+			Opcode opcode;
+			int fd;
+			bool registered_file;
+			void* buffer;
+			::std::size_t count;
+			::off_t offset;
+			int buffer_index;
+			::std::uint64_t user_data;
+		};
+
+		bool enqueue(Operation const& operation);
+		unsigned int flush(unsigned int wait_nr);
+		void account(unsigned int consumed) noexcept;
+		unsigned int harvest(AsyncCompletion* completions, unsigned int max);
+		void execute(Operation const& operation) noexcept;
+
+		unsigned int const m_depth;
+		unsigned int m_queued = 0;
+		unsigned int m_submitted = 0;
+
+		::std::unique_ptr<IoUring> m_ring;
+
+		// Thread backend. The pool comes last so that its workers are gone before the state they use is destroyed.
+		::std::vector<Operation> m_operations;
+		::std::vector<int> m_files;
+		::std::mutex m_mutex;
+		::std::condition_variable m_cv;
+		::std::vector<AsyncCompletion> m_completions;
+		::std::unique_ptr<ThreadPool> m_pool;
+	};
+
+	// Convenience wrapper binding an AsyncIo to one descriptor.
+	class AsyncFile
+	{
+	public:
+		AsyncFile(AsyncIo& io, FilePtr const& file) noexcept : m_io(io), m_fd{file.get()} {}
+		AsyncFile(AsyncIo& io, int const fd) noexcept : m_io(io), m_fd{fd} {}
+
+		AsyncIo& io() noexcept { return m_io; }
+
+		bool pread(void* const buffer, ::std::size_t const count, ::off_t const offset, ::std::uint64_t const user_data) { return m_io.read(m_fd, buffer, count, offset, user_data); }
+		bool pwrite(void const* const buffer, ::std::size_t const count, ::off_t const offset, ::std::uint64_t const user_data) { return m_io.write(m_fd, buffer, count, offset, user_data); }
+		bool fsync(::std::uint64_t const user_data) { return m_io.fsync(m_fd, false, user_data); }
+		bool fdatasync(::std::uint64_t const user_data) { return m_io.fsync(m_fd, true, user_data); }
+
+	private:
+		AsyncIo& m_io;
+		int const m_fd;
+	};
+
+} // namespace ext
+
+#endif // !HEADER_EXT_ASYNC_FILE_HPP_INCLUDED
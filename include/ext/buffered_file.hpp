@@ -0,0 +1,333 @@
+/*
+ * Copyright 2017 Mahdi Khanalizadeh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HEADER_EXT_BUFFERED_FILE_HPP_INCLUDED
+#define HEADER_EXT_BUFFERED_FILE_HPP_INCLUDED
+
+#include "aligned_buffer.hpp"
+#include "file.hpp"
+
+#include <cassert>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+
+#include <algorithm>
+#include <string>
+#include <system_error>
+#include <utility>
+
+namespace ext
+{
+
+	// Reads a File through an aligned buffer. The buffered bytes can be inspected in place with peek() and
+	// read_until() and released with consume(), so parsers never copy them.
+	class BufferedReader
+	{
+	public:
+		explicit BufferedReader(File& file, ::std::size_t const capacity = 64 * 1024, ::std::size_t const alignment = 4096) :
+			m_file(file),
+			m_buffer{capacity, alignment}
+		{
+			assert(capacity);
+		}
+
+		BufferedReader(BufferedReader const&) = delete;
+		BufferedReader& operator=(BufferedReader const&) = delete;
+
+		// The buffered bytes that were not consumed yet.
+		char const* data() const noexcept { return m_buffer.data() + m_begin; }
+		::std::size_t size() const noexcept { return m_end - m_begin; }
+
+		// True once the file reported its end and every buffered byte was consumed.
+		bool eof() const noexcept { return m_eof && m_begin == m_end; }
+
+		// Reads more data into the buffer with a single read(). Returns the number of bytes added; 0 means end of file
+		// or that the buffer is full.
+		::std::size_t fill()
+		{
+			if (m_end == m_buffer.size() || m_begin == m_end)
+				compact();
+			if (m_end == m_buffer.size() || m_eof)
+				return 0;
+
+			::std::size_t const ret = read_some(m_buffer.data() + m_end, m_buffer.size() - m_end);
+			if (!ret)
+				m_eof = true;
+			m_end += ret;
+			return ret;
+		}
+
+		// Makes at least count bytes available in place, growing the buffer if needed. Returns nullptr if the file
+		// ends first; size() then tells how many bytes are left.
+		char const* peek(::std::size_t const count)
+		{
+			if (count > m_buffer.size())
+				grow(count);
+			while (size() < count)
+			{
+				if (m_eof)
+					return nullptr;
+				if (m_buffer.size() - m_begin < count)
+					compact();
+				fill();
+			}
+			return data();
+		}
+
+		void consume(::std::size_t const count) noexcept
+		{
+			assert(count <= size());
+
+			m_begin += count;
+		}
+
+		// Finds the next record terminated by delimiter and returns it in place without the delimiter; the
+		// delimiter is consumed along with the record by consume(length + 1). The last record of a file may lack the
+		// delimiter, in which case length == size(). Records longer than the buffer grow it. Returns false at the
+		// end of the file. The view stays valid until the next non-const call.
+		bool read_until(char const delimiter, char const*& record, ::std::size_t& length)
+		{
+			::std::size_t scanned = 0;
+			for (;;)
+			{
+				// memchr is vectorized by every serious libc, which is as fast as a hand written SSE/AVX loop.
+				void const* const found = ::std::memchr(data() + scanned, delimiter, size() - scanned);
+				if (found)
+				{
+					record = data();
+					length = static_cast<::std::size_t>(static_cast<char const*>(found) - data());
+					return true;
+				}
+				scanned = size();
+
+				if (m_eof)
+				{
+					record = data();
+					length = size();
+					return length != 0;
+				}
+
+				if (m_end == m_buffer.size())
+				{
+					if (m_begin)
+						compact();
+					else
+						grow(m_buffer.size() * 2);
+				}
+				fill();
+			}
+		}
+
+		// Convenience wrapper around read_until() that copies the line without its terminator.
+		bool read_line(::std::string& line, char const delimiter = '\n')
+		{
+			char const* record;
+			::std::size_t length;
+			if (!read_until(delimiter, record, length))
+				return false;
+			line.assign(record, length);
+			consume(length < size() ? length + 1 : length);
+			return true;
+		}
+
+		// Copying read. Large requests bypass the buffer.
+		::std::size_t read(void* const buffer, ::std::size_t const count)
+		{
+			auto* out = static_cast<char*>(buffer);
+			::std::size_t done = ::std::min(count, size());
+			::std::memcpy(out, data(), done);
+			consume(done);
+
+			while (done < count && !m_eof)
+			{
+				if (count - done >= m_buffer.size())
+				{
+					::std::size_t const ret = read_some(out + done, count - done);
+					if (!ret)
+						m_eof = true;
+					done += ret;
+				}
+				else
+				{
+					fill();
+					::std::size_t const n = ::std::min(count - done, size());
+					::std::memcpy(out + done, data(), n);
+					consume(n);
+					done += n;
+				}
+			}
+			return done;
+		}
+
+	private:
+		// A signal interrupting the read is not an error worth an exception.
+		::std::size_t read_some(void* const buffer, ::std::size_t const count)
+		{
+			::std::error_code ec;
+			for (;;)
+			{
+				::std::size_t const ret = m_file.read(buffer, count, ec);
+				if (!ec)
+					return ret;
+				if (ec.value() != EINTR)
+					throw ::std::system_error{ec, u8"read"};
+			}
+		}
+
+		void compact() noexcept
+		{
+			::std::memmove(m_buffer.data(), m_buffer.data() + m_begin, m_end - m_begin);
+			m_end -= m_begin;
+			m_begin = 0;
+		}
+
+		void grow(::std::size_t const capacity)
+		{
+			AlignedBuffer buffer{capacity, m_buffer.alignment()};
+			::std::memcpy(buffer.data(), data(), size());
+			m_end -= m_begin;
+			m_begin = 0;
+			m_buffer = ::std::move(buffer);
+		}
+
+		File& m_file;
+		AlignedBuffer m_buffer;
+		::std::size_t m_begin = 0;
+		::std::size_t m_end = 0;
+		bool m_eof = false;
+	};
+
+	// Collects small writes in an aligned buffer and writes them with as few syscalls as possible. Nothing reaches
+	// the file before flush() or a write that does not fit; the destructor flushes as a last resort but cannot
+	// report errors, so call flush() explicitly. When writing fails, whatever did not reach the file stays
+	// buffered, data passed to the failing write() included, and a later flush() resumes where the file ends.
+	class BufferedWriter
+	{
+	public:
+		explicit BufferedWriter(File& file, ::std::size_t const capacity = 64 * 1024, ::std::size_t const alignment = 4096) :
+			m_file(file),
+			m_buffer{capacity, alignment}
+		{
+			assert(capacity);
+		}
+
+		~BufferedWriter() noexcept
+		{
+			try { flush(); } catch (...) {}
+		}
+
+		BufferedWriter(BufferedWriter const&) = delete;
+		BufferedWriter& operator=(BufferedWriter const&) = delete;
+
+		::std::size_t buffered() const noexcept { return m_size; }
+		::std::size_t capacity() const noexcept { return m_buffer.size(); }
+
+		void write(void const* const data, ::std::size_t const count)
+		{
+			if (count <= m_buffer.size() - m_size)
+			{
+				::std::memcpy(m_buffer.data() + m_size, data, count);
+				m_size += count;
+				return;
+			}
+
+			// Does not fit: hand the buffer and the new data to the kernel in one writev instead of copying.
+			::iovec iov[2] = {{m_buffer.data(), m_size}, {const_cast<void*>(data), count}};
+			try
+			{
+				m_file.pwritev_all(iov, 2);
+			}
+			catch (...)
+			{
+				keep(iov[0], iov[1]);
+				throw;
+			}
+			m_size = 0;
+		}
+
+		void write(::std::string const& text) { write(text.data(), text.size()); }
+
+		void put(char const c)
+		{
+			if (m_size == m_buffer.size())
+				flush();
+			m_buffer.data()[m_size++] = c;
+		}
+
+		// Zero-copy production: returns space for at least count bytes (count <= capacity()) that commit() appends.
+		char* reserve(::std::size_t const count)
+		{
+			assert(count <= m_buffer.size());
+
+			if (count > m_buffer.size() - m_size)
+				flush();
+			return m_buffer.data() + m_size;
+		}
+
+		void commit(::std::size_t const count) noexcept
+		{
+			assert(count <= m_buffer.size() - m_size);
+
+			m_size += count;
+		}
+
+		// Writes everything buffered to the file. Does not sync; see File for durability.
+		void flush()
+		{
+			if (!m_size)
+				return;
+
+			::iovec iov{m_buffer.data(), m_size};
+			try
+			{
+				m_file.pwritev_all(&iov, 1);
+			}
+			catch (...)
+			{
+				keep(iov, {nullptr, 0});
+				throw;
+			}
+			m_size = 0;
+		}
+
+	private:
+		// After a failed write, buffers exactly the bytes that did not reach the file, growing the buffer if the
+		// unwritten part of the caller's data does not fit, so that the next flush() neither repeats nor loses any.
+		void keep(::iovec const& buffered, ::iovec const& data)
+		{
+			::std::size_t const size = buffered.iov_len + data.iov_len;
+			if (size > m_buffer.size())
+			{
+				AlignedBuffer buffer{size, m_buffer.alignment()};
+				::std::memcpy(buffer.data(), buffered.iov_base, buffered.iov_len);
+				m_buffer = ::std::move(buffer);
+			}
+			else
+				::std::memmove(m_buffer.data(), buffered.iov_base, buffered.iov_len);
+			if (data.iov_len)
+				::std::memcpy(m_buffer.data() + buffered.iov_len, data.iov_base, data.iov_len);
+			m_size = size;
+		}
+
+		File& m_file;
+		AlignedBuffer m_buffer;
+		::std::size_t m_size = 0;
+	};
+
+} // namespace ext
+
+#endif // !HEADER_EXT_BUFFERED_FILE_HPP_INCLUDED
@@ -0,0 +1,30 @@
+/*
+ * Copyright 2017 Mahdi Khanalizadeh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HEADER_EXT_CACHE_LINE_HPP_INCLUDED
+#define HEADER_EXT_CACHE_LINE_HPP_INCLUDED
+
+#include <cstddef>
+
+namespace ext
+{
+
+	// std::hardware_destructive_interference_size is C++17 and not provided by every standard library.
+	constexpr ::std::size_t cache_line_size = 64;
+
+} // namespace ext
+
+#endif // !HEADER_EXT_CACHE_LINE_HPP_INCLUDED
@@ -0,0 +1,289 @@
+/*
+ * Copyright 2017 Mahdi Khanalizadeh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HEADER_EXT_CHUNKED_READER_HPP_INCLUDED
+#define HEADER_EXT_CHUNKED_READER_HPP_INCLUDED
+
+#include "aligned_buffer.hpp"
+#include "file.hpp"
+#include "thread_pool.hpp"
+
+#include <cassert>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <sys/types.h>
+
+namespace ext
+{
+
+	struct ChunkedReadOptions
+	{
+		// Nominal chunk size, rounded up to a multiple of alignment. Chunks are read in one pread each.
+		::std::size_t chunk_size = 4 * 1024 * 1024;
+
+		// Chunk boundaries fall on multiples of this, e.g. the page size or the RAID/object store stripe size.
+		::std::size_t alignment = 4096;
+
+		// With a delimiter (a value of unsigned char) chunk boundaries are moved to just after the next delimiter, so
+		// every chunk holds whole records. -1 splits at the nominal boundaries.
+		int delimiter = -1;
+
+		// Deliver chunks in file order, one at a time. Otherwise the callback runs concurrently in completion order.
+		bool ordered = false;
+
+		// Maximum number of chunks read but not yet delivered per worker, which bounds memory use when ordered.
+		unsigned int window = 2;
+	};
+
+	struct FileChunk
+	{
+		::std::size_t index; // position of the chunk in the file, starting at 0
+		::off_t offset;
+		char const* data;
+		::std::size_t size; // 0 if a record spans the whole nominal chunk; the previous chunk then owns it
+	};
+
+	namespace detail
+	{
+
+		// pread until count bytes arrived or the end of the file.
+		inline ::std::size_t pread_until_eof(File& file, char* const buffer, ::std::size_t const count, ::off_t const offset)
+		{
+			::std::size_t done = 0;
+			while (done < count)
+			{
+				::std::error_code ec;
+				::std::size_t const ret = file.pread(buffer + done, count - done, offset + static_cast<::off_t>(done), ec);
+				if (ec)
+				{
+					if (ec.value() == EINTR)
+						continue;
+					throw ::std::system_error{ec, u8"pread"};
+				}
+				if (!ret)
+					break;
+				done += ret;
+			}
+			return done;
+		}
+
+		class ChunkedRead
+		{
+		public:
+			ChunkedRead(File& file, ChunkedReadOptions const& options, ::off_t const file_size) :
+				m_file(file),
+				m_options(options),
+				m_chunk_size{align_up(::std::max<::std::size_t>(options.chunk_size, 1), options.alignment)},
+				m_file_size{file_size},
+				m_chunks{static_cast<::std::size_t>((file_size + static_cast<::off_t>(m_chunk_size) - 1) / static_cast<::off_t>(m_chunk_size))}
+			{
+			}
+
+			::std::size_t chunks() const noexcept { return m_chunks; }
+
+			// Claims and processes chunks until none are left. Run by every worker.
+			template <typename Callback>
+			void work(Callback& callback, ::std::size_t const window)
+			{
+				for (;;)
+				{
+					::std::size_t index;
+					{
+						::std::unique_lock<::std::mutex> lock{m_mutex};
+						if (m_options.ordered)
+							m_cv.wait(lock, [&]{ return m_failed || m_next_claim < m_next_delivery + window; });
+						if (m_failed || m_next_claim == m_chunks)
+							return;
+						index = m_next_claim++;
+					}
+
+					try
+					{
+						Chunk chunk = read(index);
+						if (m_options.ordered)
+							deliver_in_order(::std::move(chunk), callback);
+						else
+							callback(static_cast<FileChunk const&>(chunk.view));
+					}
+					catch (...)
+					{
+						::std::lock_guard<::std::mutex> lock{m_mutex};
+						m_failed = true;
+						m_cv.notify_all();
+						throw;
+					}
+				}
+			}
+
+		private:
+			struct Chunk
+			{
+				FileChunk view;
+				::std::vector<char> buffer;
+			};
+
+			Chunk read(::std::size_t const index)
+			{
+				::off_t const begin = static_cast<::off_t>(index * m_chunk_size);
+				::off_t const end = ::std::min(m_file_size, begin + static_cast<::off_t>(m_chunk_size));
+
+				// With a delimiter the byte before the chunk tells whether a record starts at begin.
+				::off_t const first = m_options.delimiter >= 0 && begin ? begin - 1 : begin;
+
+				Chunk chunk;
+				chunk.buffer.resize(static_cast<::std::size_t>(end - first));
+				chunk.buffer.resize(pread_until_eof(m_file, chunk.buffer.data(), chunk.buffer.size(), first));
+
+				::std::size_t skip = 0;
+				if (m_options.delimiter >= 0)
+				{
+					if (first != begin)
+					{
+						// Records starting before begin belong to the previous chunk.
+						void const* const found = ::std::memchr(chunk.buffer.data(), m_options.delimiter, chunk.buffer.size());
+						skip = found ? static_cast<::std::size_t>(static_cast<char const*>(found) - chunk.buffer.data()) + 1 : chunk.buffer.size();
+					}
+
+					// Records starting before end are completed by reading past it.
+					if (skip < chunk.buffer.size() && chunk.buffer.back() != static_cast<char>(m_options.delimiter))
+						extend(chunk.buffer, first);
+				}
+
+				chunk.view = {index, first + static_cast<::off_t>(skip), chunk.buffer.data() + skip, chunk.buffer.size() - skip};
+				return chunk;
+			}
+
+			void extend(::std::vector<char>& buffer, ::off_t const first)
+			{
+				::std::size_t const step = ::std::min<::std::size_t>(m_chunk_size, 64 * 1024);
+				for (;;)
+				{
+					::std::size_t const old_size = buffer.size();
+					buffer.resize(old_size + step);
+					::std::size_t const ret = pread_until_eof(m_file, buffer.data() + old_size, step, first + static_cast<::off_t>(old_size));
+					void const* const found = ::std::memchr(buffer.data() + old_size, m_options.delimiter, ret);
+					if (found)
+					{
+						buffer.resize(static_cast<::std::size_t>(static_cast<char const*>(found) - buffer.data()) + 1);
+						return;
+					}
+					buffer.resize(old_size + ret);
+					if (ret < step)
+						return; // the last record lacks its delimiter
+				}
+			}
+
+			// Whoever completes the next chunk in file order delivers it and every following one that is ready.
+			// m_delivering keeps the callback serialized.
+			template <typename Callback>
+			void deliver_in_order(Chunk chunk, Callback& callback)
+			{
+				::std::unique_lock<::std::mutex> lock{m_mutex};
+				::std::size_t const index = chunk.view.index;
+				m_ready.emplace(index, ::std::move(chunk));
+				if (m_delivering || index != m_next_delivery)
+					return;
+
+				m_delivering = true;
+				for (auto it = m_ready.find(m_next_delivery); it != m_ready.end() && !m_failed; it = m_ready.find(m_next_delivery))
+				{
+					Chunk next = ::std::move(it->second);
+					m_ready.erase(it);
+					lock.unlock();
+					try
+					{
+						callback(static_cast<FileChunk const&>(next.view));
+					}
+					catch (...)
+					{
+						lock.lock();
+						m_delivering = false;
+						throw;
+					}
+					lock.lock();
+					++m_next_delivery;
+					m_cv.notify_all();
+				}
+				m_delivering = false;
+			}
+
+			File& m_file;
+			ChunkedReadOptions const& m_options;
+			::std::size_t const m_chunk_size;
+			::off_t const m_file_size;
+			::std::size_t const m_chunks;
+
+			::std::mutex m_mutex;
+			::std::condition_variable m_cv;
+			::std::size_t m_next_claim = 0;
+			::std::size_t m_next_delivery = 0;
+			::std::map<::std::size_t, Chunk> m_ready;
+			bool m_delivering = false;
+			bool m_failed = false;
+		};
+
+	} // namespace detail
+
+	// Reads file in chunks with concurrent preads on the workers of pool and passes each chunk to
+	// callback(FileChunk const&). The chunk memory is only valid during the call. The first exception thrown by the
+	// callback or a read stops the remaining work and is rethrown. Must not be called from a worker of pool when
+	// options.ordered is set, as blocked workers could then starve the pool.
+	template <typename Callback>
+	void read_chunks(ThreadPool& pool, File& file, ChunkedReadOptions const& options, Callback callback)
+	{
+		assert(options.alignment);
+
+		detail::ChunkedRead read{file, options, file.size()};
+		::std::size_t const workers = ::std::min<::std::size_t>(pool.size(), read.chunks());
+		::std::size_t const window = static_cast<::std::size_t>(::std::max(options.window, 1u)) * ::std::max<::std::size_t>(workers, 1);
+
+		TaskGroup group{pool};
+		for (::std::size_t i = 1; i < workers; ++i)
+			group.run([&read, &callback, window]{ read.work(callback, window); });
+
+		// The calling thread works too instead of just waiting.
+		try
+		{
+			read.work(callback, window);
+		}
+		catch (...)
+		{
+			try { group.wait(); } catch (...) {}
+			throw;
+		}
+		group.wait();
+	}
+
+	template <typename Callback>
+	void read_chunks(File& file, ChunkedReadOptions const& options, Callback callback)
+	{
+		read_chunks(ThreadPool::global(), file, options, ::std::move(callback));
+	}
+
+} // namespace ext
+
+#endif // !HEADER_EXT_CHUNKED_READER_HPP_INCLUDED
@@ -0,0 +1,397 @@
+/*
+ * Copyright 2017 Mahdi Khanalizadeh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef HEADER_EXT_COLUMN_FILE_HPP_INCLUDED
+#define HEADER_EXT_COLUMN_FILE_HPP_INCLUDED
+
+#include "aligned_buffer.hpp"
+#include "color.hpp"
+#include "file.hpp"
+#include "memory_map.hpp"
+#include "span.hpp"
+#include "vector2.hpp"
+#include "vector3.hpp"
+#include "vector4.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <sys/mman.h>
+
+namespace ext
+{
+
+	enum class ColumnType : ::std::uint32_t
+	{
+		Int8 = 1,
+		UInt8,
+		Int16,
+		UInt16,
+		Int32,
+		UInt32,
+		Int64,
+		UInt64,
+		Float32,
+		Float64,
+	};
+
+	enum class ColumnKind : ::std::uint16_t
+	{
+		Scalar,
+		Vector,
+		Color,
+	};
+
+	// Maps element types to their on-disk description. Specialize it to store other trivially copyable types.
+	template <typename T>
+	struct ColumnElement;
+
+#define EXT_COLUMN_SCALAR(type_, code_) \
+	template <> \
+	struct ColumnElement<type_> \
+	{ \
+		using Scalar = type_; \
+		static constexpr ColumnType type = ColumnType::code_; \
+		static constexpr ColumnKind kind = ColumnKind::Scalar; \
+		static constexpr unsigned int components = 1; \
+	};
+
+	EXT_COLUMN_SCALAR(::std::int8_t, Int8)
+	EXT_COLUMN_SCALAR(::std::uint8_t, UInt8)
+	EXT_COLUMN_SCALAR(::std::int16_t, Int16)
+	EXT_COLUMN_SCALAR(::std::uint16_t, UInt16)
+	EXT_COLUMN_SCALAR(::std::int32_t, Int32)
+	EXT_COLUMN_SCALAR(::std::uint32_t, UInt32)
+	EXT_COLUMN_SCALAR(::std::int64_t, Int64)
+	EXT_COLUMN_SCALAR(::std::uint64_t, UInt64)
+	EXT_COLUMN_SCALAR(float, Float32)
+	EXT_COLUMN_SCALAR(double, Float64)
+
+#undef EXT_COLUMN_SCALAR
+
+	namespace detail
+	{
+
+		template <typename T, ColumnKind Kind, unsigned int Components>
+		struct CompoundColumnElement
+		{
+			using Scalar = T;
+			static constexpr ColumnType type = ColumnElement<T>::type;
+			static constexpr ColumnKind kind = Kind;
+			static constexpr unsigned int components = Components;
+		};
+
+	} // namespace detail
+
+	template <typename T> struct ColumnElement<Vector2<T>> : detail::CompoundColumnElement<T, ColumnKind::Vector, 2> {};
+	template <typename T> struct ColumnElement<Vector3<T>> : detail::CompoundColumnElement<T, ColumnKind::Vector, 3> {};
+	template <typename T> struct ColumnElement<Vector4<T>> : detail::CompoundColumnElement<T, ColumnKind::Vector, 4> {};
+	template <typename T> struct ColumnElement<Color<T>> : detail::CompoundColumnElement<T, ColumnKind::Color, 4> {};
+
+	// Splitting compound elements into one column per component (structure of arrays). SIMD loops over a single
+	// component then read contiguous memory and touch only the pages they need.
+	template <typename T>
+	struct SoaTraits;
+
+	template <typename T>
+	struct SoaTraits<Vector2<T>>
+	{
+		static constexpr unsigned int components = 2;
+		static char const* suffix(unsigned int const i) noexcept { return i ? u8".y" : u8".x"; }
+		static T get(Vector2<T> const& v, unsigned int const i) noexcept { return i ? v.y : v.x; }
+		static Vector2<T> make(T const* const c) { return {c[0], c[1]}; }
+	};
+
+	template <typename T>
+	struct SoaTraits<Vector3<T>>
+	{
+		static constexpr unsigned int components = 3;
+		static char const* suffix(unsigned int const i) noexcept { return i == 0 ? u8".x" : i == 1 ? u8".y" : u8".z"; }
+		static T get(Vector3<T> const& v, unsigned int const i) noexcept { return i == 0 ? v.x : i == 1 ? v.y : v.z; }
+		static Vector3<T> make(T const* const c) { return {c[0], c[1], c[2]}; }
+	};
+
+	template <typename T>
+	struct SoaTraits<Vector4<T>>
+	{
+		static constexpr unsigned int components = 4;
+		static char const* suffix(unsigned int const i) noexcept { return i == 0 ? u8".x" : i == 1 ? u8".y" : i == 2 ? u8".z" : u8".w"; }
+		static T get(Vector4<T> const& v, unsigned int const i) noexcept { return i == 0 ? v.x : i == 1 ? v.y : i == 2 ? v.z : v.w; }
+		static Vector4<T> make(T const* const c) { return {c[0], c[1], c[2], c[3]}; }
+	};
+
+	template <typename T>
+	struct SoaTraits<Color<T>>
+	{
+		static constexpr unsigned int components = 4;
+		static char const* suffix(unsigned int const i) noexcept { return i == 0 ? u8".r" : i == 1 ? u8".g" : i == 2 ? u8".b" : u8".a"; }
+		static T get(Color<T> const& c, unsigned int const i) noexcept { return i == 0 ? c.r : i == 1 ? c.g : i == 2 ? c.b : c.a; }
+		static Color<T> make(T const* const c) { return {c[0], c[1], c[2], c[3]}; }
+	};
+
+	namespace detail
+	{
+
+		// On-disk layout, version 1, native byte order (checked by byte_order):
+		//   ColumnFileHeader at offset 0
+		//   column data, each column starting at a multiple of alignment
+		//   ColumnDescriptor[column_count] at directory_offset
+		struct ColumnFileHeader
+		{
+			char magic[8];
+			::std::uint32_t version;
+			::std::uint32_t byte_order;
+			::std::uint64_t directory_offset;
+			::std::uint32_t column_count;
+			::std::uint32_t alignment;
+		};
+
+		struct ColumnDescriptor
+		{
+			char name[48];
+			::std::uint32_t type;
+			::std::uint16_t kind;
+			::std::uint16_t components;
+			::std::uint64_t count;
+			::std::uint64_t offset;
+			::std::uint64_t element_size;
+		};
+
+		static_assert(sizeof(ColumnFileHeader) == 32 && sizeof(ColumnDescriptor) == 80, "column file structures must not contain padding");
+
+		constexpr char column_file_magic[8] = {'E', 'X', 'T', 'C', 'O', 'L', 'S', '\0'};
+		constexpr ::std::uint32_t column_file_version = 1;
+		constexpr ::std::uint32_t column_file_byte_order = 0x01020304;
+
+	} // namespace detail
+
+	// Writes a column file. Columns are written as they are added; finish() adds the directory and the header, so a
+	// file missing either was not finished and is rejected by ColumnFile.
+	class ColumnFileWriter
+	{
+	public:
+		// Truncates file. alignment is the boundary every column starts at; the page size lets readers madvise()
+		// columns separately.
+		explicit ColumnFileWriter(File& file, ::std::size_t const alignment = 4096) :
+			m_file(file),
+			m_alignment{alignment},
+			m_offset{detail::align_up(sizeof(detail::ColumnFileHeader), alignment)}
+		{
+			m_file.truncate(0);
+		}
+
+		ColumnFileWriter(ColumnFileWriter const&) = delete;
+		ColumnFileWriter& operator=(ColumnFileWriter const&) = delete;
+
+		// Stores values as one column of whole elements (array of structures).
+		template <typename T>
+		void add(::std::string const& name, Span<T const> const values)
+		{
+			using Element = ColumnElement<T>;
+			static_assert(sizeof(T) == sizeof(typename Element::Scalar) * Element::components, "element must not contain padding");
+
+			auto& column = begin_column(name, Element::type, Element::kind, Element::components, sizeof(T), values.size());
+			m_file.pwrite_all(values.data(), values.size_bytes(), static_cast<::off_t>(column.offset));
+			m_offset = column.offset + values.size_bytes();
+		}
+
+		template <typename T>
+		void add(::std::string const& name, ::std::vector<T> const& values) { add(name, Span<T const>{values.data(), values.size()}); }
+
+		// Stores each component of values as a scalar column named name + suffix, e.g. "position.x".
+		template <typename T>
+		void add_soa(::std::string const& name, Span<T const> const values)
+		{
+			using Traits = SoaTraits<T>;
+			using Scalar = typename ColumnElement<T>::Scalar;
+
+			::std::vector<Scalar> buffer(::std::min<::std::size_t>(values.size(), 64 * 1024));
+			for (unsigned int component = 0; component < Traits::components; ++component)
+			{
+				auto& column = begin_column(name + Traits::suffix(component), ColumnElement<Scalar>::type, ColumnKind::Scalar, 1, sizeof(Scalar), values.size());
+				::std::uint64_t offset = column.offset;
+				for (::std::size_t first = 0; first < values.size(); first += buffer.size())
+				{
+					::std::size_t const count = ::std::min(buffer.size(), values.size() - first);
+					for (::std::size_t i = 0; i < count; ++i)
+						buffer[i] = Traits::get(values[first + i], component);
+					m_file.pwrite_all(buffer.data(), count * sizeof(Scalar), static_cast<::off_t>(offset));
+					offset += count * sizeof(Scalar);
+				}
+				m_offset = offset;
+			}
+		}
+
+		template <typename T>
+		void add_soa(::std::string const& name, ::std::vector<T> const& values) { add_soa(name, Span<T const>{values.data(), values.size()}); }
+
+		// Writes the directory and the header. Call File::fdatasync() afterwards if the file must be durable.
+		void finish()
+		{
+			detail::ColumnFileHeader header;
+			::std::memcpy(header.magic, detail::column_file_magic, sizeof header.magic);
+			header.version = detail::column_file_version;
+			header.byte_order = detail::column_file_byte_order;
+			header.directory_offset = detail::align_up(m_offset, alignof(detail::ColumnDescriptor));
+			header.column_count = static_cast<::std::uint32_t>(m_columns.size());
+			header.alignment = static_cast<::std::uint32_t>(m_alignment);
+
+			m_file.pwrite_all(m_columns.data(), m_columns.size() * sizeof(detail::ColumnDescriptor), static_cast<::off_t>(header.directory_offset));
+			m_file.pwrite_all(&header, sizeof header, 0);
+		}
+
+	private:
+		detail::ColumnDescriptor& begin_column(::std::string const& name, ColumnType const type, ColumnKind const kind, unsigned int const components, ::std::size_t const element_size, ::std::size_t const count)
+		{
+			detail::ColumnDescriptor column;
+			::std::memset(&column, 0, sizeof column);
+			if (name.empty() || name.size() >= sizeof column.name)
+				throw ::std::invalid_argument{u8"ColumnFileWriter: column names must have 1 to 47 characters"};
+			for (auto const& other : m_columns)
+			{
+				if (name == other.name)
+					throw ::std::invalid_argument{u8"ColumnFileWriter: duplicate column name"};
+			}
+
+			::std::memcpy(column.name, name.data(), name.size());
+			column.type = static_cast<::std::uint32_t>(type);
+			column.kind = static_cast<::std::uint16_t>(kind);
+			column.components = static_cast<::std::uint16_t>(components);
+			column.count = count;
+			column.offset = detail::align_up(m_offset, m_alignment);
+			column.element_size = element_size;
+			m_columns.push_back(column);
+			return m_columns.back();
+		}
+
+		File& m_file;
+		::std::size_t const m_alignment;
+		::std::uint64_t m_offset;
+		::std::vector<detail::ColumnDescriptor> m_columns;
+	};
+
+	// Read-only view of a column file. Opening maps the file and validates the directory; no data is read or
+	// parsed, so it is effectively instant, and processes mapping the same file share its pages in the page cache.
+	class ColumnFile
+	{
+	public:
+		template <typename T>
+		struct SoaView
+		{
+			using Scalar = typename ColumnElement<T>::Scalar;
+
+			Span<Scalar const> columns[SoaTraits<T>::components];
+
+			::std::size_t size() const noexcept { return columns[0].size(); }
+
+			T operator[](::std::size_t const index) const
+			{
+				Scalar components[SoaTraits<T>::components];
+				for (unsigned int i = 0; i < SoaTraits<T>::components; ++i)
+					components[i] = columns[i][index];
+				return SoaTraits<T>::make(components);
+			}
+		};
+
+		explicit ColumnFile(char const* const path)
+		{
+			FilePtr file;
+			file->open(path, O_RDONLY | O_CLOEXEC, 0);
+			auto const size = static_cast<::std::size_t>(file->size());
+			if (size < sizeof(detail::ColumnFileHeader))
+				throw ::std::runtime_error{u8"ColumnFile: file too small"};
+			m_map->map(nullptr, size, PROT_READ, MAP_SHARED, file.get(), 0);
+
+			::std::memcpy(&m_header, m_map->data(), sizeof m_header);
+			if (::std::memcmp(m_header.magic, detail::column_file_magic, sizeof m_header.magic))
+				throw ::std::runtime_error{u8"ColumnFile: not a column file or not finished"};
+			if (m_header.version != detail::column_file_version)
+				throw ::std::runtime_error{u8"ColumnFile: unsupported version"};
+			if (m_header.byte_order != detail::column_file_byte_order)
+				throw ::std::runtime_error{u8"ColumnFile: written with a different byte order"};
+
+			m_columns = as_span<detail::ColumnDescriptor const>(*m_map.operator->(), static_cast<::std::size_t>(m_header.directory_offset), m_header.column_count);
+			for (auto const& column : m_columns)
+			{
+				if (!::std::memchr(column.name, '\0', sizeof column.name) || column.offset > size || column.element_size == 0 || column.count > (size - column.offset) / column.element_size)
+					throw ::std::runtime_error{u8"ColumnFile: corrupt column directory"};
+			}
+		}
+
+		ColumnFile(ColumnFile const&) = delete;
+		ColumnFile& operator=(ColumnFile const&) = delete;
+
+		MemoryMap const& map() const noexcept { return *m_map.operator->(); }
+		::std::size_t column_count() const noexcept { return m_columns.size(); }
+		char const* column_name(::std::size_t const index) const { return m_columns.at(index).name; }
+		bool has_column(::std::string const& name) const noexcept { return find(name) != nullptr; }
+
+		// The column written by ColumnFileWriter::add<T>(). Throws std::invalid_argument if it does not exist or holds
+		// a different type.
+		template <typename T>
+		Span<T const> column(::std::string const& name) const
+		{
+			using Element = ColumnElement<T>;
+
+			detail::ColumnDescriptor const* const column = find(name);
+			if (!column)
+				throw ::std::invalid_argument{u8"ColumnFile: no such column"};
+			if (column->type != static_cast<::std::uint32_t>(Element::type) || column->kind != static_cast<::std::uint16_t>(Element::kind) || column->components != Element::components || column->element_size != sizeof(T))
+				throw ::std::invalid_argument{u8"ColumnFile: column type mismatch"};
+			return as_span<T const>(map(), static_cast<::std::size_t>(column->offset), static_cast<::std::size_t>(column->count));
+		}
+
+		// The columns written by ColumnFileWriter::add_soa<T>().
+		template <typename T>
+		SoaView<T> soa(::std::string const& name) const
+		{
+			SoaView<T> view;
+			for (unsigned int i = 0; i < SoaTraits<T>::components; ++i)
+			{
+				view.columns[i] = column<typename ColumnElement<T>::Scalar>(name + SoaTraits<T>::suffix(i));
+				if (view.columns[i].size() != view.columns[0].size())
+					throw ::std::runtime_error{u8"ColumnFile: component columns differ in length"};
+			}
+			return view;
+		}
+
+	private:
+		detail::ColumnDescriptor const* find(::std::string const& name) const noexcept
+		{
+			for (auto const& column : m_columns)
+			{
+				if (name == column.name)
+					return &column;
+			}
+			return nullptr;
+		}
+
+		MemoryMapPtr m_map;
+		detail::ColumnFileHeader m_header;
+		Span<detail::ColumnDescriptor const> m_columns;
+	};
+
+} // namespace ext
+
+#endif // !HEADER_EXT_COLUMN_FILE_HPP_INCLUDED
@@ -0,0 +1,391 @@
+/*
+ * Copyright 2017 Mahdi Khanalizadeh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HEADER_EXT_CONCURRENT_QUEUE_HPP_INCLUDED
+#define HEADER_EXT_CONCURRENT_QUEUE_HPP_INCLUDED
+
+#include "cache_line.hpp"
+#include "futex.hpp"
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+#include <atomic>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace ext
+{
+
+	namespace detail
+	{
+
+		inline ::std::size_t queue_capacity(::std::size_t const requested) noexcept
+		{
+			::std::size_t capacity = 2;
+			while (capacity < requested)
+				capacity *= 2;
+			return capacity;
+		}
+
+		template <typename T>
+		class QueueStorage
+		{
+		public:
+			T* get() noexcept { return reinterpret_cast<T*>(&m_storage); }
+
+			template <typename... Args>
+			void construct(Args&&... args) { ::new (static_cast<void*>(&m_storage)) T(::std::forward<Args>(args)...); }
+
+			void move_to(T& out) noexcept
+			{
+				out = ::std::move(*get());
+				get()->~T();
+			}
+
+		private:
+			typename ::std::aligned_storage<sizeof(T), alignof(T)>::type m_storage;
+		};
+
+	} // namespace detail
+
+	// Bounded wait-free single producer single consumer ring. T needs a noexcept move assignment, which every
+	// Handle has. The capacity is rounded up to a power of two.
+	template <typename T>
+	class SpscQueue
+	{
+		static_assert(::std::is_nothrow_move_assignable<T>::value, "T must be nothrow move assignable");
+		static_assert(::std::is_nothrow_destructible<T>::value, "T must be nothrow destructible");
+
+	public:
+		explicit SpscQueue(::std::size_t const capacity) :
+			m_mask{detail::queue_capacity(capacity) - 1},
+			m_slots{new detail::QueueStorage<T>[m_mask + 1]}
+		{
+		}
+
+		~SpscQueue() noexcept
+		{
+			for (::std::size_t i = m_head.load(::std::memory_order_relaxed); i != m_tail.load(::std::memory_order_relaxed); ++i)
+				m_slots[i & m_mask].get()->~T();
+		}
+
+		SpscQueue(SpscQueue const&) = delete;
+		SpscQueue& operator=(SpscQueue const&) = delete;
+
+		::std::size_t capacity() const noexcept { return m_mask + 1; }
+
+		// Approximate when called concurrently.
+		::std::size_t size() const noexcept { return m_tail.load(::std::memory_order_acquire) - m_head.load(::std::memory_order_acquire); }
+		bool empty() const noexcept { return !size(); }
+
+		// Producer only. Returns false and leaves the arguments untouched if the queue is full.
+		template <typename... Args>
+		bool try_emplace(Args&&... args)
+		{
+			::std::size_t const tail = m_tail.load(::std::memory_order_relaxed);
+			if (tail - m_cached_head == capacity())
+			{
+				m_cached_head = m_head.load(::std::memory_order_acquire);
+				if (tail - m_cached_head == capacity())
+					return false;
+			}
+
+			m_slots[tail & m_mask].construct(::std::forward<Args>(args)...);
+			m_tail.store(tail + 1, ::std::memory_order_release);
+			m_not_empty.notify_all();
+			return true;
+		}
+
+		bool try_push(T const& item) { return try_emplace(item); }
+		bool try_push(T&& item) { return try_emplace(::std::move(item)); }
+
+		// Producer only. Moves up to count items out of items and returns how many were pushed.
+		::std::size_t try_push(T* const items, ::std::size_t const count)
+		{
+			::std::size_t const tail = m_tail.load(::std::memory_order_relaxed);
+			if (capacity() - (tail - m_cached_head) < count)
+				m_cached_head = m_head.load(::std::memory_order_acquire);
+
+			::std::size_t const free = capacity() - (tail - m_cached_head);
+			::std::size_t const n = free < count ? free : count;
+			for (::std::size_t i = 0; i < n; ++i)
+				m_slots[(tail + i) & m_mask].construct(::std::move(items[i]));
+			if (n)
+			{
+				m_tail.store(tail + n, ::std::memory_order_release);
+				m_not_empty.notify_all();
+			}
+			return n;
+		}
+
+		// Producer only. Blocks while the queue is full.
+		void push(T item)
+		{
+			m_not_full.wait([&]{ return try_push(::std::move(item)); });
+		}
+
+		// Consumer only. Returns false if the queue is empty.
+		bool try_pop(T& out) noexcept
+		{
+			::std::size_t const head = m_head.load(::std::memory_order_relaxed);
+			if (head == m_cached_tail)
+			{
+				m_cached_tail = m_tail.load(::std::memory_order_acquire);
+				if (head == m_cached_tail)
+					return false;
+			}
+
+			m_slots[head & m_mask].move_to(out);
+			m_head.store(head + 1, ::std::memory_order_release);
+			m_not_full.notify_all();
+			return true;
+		}
+
+		// Consumer only. Moves up to count items into out and returns how many were popped.
+		::std::size_t try_pop(T* const out, ::std::size_t const count) noexcept
+		{
+			::std::size_t const head = m_head.load(::std::memory_order_relaxed);
+			if (m_cached_tail - head < count)
+				m_cached_tail = m_tail.load(::std::memory_order_acquire);
+
+			::std::size_t const available = m_cached_tail - head;
+			::std::size_t const n = available < count ? available : count;
+			for (::std::size_t i = 0; i < n; ++i)
+				m_slots[(head + i) & m_mask].move_to(out[i]);
+			if (n)
+			{
+				m_head.store(head + n, ::std::memory_order_release);
+				m_not_full.notify_all();
+			}
+			return n;
+		}
+
+		// Consumer only. Blocks while the queue is empty.
+		void pop(T& out) noexcept
+		{
+			m_not_empty.wait([&]{ return try_pop(out); });
+		}
+
+		// Consumer only. Blocks until at least one item is available.
+		::std::size_t pop(T* const out, ::std::size_t const count) noexcept
+		{
+			::std::size_t n = 0;
+			m_not_empty.wait([&]{ return (n = try_pop(out, count)) != 0; });
+			return n;
+		}
+
+	private:
+		::std::size_t const m_mask;
+		::std::unique_ptr<detail::QueueStorage<T>[]> m_slots;
+
+		char m_padding0[cache_line_size];
+		::std::atomic<::std::size_t> m_head{0};
+		::std::size_t m_cached_tail = 0; // consumer's view of m_tail
+		EventCount m_not_full;
+
+		char m_padding1[cache_line_size];
+		::std::atomic<::std::size_t> m_tail{0};
+		::std::size_t m_cached_head = 0; // producer's view of m_head
+		EventCount m_not_empty;
+
+		char m_padding2[cache_line_size];
+	};
+
+	// Bounded multi producer multi consumer queue after Dmitry Vyukov: every slot carries a sequence number that
+	// tells producers and consumers whether it is their turn, so the only contended writes are the two indices.
+	// Items are constructed in slots that are already claimed, where a throwing constructor would leave the slot
+	// unpublished and stall the queue for good, so they must be constructed without exceptions.
+	template <typename T>
+	class MpmcQueue
+	{
+		static_assert(::std::is_nothrow_move_constructible<T>::value, "T must be nothrow move constructible");
+		static_assert(::std::is_nothrow_move_assignable<T>::value, "T must be nothrow move assignable");
+		static_assert(::std::is_nothrow_destructible<T>::value, "T must be nothrow destructible");
+
+	public:
+		explicit MpmcQueue(::std::size_t const capacity) :
+			m_mask{detail::queue_capacity(capacity) - 1},
+			m_slots{new Slot[m_mask + 1]}
+		{
+			for (::std::size_t i = 0; i <= m_mask; ++i)
+				m_slots[i].sequence.store(i, ::std::memory_order_relaxed);
+		}
+
+		~MpmcQueue() noexcept
+		{
+			for (::std::size_t i = m_head.load(::std::memory_order_relaxed); i != m_tail.load(::std::memory_order_relaxed); ++i)
+				m_slots[i & m_mask].storage.get()->~T();
+		}
+
+		MpmcQueue(MpmcQueue const&) = delete;
+		MpmcQueue& operator=(MpmcQueue const&) = delete;
+
+		::std::size_t capacity() const noexcept { return m_mask + 1; }
+
+		// Approximate when called concurrently.
+		::std::size_t size() const noexcept
+		{
+			::std::size_t const head = m_head.load(::std::memory_order_acquire);
+			::std::size_t const tail = m_tail.load(::std::memory_order_acquire);
+			return tail > head ? tail - head : 0;
+		}
+		bool empty() const noexcept { return !size(); }
+
+		// Returns false and leaves the arguments untouched if the queue is full.
+		template <typename... Args>
+		bool try_emplace(Args&&... args)
+		{
+			static_assert(::std::is_nothrow_constructible<T, Args&&...>::value, "construct the item first and push it by move");
+
+			::std::size_t position;
+			if (!claim(m_tail, 0, 1, position))
+				return false;
+
+			Slot& slot = m_slots[position & m_mask];
+			slot.storage.construct(::std::forward<Args>(args)...);
+			slot.sequence.store(position + 1, ::std::memory_order_release);
+			m_not_empty.notify_all();
+			return true;
+		}
+
+		bool try_push(T const& item) { return try_emplace(item); }
+		bool try_push(T&& item) { return try_emplace(::std::move(item)); }
+
+		// Moves up to count items out of items with a single index update and returns how many were pushed.
+		::std::size_t try_push(T* const items, ::std::size_t const count)
+		{
+			::std::size_t position;
+			::std::size_t const n = claim(m_tail, 0, count, position);
+			for (::std::size_t i = 0; i < n; ++i)
+			{
+				Slot& slot = m_slots[(position + i) & m_mask];
+				slot.storage.construct(::std::move(items[i]));
+				slot.sequence.store(position + i + 1, ::std::memory_order_release);
+			}
+			if (n)
+				m_not_empty.notify_all();
+			return n;
+		}
+
+		// Blocks while the queue is full.
+		void push(T item)
+		{
+			m_not_full.wait([&]{ return try_push(::std::move(item)); });
+		}
+
+		// Returns false if the queue is empty.
+		bool try_pop(T& out) noexcept
+		{
+			::std::size_t position;
+			if (!claim(m_head, 1, 1, position))
+				return false;
+
+			Slot& slot = m_slots[position & m_mask];
+			slot.storage.move_to(out);
+			slot.sequence.store(position + m_mask + 1, ::std::memory_order_release);
+			m_not_full.notify_all();
+			return true;
+		}
+
+		// Moves up to count items into out with a single index update and returns how many were popped.
+		::std::size_t try_pop(T* const out, ::std::size_t const count) noexcept
+		{
+			::std::size_t position;
+			::std::size_t const n = claim(m_head, 1, count, position);
+			for (::std::size_t i = 0; i < n; ++i)
+			{
+				Slot& slot = m_slots[(position + i) & m_mask];
+				slot.storage.move_to(out[i]);
+				slot.sequence.store(position + i + m_mask + 1, ::std::memory_order_release);
+			}
+			if (n)
+				m_not_full.notify_all();
+			return n;
+		}
+
+		// Blocks while the queue is empty.
+		void pop(T& out) noexcept
+		{
+			m_not_empty.wait([&]{ return try_pop(out); });
+		}
+
+		// Blocks until at least one item is available.
+		::std::size_t pop(T* const out, ::std::size_t const count) noexcept
+		{
+			::std::size_t n = 0;
+			m_not_empty.wait([&]{ return (n = try_pop(out, count)) != 0; });
+			return n;
+		}
+
+	private:
+		struct Slot
+		{
+			::std::atomic<::std::size_t> sequence;
+			detail::QueueStorage<T> storage;
+		};
+
+		// Claims up to count consecutive slots whose sequence equals their position plus ready. A slot that is ready
+		// cannot become unready until it is claimed, so checking the run first and then advancing the index with one
+		// CAS is safe. Returns the number of slots claimed and their first position.
+		::std::size_t claim(::std::atomic<::std::size_t>& index, ::std::size_t const ready, ::std::size_t const count, ::std::size_t& position) noexcept
+		{
+			position = index.load(::std::memory_order_relaxed);
+			for (;;)
+			{
+				::std::size_t n = 0;
+				for (; n < count; ++n)
+				{
+					::std::size_t const sequence = m_slots[(position + n) & m_mask].sequence.load(::std::memory_order_acquire);
+					if (sequence != position + n + ready)
+						break;
+				}
+
+				if (!n)
+				{
+					::std::size_t const sequence = m_slots[position & m_mask].sequence.load(::std::memory_order_acquire);
+					auto const difference = static_cast<::std::ptrdiff_t>(sequence - (position + ready));
+					if (difference < 0)
+						return 0; // full for producers, empty for consumers
+					position = index.load(::std::memory_order_relaxed); // somebody else took it
+					continue;
+				}
+
+				if (index.compare_exchange_weak(position, position + n, ::std::memory_order_relaxed, ::std::memory_order_relaxed))
+					return n;
+			}
+		}
+
+		::std::size_t const m_mask;
+		::std::unique_ptr<Slot[]> m_slots;
+
+		char m_padding0[cache_line_size];
+		::std::atomic<::std::size_t> m_tail{0};
+		EventCount m_not_empty;
+
+		char m_padding1[cache_line_size];
+		::std::atomic<::std::size_t> m_head{0};
+		EventCount m_not_full;
+
+		char m_padding2[cache_line_size];
+	};
+
+} // namespace ext
+
+#endif // !HEADER_EXT_CONCURRENT_QUEUE_HPP_INCLUDED
@@ -19,7 +19,40 @@
 
 #ifdef __cplusplus
 extern "C"
+{
 #endif // __cplusplus
+
+/*
+ * Number of processors installed in the system. Returns 0 on failure.
+ */
 unsigned int ext_num_cores(void);
 
+/*
+ * Number of processors this process can actually keep busy. On Linux this is
+ * the minimum of the scheduler affinity mask, the cgroup cpuset and the cgroup
+ * (v1 or v2) CPU bandwidth quota rounded up. Never returns 0.
+ */
+unsigned int ext_num_effective_cores(void);
+
+typedef void (*ext_cores_listener)(unsigned int cores, void* data);
+
+/*
+ * Registers a listener that is called from ext_poll_effective_cores() whenever
+ * the effective number of cores changed since the last poll. Returns 0 on
+ * success and -1 if the listener table is full.
+ */
+int ext_add_cores_listener(ext_cores_listener listener, void* data);
+void ext_remove_cores_listener(ext_cores_listener listener, void* data);
+
+/*
+ * Recomputes the effective number of cores, notifies the registered listeners
+ * if it changed and returns it. Cgroup limits cannot be watched reliably, so
+ * callers are expected to poll this periodically (e.g. once per second).
+ */
+unsigned int ext_poll_effective_cores(void);
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+
 #endif // !HEADER_EXT_CORES_H_INCLUDED
@@ -0,0 +1,81 @@
+/*
+ * Copyright 2017 Mahdi Khanalizadeh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef HEADER_EXT_CRC32C_HPP_INCLUDED
+#define HEADER_EXT_CRC32C_HPP_INCLUDED
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+
+namespace ext
+{
+
+	namespace detail
+	{
+
+		struct Crc32cTable
+		{
+			Crc32cTable() noexcept
+			{
+				for (::std::uint32_t i = 0; i < 256; ++i)
+				{
+					::std::uint32_t crc = i;
+					for (int bit = 0; bit < 8; ++bit)
+						crc = crc & 1 ? (crc >> 1) ^ 0x82f63b78u : crc >> 1; // reflected Castagnoli polynomial
+					entries[i] = crc;
+				}
+			}
+
+			::std::uint32_t entries[256];
+		};
+
+	} // namespace detail
+
+	// CRC-32C (Castagnoli), the checksum of iSCSI, ext4 metadata and most storage formats. Uses the SSE4.2 crc32
+	// instruction when compiled for it and a table otherwise. Pass the previous result as crc to checksum data in
+	// pieces; start with 0.
+	inline ::std::uint32_t crc32c(::std::uint32_t crc, void const* const data, ::std::size_t size) noexcept
+	{
+		auto const* bytes = static_cast<unsigned char const*>(data);
+		crc = ~crc;
+
+#if defined(__SSE4_2__)
+		for (; size >= 8; size -= 8, bytes += 8)
+		{
+			::std::uint64_t word;
+			::std::memcpy(&word, bytes, sizeof word);
+			crc = static_cast<::std::uint32_t>(_mm_crc32_u64(crc, word));
+		}
+		for (; size; --size)
+			crc = _mm_crc32_u8(crc, *bytes++);
+#else
+		static detail::Crc32cTable const table;
+		for (; size; --size)
+			crc = table.entries[(crc ^ *bytes++) & 0xff] ^ (crc >> 8);
+#endif
+
+		return ~crc;
+	}
+
+} // namespace ext
+
+#endif // !HEADER_EXT_CRC32C_HPP_INCLUDED
@@ -21,12 +21,23 @@
 
 #include <cassert>
 #include <cerrno>
+#include <climits>
 #include <cstddef>
+#include <cstdint>
 
+#include <algorithm>
+#include <initializer_list>
 #include <system_error>
+#include <vector>
 
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #include <unistd.h>
 
@@ -43,8 +54,45 @@ namespace ext
 			static void destroy(RawHandle const& handle) noexcept { ::close(handle); }
 		};
 
+#ifdef IOV_MAX
+		constexpr int max_iovecs = IOV_MAX;
+#else
+		constexpr int max_iovecs = 1024;
+#endif
+
+		// Drops the first count bytes from an iovec array after a partial transfer. Entries that were transferred
+		// completely are left empty, so the caller's array tells what is left.
+		inline void advance(::iovec*& iov, int& iovcnt, ::std::size_t count) noexcept
+		{
+			while (iovcnt && count >= iov->iov_len)
+			{
+				count -= iov->iov_len;
+				iov->iov_base = static_cast<char*>(iov->iov_base) + iov->iov_len;
+				iov->iov_len = 0;
+				++iov;
+				--iovcnt;
+			}
+			if (iovcnt)
+			{
+				iov->iov_base = static_cast<char*>(iov->iov_base) + count;
+				iov->iov_len -= count;
+			}
+		}
+
 	} // namespace detail
 
+	// Alignment O_DIRECT requires of buffer addresses and of file offsets and transfer sizes.
+	struct DirectIoAlignment
+	{
+		::std::size_t memory;
+		::std::size_t offset;
+
+		bool fits(void const* const buffer, ::std::size_t const count, ::off_t const position) const noexcept
+		{
+			return reinterpret_cast<::std::uintptr_t>(buffer) % memory == 0 && count % offset == 0 && static_cast<::std::uintmax_t>(position) % offset == 0;
+		}
+	};
+
 	class File :
 		public Handle<detail::FileTraits>
 	{
@@ -60,6 +108,25 @@ namespace ext
 				throw ::std::system_error{errno, ::std::system_category(), u8"open"};
 		}
 
+		void open(char const* const path_name, int const flags, mode_t const mode, ::std::error_code& ec) noexcept
+		{
+			assert(raw_handle() == Traits::invalid());
+
+			m_raw_handle = ::open(path_name, flags, mode);
+			set_error(ec, raw_handle() == Traits::invalid());
+		}
+
+		// Creates an anonymous file that lives in memory (Linux 3.17). name only shows up in /proc/self/fd. Size it
+		// with truncate(); it can be mapped like any other file, also several times and by other processes.
+		void memfd_create(char const* const name, unsigned int const flags = MFD_CLOEXEC)
+		{
+			assert(raw_handle() == Traits::invalid());
+
+			m_raw_handle = ::memfd_create(name, flags);
+			if (raw_handle() == Traits::invalid())
+				throw ::std::system_error{errno, ::std::system_category(), u8"memfd_create"};
+		}
+
 		void close()
 		{
 			assert(raw_handle() != Traits::invalid());
@@ -70,6 +137,15 @@ namespace ext
 			m_raw_handle = Traits::invalid();
 		}
 
+		void close(::std::error_code& ec) noexcept
+		{
+			assert(raw_handle() != Traits::invalid());
+
+			// The descriptor is gone even if close() fails, so never retry it.
+			set_error(ec, ::close(raw_handle()) == -1);
+			m_raw_handle = Traits::invalid();
+		}
+
 		void truncate(off_t const length)
 		{
 			assert(raw_handle() != Traits::invalid());
@@ -78,6 +154,13 @@ namespace ext
 				throw ::std::system_error{errno, ::std::system_category(), u8"ftruncate"};
 		}
 
+		void truncate(off_t const length, ::std::error_code& ec) noexcept
+		{
+			assert(raw_handle() != Traits::invalid());
+
+			set_error(ec, ::ftruncate(raw_handle(), length) == -1);
+		}
+
 		::off_t lseek(::off_t const offset, int const whence)
 		{
 			assert(raw_handle() != Traits::invalid());
@@ -88,6 +171,15 @@ namespace ext
 			return ret;
 		}
 
+		::off_t lseek(::off_t const offset, int const whence, ::std::error_code& ec) noexcept
+		{
+			assert(raw_handle() != Traits::invalid());
+
+			auto const ret = ::lseek(raw_handle(), offset, whence);
+			set_error(ec, ret == static_cast<::off_t>(-1));
+			return ret;
+		}
+
 		::std::size_t read(void* const buffer, ::std::size_t const count)
 		{
 			assert(raw_handle() != Traits::invalid());
@@ -98,6 +190,16 @@ namespace ext
 			return static_cast<::std::size_t>(ret);
 		}
 
+		// Returns 0 and sets ec on failure, which avoids the cost of an exception for expected errors like EAGAIN.
+		::std::size_t read(void* const buffer, ::std::size_t const count, ::std::error_code& ec) noexcept
+		{
+			assert(raw_handle() != Traits::invalid());
+
+			auto const ret = ::read(raw_handle(), buffer, count);
+			set_error(ec, ret == -1);
+			return ret == -1 ? 0 : static_cast<::std::size_t>(ret);
+		}
+
 		::std::size_t pread(void* const buffer, ::std::size_t const count, ::off_t const offset)
 		{
 			assert(raw_handle() != Traits::invalid());
@@ -108,6 +210,15 @@ namespace ext
 			return static_cast<::std::size_t>(ret);
 		}
 
+		::std::size_t pread(void* const buffer, ::std::size_t const count, ::off_t const offset, ::std::error_code& ec) noexcept
+		{
+			assert(raw_handle() != Traits::invalid());
+
+			auto const ret = ::pread(raw_handle(), buffer, count, offset);
+			set_error(ec, ret == -1);
+			return ret == -1 ? 0 : static_cast<::std::size_t>(ret);
+		}
+
 		::std::size_t write(void const* const buffer, ::std::size_t const count)
 		{
 			assert(raw_handle() != Traits::invalid());
@@ -118,6 +229,15 @@ namespace ext
 			return static_cast<::std::size_t>(ret);
 		}
 
+		::std::size_t write(void const* const buffer, ::std::size_t const count, ::std::error_code& ec) noexcept
+		{
+			assert(raw_handle() != Traits::invalid());
+
+			auto const ret = ::write(raw_handle(), buffer, count);
+			set_error(ec, ret == -1);
+			return ret == -1 ? 0 : static_cast<::std::size_t>(ret);
+		}
+
 		::std::size_t pwrite(void const* const buffer, ::std::size_t const count, ::off_t const offset)
 		{
 			assert(raw_handle() != Traits::invalid());
@@ -127,6 +247,807 @@ namespace ext
 				throw ::std::system_error{errno, ::std::system_category(), u8"pwrite"};
 			return static_cast<::std::size_t>(ret);
 		}
+
+		::std::size_t pwrite(void const* const buffer, ::std::size_t const count, ::off_t const offset, ::std::error_code& ec) noexcept
+		{
+			assert(raw_handle() != Traits::invalid());
+
+			auto const ret = ::pwrite(raw_handle(), buffer, count, offset);
+			set_error(ec, ret == -1);
+			return ret == -1 ? 0 : static_cast<::std::size_t>(ret);
+		}
+
+		// The following functions transfer exactly count bytes, resuming short transfers and retrying EINTR. A read
+		// that hits the end of the file first fails with EIO. The error_code overloads return the number of bytes
+		// transferred, which is only less than count on failure.
+		void read_exact(void* const buffer, ::std::size_t const count)
+		{
+			::std::error_code ec;
+			read_exact(buffer, count, ec);
+			if (ec)
+				throw ::std::system_error{ec, u8"read_exact"};
+		}
+
+		void write_all(void const* const buffer, ::std::size_t const count)
+		{
+			::std::error_code ec;
+			write_all(buffer, count, ec);
+			if (ec)
+				throw ::std::system_error{ec, u8"write_all"};
+		}
+
+		void pread_exact(void* const buffer, ::std::size_t const count, ::off_t const offset)
+		{
+			::std::error_code ec;
+			pread_exact(buffer, count, offset, ec);
+			if (ec)
+				throw ::std::system_error{ec, u8"pread_exact"};
+		}
+
+		void pwrite_all(void const* const buffer, ::std::size_t const count, ::off_t const offset)
+		{
+			::std::error_code ec;
+			pwrite_all(buffer, count, offset, ec);
+			if (ec)
+				throw ::std::system_error{ec, u8"pwrite_all"};
+		}
+
+		::std::size_t read_exact(void* const buffer, ::std::size_t const count, ::std::error_code& ec) noexcept
+		{
+			return exact(static_cast<char*>(buffer), count, ec, [this](char* const data, ::std::size_t const size, ::std::size_t) { return ::read(raw_handle(), data, size); });
+		}
+
+		::std::size_t write_all(void const* const buffer, ::std::size_t const count, ::std::error_code& ec) noexcept
+		{
+			return exact(static_cast<char const*>(buffer), count, ec, [this](char const* const data, ::std::size_t const size, ::std::size_t) { return ::write(raw_handle(), data, size); });
+		}
+
+		::std::size_t pread_exact(void* const buffer, ::std::size_t const count, ::off_t const offset, ::std::error_code& ec) noexcept
+		{
+			return exact(static_cast<char*>(buffer), count, ec, [this, offset](char* const data, ::std::size_t const size, ::std::size_t const done) { return ::pread(raw_handle(), data, size, offset + static_cast<::off_t>(done)); });
+		}
+
+		::std::size_t pwrite_all(void const* const buffer, ::std::size_t const count, ::off_t const offset, ::std::error_code& ec) noexcept
+		{
+			return exact(static_cast<char const*>(buffer), count, ec, [this, offset](char const* const data, ::std::size_t const size, ::std::size_t const done) { return ::pwrite(raw_handle(), data, size, offset + static_cast<::off_t>(done)); });
+		}
+
+		// Scatter/gather I/O. iovcnt must not exceed IOV_MAX; the *_all variants below lift that limit.
+		::std::size_t readv(::iovec const* const iov, int const iovcnt)
+		{
+			assert(raw_handle() != Traits::invalid());
+
+			auto const ret = ::readv(raw_handle(), iov, iovcnt);
+			if (ret == -1)
+				throw ::std::system_error{errno, ::std::system_category(), u8"readv"};
+			return static_cast<::std::size_t>(ret);
+		}
+
+		::std::size_t readv(::iovec const* const iov, int const iovcnt, ::std::error_code& ec) noexcept
+		{
+			assert(raw_handle() != Traits::invalid());
+
+			auto const ret = ::readv(raw_handle(), iov, iovcnt);
+			set_error(ec, ret == -1);
+			return ret == -1 ? 0 : static_cast<::std::size_t>(ret);
+		}
+
+		::std::size_t writev(::iovec const* const iov, int const iovcnt)
+		{
+			assert(raw_handle() != Traits::invalid());
+
+			auto const ret = ::writev(raw_handle(), iov, iovcnt);
+			if (ret == -1)
+				throw ::std::system_error{errno, ::std::system_category(), u8"writev"};
+			return static_cast<::std::size_t>(ret);
+		}
+
+		::std::size_t writev(::iovec const* const iov, int const iovcnt, ::std::error_code& ec) noexcept
+		{
+			assert(raw_handle() != Traits::invalid());
+
+			auto const ret = ::writev(raw_handle(), iov, iovcnt);
+			set_error(ec, ret == -1);
+			return ret == -1 ? 0 : static_cast<::std::size_t>(ret);
+		}
+
+		::std::size_t preadv(::iovec const* const iov, int const iovcnt, ::off_t const offset)
+		{
+			assert(raw_handle() != Traits::invalid());
+
+			auto const ret = ::preadv(raw_handle(), iov, iovcnt, offset);
+			if (ret == -1)
+				throw ::std::system_error{errno, ::std::system_category(), u8"preadv"};
+			return static_cast<::std::size_t>(ret);
+		}
+
+		::std::size_t preadv(::iovec const* const iov, int const iovcnt, ::off_t const offset, ::std::error_code& ec) noexcept
+		{
+			assert(raw_handle() != Traits::invalid());
+
+			auto const ret = ::preadv(raw_handle(), iov, iovcnt, offset);
+			set_error(ec, ret == -1);
+			return ret == -1 ? 0 : static_cast<::std::size_t>(ret);
+		}
+
+		::std::size_t pwritev(::iovec const* const iov, int const iovcnt, ::off_t const offset)
+		{
+			assert(raw_handle() != Traits::invalid());
+
+			auto const ret = ::pwritev(raw_handle(), iov, iovcnt, offset);
+			if (ret == -1)
+				throw ::std::system_error{errno, ::std::system_category(), u8"pwritev"};
+			return static_cast<::std::size_t>(ret);
+		}
+
+		::std::size_t pwritev(::iovec const* const iov, int const iovcnt, ::off_t const offset, ::std::error_code& ec) noexcept
+		{
+			assert(raw_handle() != Traits::invalid());
+
+			auto const ret = ::pwritev(raw_handle(), iov, iovcnt, offset);
+			set_error(ec, ret == -1);
+			return ret == -1 ? 0 : static_cast<::std::size_t>(ret);
+		}
+
+		// flags is a combination of RWF_HIPRI, RWF_DSYNC, RWF_SYNC, RWF_NOWAIT and RWF_APPEND. An offset of -1 uses
+		// and updates the file position.
+		::std::size_t preadv2(::iovec const* const iov, int const iovcnt, ::off_t const offset, int const flags)
+		{
+			assert(raw_handle() != Traits::invalid());
+
+			auto const ret = ::preadv2(raw_handle(), iov, iovcnt, offset, flags);
+			if (ret == -1)
+				throw ::std::system_error{errno, ::std::system_category(), u8"preadv2"};
+			return static_cast<::std::size_t>(ret);
+		}
+
+		// With RWF_NOWAIT, data that is not cached fails with EAGAIN instead of blocking; the error_code overloads
+		// make that cheap to test for.
+		::std::size_t preadv2(::iovec const* const iov, int const iovcnt, ::off_t const offset, int const flags, ::std::error_code& ec) noexcept
+		{
+			assert(raw_handle() != Traits::invalid());
+
+			auto const ret = ::preadv2(raw_handle(), iov, iovcnt, offset, flags);
+			set_error(ec, ret == -1);
+			return ret == -1 ? 0 : static_cast<::std::size_t>(ret);
+		}
+
+		::std::size_t pwritev2(::iovec const* const iov, int const iovcnt, ::off_t const offset, int const flags)
+		{
+			assert(raw_handle() != Traits::invalid());
+
+			auto const ret = ::pwritev2(raw_handle(), iov, iovcnt, offset, flags);
+			if (ret == -1)
+				throw ::std::system_error{errno, ::std::system_category(), u8"pwritev2"};
+			return static_cast<::std::size_t>(ret);
+		}
+
+		::std::size_t pwritev2(::iovec const* const iov, int const iovcnt, ::off_t const offset, int const flags, ::std::error_code& ec) noexcept
+		{
+			assert(raw_handle() != Traits::invalid());
+
+			auto const ret = ::pwritev2(raw_handle(), iov, iovcnt, offset, flags);
+			set_error(ec, ret == -1);
+			return ret == -1 ? 0 : static_cast<::std::size_t>(ret);
+		}
+
+		// The following functions resume after partial transfers and EINTR until every buffer was transferred or,
+		// for reads, the end of the file was reached. They consume iov: on return, or when they throw, it describes
+		// what is left. An offset of -1 uses and updates the file position. Returns the number of bytes transferred.
+		::std::size_t preadv_all(::iovec* iov, int iovcnt, ::off_t const offset = -1, int const flags = 0)
+		{
+			return transfer_all(iov, iovcnt, offset, flags, false);
+		}
+
+		::std::size_t pwritev_all(::iovec* iov, int iovcnt, ::off_t const offset = -1, int const flags = 0)
+		{
+			return transfer_all(iov, iovcnt, offset, flags, true);
+		}
+
+		// For the common header/payload/trailer case: f.pwritev_all({{&header, sizeof header}, {data, size}}, offset)
+		::std::size_t pwritev_all(::std::initializer_list<::iovec> const buffers, ::off_t const offset = -1, int const flags = 0)
+		{
+			return transfer_all(buffers, offset, flags, true);
+		}
+
+		::std::size_t preadv_all(::std::initializer_list<::iovec> const buffers, ::off_t const offset = -1, int const flags = 0)
+		{
+			return transfer_all(buffers, offset, flags, false);
+		}
+
+		// Kernel side copies. Offsets passed as nullptr use and update the file position.
+		::std::size_t copy_file_range(::off_t* const in_offset, File& out, ::off_t* const out_offset, ::std::size_t const count, unsigned int const flags = 0)
+		{
+			assert(raw_handle() != Traits::invalid());
+			assert(out.raw_handle() != Traits::invalid());
+
+			auto const ret = ::copy_file_range(raw_handle(), in_offset, out.raw_handle(), out_offset, count, flags);
+			if (ret == -1)
+				throw ::std::system_error{errno, ::std::system_category(), u8"copy_file_range"};
+			return static_cast<::std::size_t>(ret);
+		}
+
+		::std::size_t copy_file_range(::off_t* const in_offset, File& out, ::off_t* const out_offset, ::std::size_t const count, unsigned int const flags, ::std::error_code& ec) noexcept
+		{
+			assert(raw_handle() != Traits::invalid());
+			assert(out.raw_handle() != Traits::invalid());
+
+			auto const ret = ::copy_file_range(raw_handle(), in_offset, out.raw_handle(), out_offset, count, flags);
+			set_error(ec, ret == -1);
+			return ret == -1 ? 0 : static_cast<::std::size_t>(ret);
+		}
+
+		// Writes to out at its current file position.
+		::std::size_t sendfile(File& out, ::off_t* const in_offset, ::std::size_t const count)
+		{
+			assert(raw_handle() != Traits::invalid());
+			assert(out.raw_handle() != Traits::invalid());
+
+			auto const ret = ::sendfile(out.raw_handle(), raw_handle(), in_offset, count);
+			if (ret == -1)
+				throw ::std::system_error{errno, ::std::system_category(), u8"sendfile"};
+			return static_cast<::std::size_t>(ret);
+		}
+
+		::std::size_t sendfile(File& out, ::off_t* const in_offset, ::std::size_t const count, ::std::error_code& ec) noexcept
+		{
+			assert(raw_handle() != Traits::invalid());
+			assert(out.raw_handle() != Traits::invalid());
+
+			auto const ret = ::sendfile(out.raw_handle(), raw_handle(), in_offset, count);
+			set_error(ec, ret == -1);
+			return ret == -1 ? 0 : static_cast<::std::size_t>(ret);
+		}
+
+		// One side must be a pipe.
+		::std::size_t splice(::loff_t* const in_offset, File& out, ::loff_t* const out_offset, ::std::size_t const count, unsigned int const flags = 0)
+		{
+			assert(raw_handle() != Traits::invalid());
+			assert(out.raw_handle() != Traits::invalid());
+
+			auto const ret = ::splice(raw_handle(), in_offset, out.raw_handle(), out_offset, count, flags);
+			if (ret == -1)
+				throw ::std::system_error{errno, ::std::system_category(), u8"splice"};
+			return static_cast<::std::size_t>(ret);
+		}
+
+		::std::size_t splice(::loff_t* const in_offset, File& out, ::loff_t* const out_offset, ::std::size_t const count, unsigned int const flags, ::std::error_code& ec) noexcept
+		{
+			assert(raw_handle() != Traits::invalid());
+			assert(out.raw_handle() != Traits::invalid());
+
+			auto const ret = ::splice(raw_handle(), in_offset, out.raw_handle(), out_offset, count, flags);
+			set_error(ec, ret == -1);
+			return ret == -1 ? 0 : static_cast<::std::size_t>(ret);
+		}
+
+		// Shares the extents of [in_offset, in_offset + count) with out (reflink). Only some file systems support it.
+		void clone_range(::off_t const in_offset, File& out, ::off_t const out_offset, ::std::size_t const count)
+		{
+			assert(raw_handle() != Traits::invalid());
+			assert(out.raw_handle() != Traits::invalid());
+
+			::file_clone_range range;
+			range.src_fd = raw_handle();
+			range.src_offset = static_cast<__u64>(in_offset);
+			range.src_length = count;
+			range.dest_offset = static_cast<__u64>(out_offset);
+			if (::ioctl(out.raw_handle(), FICLONERANGE, &range) == -1)
+				throw ::std::system_error{errno, ::std::system_category(), u8"FICLONERANGE"};
+		}
+
+		// Offset of the next data at or after offset, or -1 if only a hole follows up to the end of the file. File
+		// systems without hole tracking report all of the file as data.
+		::off_t seek_data(::off_t const offset)
+		{
+			return seek_extent(offset, SEEK_DATA, u8"lseek(SEEK_DATA)");
+		}
+
+		// Offset of the next hole at or after offset; the end of the file counts as a hole.
+		::off_t seek_hole(::off_t const offset)
+		{
+			return seek_extent(offset, SEEK_HOLE, u8"lseek(SEEK_HOLE)");
+		}
+
+		// Copies length bytes starting at in_offset to out without passing them through user space where possible:
+		// copy_file_range (which reflinks on file systems that support it), then sendfile, then splice through a
+		// pipe, then a plain read/write loop, falling back whenever a combination is not supported. If out is a
+		// regular file, holes in the source are skipped and become holes (or zeros) in out. out_offset == -1 writes
+		// at out's file position, which makes sockets and pipes valid targets. Moves the file position of this file,
+		// and out's only if out_offset == -1.
+		// Returns the number of bytes copied, which is short only if the end of the file was reached.
+		::std::size_t copy_to(File& out, ::off_t const in_offset, ::off_t const out_offset, ::std::size_t length)
+		{
+			assert(raw_handle() != Traits::invalid());
+			assert(out.raw_handle() != Traits::invalid());
+
+			struct ::stat in_stat;
+			struct ::stat out_stat;
+			if (::fstat(raw_handle(), &in_stat) == -1 || ::fstat(out.raw_handle(), &out_stat) == -1)
+				throw ::std::system_error{errno, ::std::system_category(), u8"fstat"};
+
+			bool const sparse = S_ISREG(in_stat.st_mode) && S_ISREG(out_stat.st_mode) && out_offset != -1;
+			if (S_ISREG(in_stat.st_mode))
+				length = in_offset < in_stat.st_size ? ::std::min(length, static_cast<::std::size_t>(in_stat.st_size - in_offset)) : 0;
+
+			CopyState state;
+			::std::size_t total = 0;
+			while (total < length)
+			{
+				::off_t const position = in_offset + static_cast<::off_t>(total);
+				::std::size_t count = length - total;
+
+				if (sparse)
+				{
+					::off_t const data = seek_data(position);
+					if (data == -1 || data > position)
+					{
+						// Hole, nothing to copy, but whatever out held there before has to go.
+						::std::size_t const skipped = data == -1 ? count : ::std::min(count, static_cast<::std::size_t>(data - position));
+						::off_t const target = out_offset + static_cast<::off_t>(total);
+						if (target < out_stat.st_size)
+							out.clear_range(target, ::std::min(static_cast<::off_t>(skipped), out_stat.st_size - target));
+						total += skipped;
+						continue;
+					}
+					count = ::std::min(count, static_cast<::std::size_t>(seek_hole(position) - position));
+				}
+
+				::std::size_t const copied = copy_range(state, out, position, out_offset == -1 ? -1 : out_offset + static_cast<::off_t>(total), count);
+				if (!copied)
+					break; // end of file
+				total += copied;
+			}
+
+			// A trailing hole was skipped, so the destination may be too short.
+			if (sparse && total && out_stat.st_size < out_offset + static_cast<::off_t>(total) && ::fstat(out.raw_handle(), &out_stat) == 0 && out_stat.st_size < out_offset + static_cast<::off_t>(total))
+				out.truncate(out_offset + static_cast<::off_t>(total));
+			return total;
+		}
+
+		// Makes [offset, offset + length) read back as zeros, deallocating it where the file system can punch holes.
+		void clear_range(::off_t offset, ::off_t length)
+		{
+			assert(raw_handle() != Traits::invalid());
+
+			int ret;
+			do
+				ret = ::fallocate(raw_handle(), FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, length);
+			while (ret == -1 && errno == EINTR);
+			if (ret == 0)
+				return;
+			if (errno != EOPNOTSUPP && errno != ENOSYS)
+				throw ::std::system_error{errno, ::std::system_category(), u8"fallocate"};
+
+			static char const zeros[64 * 1024] = {};
+			while (length)
+			{
+				::iovec iov{const_cast<char*>(zeros), static_cast<::std::size_t>(::std::min<::off_t>(length, sizeof zeros))};
+				auto const written = static_cast<::off_t>(transfer_all(&iov, 1, offset, 0, true));
+				offset += written;
+				length -= written;
+			}
+		}
+
+		// Allocates (or with FALLOC_FL_PUNCH_HOLE/FALLOC_FL_ZERO_RANGE releases or zeroes) the blocks backing
+		// [offset, offset + length). Preallocating a file that is appended to keeps it contiguous and takes block
+		// allocation out of the write path; FALLOC_FL_KEEP_SIZE does so without changing the reported size.
+		void fallocate(int const mode, ::off_t const offset, ::off_t const length)
+		{
+			assert(raw_handle() != Traits::invalid());
+
+			int ret;
+			do
+				ret = ::fallocate(raw_handle(), mode, offset, length);
+			while (ret == -1 && errno == EINTR);
+			if (ret == -1)
+				throw ::std::system_error{errno, ::std::system_category(), u8"fallocate"};
+		}
+
+		void fallocate(int const mode, ::off_t const offset, ::off_t const length, ::std::error_code& ec) noexcept
+		{
+			assert(raw_handle() != Traits::invalid());
+
+			int ret;
+			do
+				ret = ::fallocate(raw_handle(), mode, offset, length);
+			while (ret == -1 && errno == EINTR);
+			set_error(ec, ret == -1);
+		}
+
+		void preallocate(::off_t const offset, ::off_t const length, bool const keep_size = false) { fallocate(keep_size ? FALLOC_FL_KEEP_SIZE : 0, offset, length); }
+		void punch_hole(::off_t const offset, ::off_t const length) { fallocate(FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, length); }
+		void zero_range(::off_t const offset, ::off_t const length, bool const keep_size = false) { fallocate(FALLOC_FL_ZERO_RANGE | (keep_size ? FALLOC_FL_KEEP_SIZE : 0), offset, length); }
+
+		// Declares the access pattern of [offset, offset + length), length == 0 meaning up to the end of the file:
+		// POSIX_FADV_SEQUENTIAL widens readahead, POSIX_FADV_RANDOM disables it, POSIX_FADV_WILLNEED starts reading
+		// in the background and POSIX_FADV_DONTNEED drops clean cached pages.
+		void fadvise(::off_t const offset, ::off_t const length, int const advice)
+		{
+			assert(raw_handle() != Traits::invalid());
+
+			int const ret = ::posix_fadvise(raw_handle(), offset, length, advice); // returns the error instead of setting errno
+			if (ret)
+				throw ::std::system_error{ret, ::std::system_category(), u8"posix_fadvise"};
+		}
+
+		void fadvise(::off_t const offset, ::off_t const length, int const advice, ::std::error_code& ec) noexcept
+		{
+			assert(raw_handle() != Traits::invalid());
+
+			int const ret = ::posix_fadvise(raw_handle(), offset, length, advice);
+			if (ret)
+				ec.assign(ret, ::std::system_category());
+			else
+				ec.clear();
+		}
+
+		// Populates the page cache with [offset, offset + count) without copying anything to user space. Blocks until
+		// the reads are issued, not until they complete.
+		void readahead(::off_t const offset, ::std::size_t const count)
+		{
+			assert(raw_handle() != Traits::invalid());
+
+			if (::readahead(raw_handle(), offset, count) == -1)
+				throw ::std::system_error{errno, ::std::system_category(), u8"readahead"};
+		}
+
+		// Starts or waits for writeback of dirty pages in [offset, offset + count), count == 0 meaning up to the end of
+		// the file. flags combines SYNC_FILE_RANGE_WAIT_BEFORE, SYNC_FILE_RANGE_WRITE and SYNC_FILE_RANGE_WAIT_AFTER.
+		// Gives no durability guarantee since metadata and the disk cache are not flushed; use fdatasync() for that.
+		// Writing behind a streaming writer with SYNC_FILE_RANGE_WRITE keeps the amount of dirty memory bounded.
+		void sync_file_range(::off_t const offset, ::off_t const count, unsigned int const flags)
+		{
+			assert(raw_handle() != Traits::invalid());
+
+			if (::sync_file_range(raw_handle(), offset, count, flags) == -1)
+				throw ::std::system_error{errno, ::std::system_category(), u8"sync_file_range"};
+		}
+
+		void fsync()
+		{
+			assert(raw_handle() != Traits::invalid());
+
+			if (::fsync(raw_handle()) == -1)
+				throw ::std::system_error{errno, ::std::system_category(), u8"fsync"};
+		}
+
+		void fdatasync()
+		{
+			assert(raw_handle() != Traits::invalid());
+
+			if (::fdatasync(raw_handle()) == -1)
+				throw ::std::system_error{errno, ::std::system_category(), u8"fdatasync"};
+		}
+
+		// Adds F_SEAL_* seals, which can never be removed again. Only files created by memfd_create() with
+		// MFD_ALLOW_SEALING accept seals; they let another process trust the file not to shrink (F_SEAL_SHRINK) or
+		// change (F_SEAL_WRITE) under its mapping.
+		void add_seals(unsigned int const seals)
+		{
+			assert(raw_handle() != Traits::invalid());
+
+			if (::fcntl(raw_handle(), F_ADD_SEALS, seals) == -1)
+				throw ::std::system_error{errno, ::std::system_category(), u8"fcntl(F_ADD_SEALS)"};
+		}
+
+		unsigned int seals() const
+		{
+			assert(raw_handle() != Traits::invalid());
+
+			int const ret = ::fcntl(raw_handle(), F_GET_SEALS);
+			if (ret == -1)
+				throw ::std::system_error{errno, ::std::system_category(), u8"fcntl(F_GET_SEALS)"};
+			return static_cast<unsigned int>(ret);
+		}
+
+		// Current size of the file according to fstat().
+		::off_t size() const
+		{
+			assert(raw_handle() != Traits::invalid());
+
+			struct ::stat st;
+			if (::fstat(raw_handle(), &st) == -1)
+				throw ::std::system_error{errno, ::std::system_category(), u8"fstat"};
+			return st.st_size;
+		}
+
+		// Switches O_DIRECT on or off for this open file description. Direct transfers bypass the page cache, so large
+		// scans do not evict hot data, but buffers, offsets and sizes must satisfy direct_io_alignment() or the
+		// kernel fails them with EINVAL. Direct I/O is synchronous per call; reach high queue depths on NVMe by
+		// issuing many transfers at once through AsyncIo with AlignedBuffer memory.
+		void set_direct(bool const enable)
+		{
+			assert(raw_handle() != Traits::invalid());
+
+			int const flags = ::fcntl(raw_handle(), F_GETFL);
+			if (flags == -1 || ::fcntl(raw_handle(), F_SETFL, enable ? flags | O_DIRECT : flags & ~O_DIRECT) == -1)
+				throw ::std::system_error{errno, ::std::system_category(), u8"fcntl(O_DIRECT)"};
+		}
+
+		bool direct() const
+		{
+			assert(raw_handle() != Traits::invalid());
+
+			int const flags = ::fcntl(raw_handle(), F_GETFL);
+			if (flags == -1)
+				throw ::std::system_error{errno, ::std::system_category(), u8"fcntl(F_GETFL)"};
+			return flags & O_DIRECT;
+		}
+
+		// Asks the kernel for the direct I/O alignment (statx STATX_DIOALIGN, Linux 6.1). Older kernels fall back to
+		// the logical sector size of block devices and the file system block size otherwise, which is never too
+		// small. Throws EINVAL if the file does not support direct I/O at all.
+		DirectIoAlignment direct_io_alignment() const
+		{
+			assert(raw_handle() != Traits::invalid());
+
+#ifdef STATX_DIOALIGN
+			struct ::statx stx;
+			if (::statx(raw_handle(), u8"", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) == 0 && (stx.stx_mask & STATX_DIOALIGN))
+			{
+				if (!stx.stx_dio_mem_align)
+					throw ::std::system_error{EINVAL, ::std::system_category(), u8"direct I/O not supported"};
+				return {stx.stx_dio_mem_align, stx.stx_dio_offset_align};
+			}
+#endif
+
+			struct ::stat st;
+			if (::fstat(raw_handle(), &st) == -1)
+				throw ::std::system_error{errno, ::std::system_category(), u8"fstat"};
+
+			if (S_ISBLK(st.st_mode))
+			{
+				int sector_size;
+				if (::ioctl(raw_handle(), BLKSSZGET, &sector_size) == -1)
+					throw ::std::system_error{errno, ::std::system_category(), u8"BLKSSZGET"};
+				return {static_cast<::std::size_t>(sector_size), static_cast<::std::size_t>(sector_size)};
+			}
+
+			struct ::statvfs vfs;
+			if (::fstatvfs(raw_handle(), &vfs) == -1)
+				throw ::std::system_error{errno, ::std::system_category(), u8"fstatvfs"};
+			return {static_cast<::std::size_t>(vfs.f_bsize), static_cast<::std::size_t>(vfs.f_bsize)};
+		}
+
+		// pread/pwrite that check the alignment rules up front instead of letting a misaligned transfer fail with a
+		// bare EINVAL (or, on some file systems, silently fall back to buffered I/O).
+		::std::size_t pread_direct(void* const buffer, ::std::size_t const count, ::off_t const offset, DirectIoAlignment const& alignment)
+		{
+			check_alignment(alignment, buffer, count, offset, u8"pread_direct: misaligned transfer");
+			return pread(buffer, count, offset);
+		}
+
+		::std::size_t pwrite_direct(void const* const buffer, ::std::size_t const count, ::off_t const offset, DirectIoAlignment const& alignment)
+		{
+			check_alignment(alignment, buffer, count, offset, u8"pwrite_direct: misaligned transfer");
+			return pwrite(buffer, count, offset);
+		}
+
+	private:
+		static void check_alignment(DirectIoAlignment const& alignment, void const* const buffer, ::std::size_t const count, ::off_t const offset, char const* const what)
+		{
+			if (!alignment.fits(buffer, count, offset))
+				throw ::std::system_error{EINVAL, ::std::system_category(), what};
+		}
+
+		static void set_error(::std::error_code& ec, bool const failed) noexcept
+		{
+			if (failed)
+				ec.assign(errno, ::std::system_category());
+			else
+				ec.clear();
+		}
+
+		template <typename Pointer, typename Transfer>
+		static ::std::size_t exact(Pointer const data, ::std::size_t const count, ::std::error_code& ec, Transfer const& transfer) noexcept
+		{
+			ec.clear();
+			::std::size_t done = 0;
+			while (done < count)
+			{
+				auto const ret = transfer(data + done, count - done, done);
+				if (ret == -1)
+				{
+					if (errno == EINTR)
+						continue;
+					ec.assign(errno, ::std::system_category());
+					break;
+				}
+				if (ret == 0)
+				{
+					ec.assign(EIO, ::std::system_category()); // end of file or a device refusing to take more
+					break;
+				}
+				done += static_cast<::std::size_t>(ret);
+			}
+			return done;
+		}
+
+		// transfer_all consumes its iovec array, so the initializer_list is copied: onto the stack for the usual
+		// handful of buffers, onto the heap beyond that.
+		::std::size_t transfer_all(::std::initializer_list<::iovec> const buffers, ::off_t const offset, int const flags, bool const write)
+		{
+			auto const iovcnt = static_cast<int>(buffers.size());
+			::iovec iov[16];
+			if (buffers.size() <= sizeof iov / sizeof *iov)
+			{
+				::std::copy(buffers.begin(), buffers.end(), iov);
+				return transfer_all(iov, iovcnt, offset, flags, write);
+			}
+			::std::vector<::iovec> heap(buffers);
+			return transfer_all(heap.data(), iovcnt, offset, flags, write);
+		}
+
+		::std::size_t transfer_all(::iovec* iov, int iovcnt, ::off_t offset, int const flags, bool const write)
+		{
+			assert(raw_handle() != Traits::invalid());
+
+			::std::size_t total = 0;
+			while (iovcnt)
+			{
+				int const count = ::std::min(iovcnt, detail::max_iovecs);
+				auto const ret = write ? ::pwritev2(raw_handle(), iov, count, offset, flags) : ::preadv2(raw_handle(), iov, count, offset, flags);
+				if (ret == -1)
+				{
+					if (errno == EINTR)
+						continue;
+					throw ::std::system_error{errno, ::std::system_category(), write ? u8"pwritev2" : u8"preadv2"};
+				}
+				if (ret == 0 && iov->iov_len)
+				{
+					if (!write)
+						break; // end of file
+					throw ::std::system_error{EIO, ::std::system_category(), u8"pwritev2"};
+				}
+
+				auto const transferred = static_cast<::std::size_t>(ret);
+				total += transferred;
+				if (offset != -1)
+					offset += static_cast<::off_t>(transferred);
+				detail::advance(iov, iovcnt, transferred);
+			}
+			return total;
+		}
+
+		::off_t seek_extent(::off_t const offset, int const whence, char const* const what)
+		{
+			assert(raw_handle() != Traits::invalid());
+
+			auto const ret = ::lseek(raw_handle(), offset, whence);
+			if (ret != static_cast<::off_t>(-1))
+				return ret;
+			if (errno == ENXIO)
+				return whence == SEEK_DATA ? -1 : offset;
+			if (errno == EINVAL) // no hole support: everything is data
+			{
+				struct ::stat info;
+				if (::fstat(raw_handle(), &info) == 0)
+					return whence == SEEK_DATA ? offset : info.st_size;
+			}
+			throw ::std::system_error{errno, ::std::system_category(), what};
+		}
+
+		struct CopyState
+		{
+			enum Method { CopyFileRange, SendFile, Splice, ReadWrite } method = CopyFileRange;
+			int pipe[2] = {-1, -1};
+
+			~CopyState() noexcept
+			{
+				if (pipe[0] != -1)
+				{
+					::close(pipe[0]);
+					::close(pipe[1]);
+				}
+			}
+		};
+
+		static bool unsupported(int const error) noexcept
+		{
+			return error == ENOSYS || error == EINVAL || error == EXDEV || error == EOPNOTSUPP || error == EBADF || error == ESPIPE;
+		}
+
+		// Copies up to count bytes with the cheapest method that works. Returns 0 at the end of the file.
+		::std::size_t copy_range(CopyState& state, File& out, ::off_t in_offset, ::off_t const out_offset, ::std::size_t const count)
+		{
+			for (;;)
+			{
+				::ssize_t ret = -1;
+				switch (state.method)
+				{
+					case CopyState::CopyFileRange:
+					{
+						::off_t out_position = out_offset;
+						ret = ::copy_file_range(raw_handle(), &in_offset, out.raw_handle(), out_offset == -1 ? nullptr : &out_position, count, 0);
+						break;
+					}
+
+					case CopyState::SendFile:
+					{
+						if (out_offset == -1)
+						{
+							ret = ::sendfile(out.raw_handle(), raw_handle(), &in_offset, count);
+							break;
+						}
+
+						// sendfile() writes at out's file position, which is put back afterwards.
+						::off_t const position = ::lseek(out.raw_handle(), 0, SEEK_CUR);
+						if (position == -1 || ::lseek(out.raw_handle(), out_offset, SEEK_SET) == -1)
+							break;
+						ret = ::sendfile(out.raw_handle(), raw_handle(), &in_offset, count);
+						int const error = errno;
+						if (::lseek(out.raw_handle(), position, SEEK_SET) == -1 && ret != -1)
+							throw ::std::system_error{errno, ::std::system_category(), u8"lseek"};
+						errno = error;
+						break;
+					}
+
+					case CopyState::Splice:
+						ret = splice_range(state, out, in_offset, out_offset, count);
+						break;
+
+					case CopyState::ReadWrite:
+					{
+						char buffer[64 * 1024];
+						ret = ::pread(raw_handle(), buffer, ::std::min(count, sizeof buffer), in_offset);
+						if (ret > 0)
+						{
+							::iovec iov{buffer, static_cast<::std::size_t>(ret)};
+							return transfer_to(out, &iov, out_offset);
+						}
+						break;
+					}
+				}
+
+				if (ret >= 0)
+					return static_cast<::std::size_t>(ret);
+				if (errno == EINTR)
+					continue;
+				if (state.method == CopyState::ReadWrite || !unsupported(errno))
+					throw ::std::system_error{errno, ::std::system_category(), u8"copy_to"};
+				state.method = static_cast<CopyState::Method>(state.method + 1);
+			}
+		}
+
+		::ssize_t splice_range(CopyState& state, File& out, ::loff_t in_offset, ::off_t const out_offset, ::std::size_t const count)
+		{
+			if (state.pipe[0] == -1 && ::pipe2(state.pipe, O_CLOEXEC) == -1)
+				return -1;
+
+			::ssize_t const in = ::splice(raw_handle(), &in_offset, state.pipe[1], nullptr, count, SPLICE_F_MOVE);
+			if (in <= 0)
+				return in;
+
+			::loff_t out_position = out_offset;
+			::ssize_t done = 0;
+			while (done < in)
+			{
+				::ssize_t const ret = ::splice(state.pipe[0], nullptr, out.raw_handle(), out_offset == -1 ? nullptr : &out_position, static_cast<::std::size_t>(in - done), SPLICE_F_MOVE);
+				if (ret == -1 && errno == EINTR)
+					continue;
+				if (ret <= 0)
+				{
+					// Data stuck in the pipe cannot be put back; drop the pipe so it does not leak into the next copy.
+					::close(state.pipe[0]);
+					::close(state.pipe[1]);
+					state.pipe[0] = state.pipe[1] = -1;
+					if (ret == 0)
+						errno = EIO;
+					if (done)
+						throw ::std::system_error{errno, ::std::system_category(), u8"splice"};
+					return -1;
+				}
+				done += ret;
+			}
+			return done;
+		}
+
+		// Writes a whole buffer to out at out_offset or at its file position.
+		static ::std::size_t transfer_to(File& out, ::iovec* const iov, ::off_t const out_offset)
+		{
+			return out.transfer_all(iov, 1, out_offset, 0, true);
+		}
 	};
 
 	using FilePtr = HandlePtr<File>;
@@ -0,0 +1,107 @@
+/*
+ * Copyright 2017 Mahdi Khanalizadeh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef HEADER_EXT_FILE_CACHE_HPP_INCLUDED
+#define HEADER_EXT_FILE_CACHE_HPP_INCLUDED
+
+#include "file.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <sys/types.h>
+
+namespace ext
+{
+
+	struct FileCacheStats
+	{
+		::std::uint64_t hits;
+		::std::uint64_t misses;
+		::std::uint64_t evictions;
+		::std::uint64_t invalidations; // entries reopened because the file at their path changed
+		::std::size_t size;
+	};
+
+	// Keeps recently used files open so that repeated accesses to the same paths skip open(), close() and the path
+	// lookup. Handles are shared: an evicted file stays open until its last user drops it. Thread safe.
+	//
+	// The cache does not notice files being replaced on its own. With validate_after set, an entry older than that is
+	// checked with stat() on its next use and reopened if the path now refers to a different or modified file.
+	class FileCache
+	{
+	public:
+		using FileRef = ::std::shared_ptr<File>;
+
+		// capacity == 0 and capacities beyond half of RLIMIT_NOFILE are limited to half of RLIMIT_NOFILE, leaving the
+		// rest to evicted files still in use and to the rest of the process. Files are opened with flags, and created
+		// with mode if flags include O_CREAT. A negative validate_after never revalidates.
+		explicit FileCache(::std::size_t capacity = 0, int flags = O_RDONLY | O_CLOEXEC, ::mode_t mode = 0666, ::std::chrono::milliseconds validate_after = ::std::chrono::milliseconds{-1});
+
+		FileCache(FileCache const&) = delete;
+		FileCache& operator=(FileCache const&) = delete;
+
+		// Returns the cached file for path or opens it. Throws like File::open().
+		FileRef open(::std::string const& path);
+
+		// Drops the entry for path, e.g. after renaming a new version over it.
+		void invalidate(::std::string const& path);
+		void clear();
+
+		::std::size_t capacity() const noexcept { return m_capacity; }
+		FileCacheStats stats() const;
+
+	private:
+		struct Entry
+		{
+			::std::string path;
+			FileRef file;
+			::dev_t device;
+			::ino_t inode;
+			::timespec mtime;
+			::off_t size;
+			::std::chrono::steady_clock::time_point validated;
+		};
+
+		using Lru = ::std::list<Entry>; // most recently used first
+
+		Entry open_entry(::std::string const& path);
+		bool is_current(Entry& entry);
+		void insert(Entry entry);
+		void evict(::std::size_t count);
+
+		::std::size_t const m_capacity;
+		int const m_flags;
+		::mode_t const m_mode;
+		::std::chrono::milliseconds const m_validate_after;
+
+		mutable ::std::mutex m_mutex;
+		Lru m_lru;
+		::std::unordered_map<::std::string, Lru::iterator> m_index;
+		FileCacheStats m_stats{};
+	};
+
+} // namespace ext
+
+#endif // !HEADER_EXT_FILE_CACHE_HPP_INCLUDED
@@ -0,0 +1,121 @@
+/*
+ * Copyright 2017 Mahdi Khanalizadeh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HEADER_EXT_FUTEX_HPP_INCLUDED
+#define HEADER_EXT_FUTEX_HPP_INCLUDED
+
+#include <climits>
+#include <cstdint>
+
+#include <atomic>
+
+#include <linux/futex.h>
+#include <linux/membarrier.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace ext
+{
+
+	static_assert(sizeof(::std::atomic<::std::uint32_t>) == sizeof(::std::uint32_t), "futex word must be a plain 32 bit integer");
+
+	// Blocks while word == expected. May return spuriously.
+	inline void futex_wait(::std::atomic<::std::uint32_t>& word, ::std::uint32_t const expected) noexcept
+	{
+		::syscall(SYS_futex, reinterpret_cast<::std::uint32_t*>(&word), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+	}
+
+	inline void futex_wake(::std::atomic<::std::uint32_t>& word, int const count = INT_MAX) noexcept
+	{
+		::syscall(SYS_futex, reinterpret_cast<::std::uint32_t*>(&word), FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+	}
+
+	namespace detail
+	{
+
+		// membarrier() executes a full barrier on every running thread of the process. Where it works, the rarely
+		// taken side of a store-load handshake issues it, and the hot side only needs to keep the compiler from
+		// reordering.
+		inline bool has_asymmetric_fence() noexcept
+		{
+			static bool const registered = ::syscall(SYS_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0, 0) == 0;
+			return registered;
+		}
+
+		inline void light_fence() noexcept
+		{
+			if (has_asymmetric_fence())
+				::std::atomic_signal_fence(::std::memory_order_seq_cst);
+			else
+				::std::atomic_thread_fence(::std::memory_order_seq_cst);
+		}
+
+		inline void heavy_fence() noexcept
+		{
+			if (!has_asymmetric_fence() || ::syscall(SYS_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0) != 0)
+				::std::atomic_thread_fence(::std::memory_order_seq_cst);
+		}
+
+	} // namespace detail
+
+	// Lets threads sleep until a lock-free condition might have become true. Notifying costs a relaxed load and no
+	// fence while nobody waits: waiters pay for the barrier with membarrier() right before they would sleep anyway.
+	class EventCount
+	{
+	public:
+		// Call after making the condition true.
+		void notify_all() noexcept
+		{
+			detail::light_fence();
+			if (m_waiters.load(::std::memory_order_relaxed))
+			{
+				m_epoch.fetch_add(1, ::std::memory_order_release);
+				futex_wake(m_epoch);
+			}
+		}
+
+		// Blocks until attempt() returns true. attempt() is the non-blocking operation itself, e.g. a try_pop().
+		template <typename Attempt>
+		void wait(Attempt&& attempt)
+		{
+			for (int i = 0; i < 128; ++i)
+			{
+				if (attempt())
+					return;
+			}
+
+			for (;;)
+			{
+				m_waiters.fetch_add(1, ::std::memory_order_relaxed);
+				detail::heavy_fence();
+				::std::uint32_t const epoch = m_epoch.load(::std::memory_order_acquire);
+				bool const done = attempt();
+				if (!done)
+					futex_wait(m_epoch, epoch);
+				m_waiters.fetch_sub(1, ::std::memory_order_relaxed);
+				if (done || attempt())
+					return;
+			}
+		}
+
+	private:
+		::std::atomic<::std::uint32_t> m_epoch{0};
+		::std::atomic<::std::uint32_t> m_waiters{0};
+	};
+
+} // namespace ext
+
+#endif // !HEADER_EXT_FUTEX_HPP_INCLUDED
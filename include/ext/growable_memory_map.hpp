@@ -0,0 +1,193 @@
+/*
+ * Copyright 2017 Mahdi Khanalizadeh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef HEADER_EXT_GROWABLE_MEMORY_MAP_HPP_INCLUDED
+#define HEADER_EXT_GROWABLE_MEMORY_MAP_HPP_INCLUDED
+
+#include "aligned_buffer.hpp"
+#include "file.hpp"
+#include "memory_map.hpp"
+
+#include <cassert>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+
+#include <algorithm>
+#include <system_error>
+
+#include <sys/mman.h>
+
+namespace ext
+{
+
+	// A mapping that grows in place. The constructor reserves reserve bytes of address space without committing
+	// memory; growing maps more of the file (or commits more anonymous memory) at the end of what is already mapped,
+	// inside the reservation, so data() never changes and pointers into the mapping stay valid. Address space is
+	// cheap on 64 bit systems, so reserve generously: growing past the reservation fails with ENOMEM.
+	//
+	// Capacity grows by at least half of itself at a time, so a sequence of appends costs amortized O(1) syscalls.
+	// Not thread safe.
+	class GrowableMemoryMap
+	{
+	public:
+		// Anonymous memory.
+		explicit GrowableMemoryMap(::std::size_t const reserve, int const prot = PROT_READ | PROT_WRITE) :
+			m_prot{prot}
+		{
+			reserve_address_space(reserve);
+		}
+
+		// Maps file shared, starting with its current size. With preallocate set growth allocates disk blocks up front,
+		// so that running out of space fails the growing call instead of raising SIGBUS on a later store.
+		GrowableMemoryMap(FilePtr& file, ::std::size_t const reserve, int const prot = PROT_READ | PROT_WRITE, bool const preallocate = true) :
+			m_file{&file},
+			m_prot{prot},
+			m_preallocate{preallocate}
+		{
+			reserve_address_space(reserve);
+
+			m_size = static_cast<::std::size_t>(file->size());
+			if (m_size > m_reservation->size())
+				throw ::std::system_error{ENOMEM, ::std::system_category(), u8"GrowableMemoryMap: file larger than reservation"};
+			if (m_size)
+				map_range(0, detail::align_up(m_size, detail::page_size()));
+		}
+
+		GrowableMemoryMap(GrowableMemoryMap const&) = delete;
+		GrowableMemoryMap& operator=(GrowableMemoryMap const&) = delete;
+
+		char* data() const noexcept { return static_cast<char*>(m_reservation->data()); }
+		::std::size_t size() const noexcept { return m_size; }
+		::std::size_t capacity() const noexcept { return m_capacity; }
+		::std::size_t reserved() const noexcept { return m_reservation->size(); }
+
+		// Makes at least capacity bytes accessible. Grows the file to match.
+		void reserve(::std::size_t const capacity)
+		{
+			if (capacity <= m_capacity)
+				return;
+			if (capacity > reserved())
+				throw ::std::system_error{ENOMEM, ::std::system_category(), u8"GrowableMemoryMap: reservation exhausted"};
+
+			::std::size_t const page = detail::page_size();
+			::std::size_t target = ::std::max({capacity, m_capacity + m_capacity / 2, 16 * page});
+			target = ::std::min(detail::align_up(target, page), reserved());
+			map_range(m_capacity, target);
+		}
+
+		void resize(::std::size_t const size)
+		{
+			reserve(size);
+			m_size = size;
+		}
+
+		// Extends the size by count bytes and returns the first of them.
+		char* append(::std::size_t const count)
+		{
+			::std::size_t const offset = m_size;
+			resize(m_size + count);
+			return data() + offset;
+		}
+
+		void append(void const* const buffer, ::std::size_t const count)
+		{
+			::std::memcpy(append(count), buffer, count);
+		}
+
+		// Writes dirty pages of [0, size()) back to the file, waiting for them unless async is set.
+		void sync(bool const async = false)
+		{
+			assert(m_file);
+
+			if (m_size && ::msync(data(), m_size, async ? MS_ASYNC : MS_SYNC) == -1)
+				throw ::std::system_error{errno, ::std::system_category(), u8"msync"};
+		}
+
+		// Cuts the file down to size(), dropping the slack left by amortized growth. The mapping stays usable: the
+		// capacity shrinks to size() and appending grows the file again.
+		void finish()
+		{
+			assert(m_file);
+
+			(*m_file)->truncate(static_cast<::off_t>(m_size));
+
+			// Pages wholly past the new end of the file would raise SIGBUS; hand them back to the reservation.
+			::std::size_t const end = detail::align_up(m_size, detail::page_size());
+			if (end < m_capacity && ::mmap(data() + end, m_capacity - end, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0) == MAP_FAILED)
+				throw ::std::system_error{errno, ::std::system_category(), u8"mmap(MAP_FIXED)"};
+			m_capacity = m_size;
+		}
+
+	private:
+		void reserve_address_space(::std::size_t const reserve)
+		{
+			// PROT_NONE and MAP_NORESERVE: neither memory nor swap is committed for the reservation.
+			m_reservation->map(nullptr, detail::align_up(::std::max<::std::size_t>(reserve, 1), detail::page_size()), PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		}
+
+		// Makes [first, last) of the reservation accessible. last is page aligned; first is too unless finish() cut
+		// the file inside the page that is already mapped, in which case only the file has to grow into it.
+		void map_range(::std::size_t const first, ::std::size_t const last)
+		{
+			if (!m_file)
+			{
+				if (::mprotect(data() + first, last - first, m_prot) == -1)
+					throw ::std::system_error{errno, ::std::system_category(), u8"mprotect"};
+				m_capacity = last;
+				return;
+			}
+
+			if (static_cast<::std::size_t>((*m_file)->size()) < last)
+			{
+				bool extended = false;
+				if (m_preallocate)
+				{
+					try
+					{
+						(*m_file)->preallocate(0, static_cast<::off_t>(last));
+						extended = true;
+					}
+					catch (::std::system_error const& error)
+					{
+						if (error.code().value() != EOPNOTSUPP)
+							throw;
+					}
+				}
+				if (!extended)
+					(*m_file)->truncate(static_cast<::off_t>(last));
+			}
+
+			// MAP_FIXED replaces the reserved pages atomically, and the kernel merges the new range with the previous
+			// one into a single VMA since it continues the same file at the matching offset.
+			::std::size_t const mapped = detail::align_up(first, detail::page_size());
+			if (mapped < last && ::mmap(data() + mapped, last - mapped, m_prot, MAP_SHARED | MAP_FIXED, m_file->get(), static_cast<::off_t>(mapped)) == MAP_FAILED)
+				throw ::std::system_error{errno, ::std::system_category(), u8"mmap(MAP_FIXED)"};
+			m_capacity = last;
+		}
+
+		FilePtr* const m_file = nullptr;
+		int const m_prot;
+		bool const m_preallocate = false;
+		MemoryMapPtr m_reservation; // unmapping the reservation also unmaps everything mapped into it
+		::std::size_t m_size = 0;
+		::std::size_t m_capacity = 0;
+	};
+
+} // namespace ext
+
+#endif // !HEADER_EXT_GROWABLE_MEMORY_MAP_HPP_INCLUDED
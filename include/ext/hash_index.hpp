@@ -0,0 +1,483 @@
+/*
+ * Copyright 2017 Mahdi Khanalizadeh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef HEADER_EXT_HASH_INDEX_HPP_INCLUDED
+#define HEADER_EXT_HASH_INDEX_HPP_INCLUDED
+
+#include "aligned_buffer.hpp"
+#include "file.hpp"
+#include "growable_memory_map.hpp"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <functional>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+
+#include <fcntl.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace ext
+{
+
+	namespace detail
+	{
+
+		struct HashIndexHeader
+		{
+			char magic[8];
+			::std::uint32_t version;
+			::std::uint32_t byte_order;
+			::std::uint32_t key_size;
+			::std::uint32_t value_size;
+			::std::uint64_t sequence;     // seqlock, odd while the writer changes what readers may have found
+			::std::uint64_t table_offset;
+			::std::uint64_t capacity;     // slots, a power of two and a multiple of the group size
+			::std::uint64_t count;        // live entries
+			::std::uint64_t used;         // live entries plus tombstones
+		};
+
+		static_assert(sizeof(HashIndexHeader) == 64, "hash index header must not contain padding");
+
+		constexpr char hash_index_magic[8] = {'E', 'X', 'T', 'H', 'I', 'D', 'X', '\0'};
+		constexpr ::std::uint32_t hash_index_version = 1;
+		constexpr ::std::uint32_t hash_index_byte_order = 0x01020304;
+
+		// Control bytes: a full slot stores the low 7 bits of its hash, free slots have the high bit set.
+		constexpr ::std::int8_t control_empty = -128;
+		constexpr ::std::int8_t control_deleted = -2;
+		constexpr ::std::size_t group_size = 16;
+
+		// Bit i of each mask is set if control byte i of the group matches.
+		class ControlGroup
+		{
+		public:
+			explicit ControlGroup(::std::int8_t const* const control) noexcept
+#if defined(__SSE2__)
+				: m_control{_mm_load_si128(reinterpret_cast<__m128i const*>(control))}
+			{
+			}
+
+			unsigned int match(::std::int8_t const h2) const noexcept { return static_cast<unsigned int>(_mm_movemask_epi8(_mm_cmpeq_epi8(m_control, _mm_set1_epi8(h2)))); }
+			unsigned int match_empty() const noexcept { return match(control_empty); }
+			unsigned int match_free() const noexcept { return static_cast<unsigned int>(_mm_movemask_epi8(m_control)); }
+
+		private:
+			__m128i const m_control;
+#else
+			{
+				::std::memcpy(m_control, control, group_size);
+			}
+
+			unsigned int match(::std::int8_t const h2) const noexcept
+			{
+				unsigned int mask = 0;
+				for (unsigned int i = 0; i < group_size; ++i)
+					mask |= static_cast<unsigned int>(m_control[i] == h2) << i;
+				return mask;
+			}
+
+			unsigned int match_empty() const noexcept { return match(control_empty); }
+
+			unsigned int match_free() const noexcept
+			{
+				unsigned int mask = 0;
+				for (unsigned int i = 0; i < group_size; ++i)
+					mask |= static_cast<unsigned int>(m_control[i] < 0) << i;
+				return mask;
+			}
+
+		private:
+			::std::int8_t m_control[group_size];
+#endif
+		};
+
+		// Hashes the object representation, so the result is the same in every process and build, unlike std::hash.
+		inline ::std::uint64_t hash_bytes(void const* const data, ::std::size_t size) noexcept
+		{
+			auto const* bytes = static_cast<unsigned char const*>(data);
+			::std::uint64_t hash = 0x9e3779b97f4a7c15u ^ size;
+			for (; size >= 8; size -= 8, bytes += 8)
+			{
+				::std::uint64_t word;
+				::std::memcpy(&word, bytes, sizeof word);
+				hash = (hash ^ word) * 0xff51afd7ed558ccdu;
+				hash ^= hash >> 32;
+			}
+			if (size)
+			{
+				::std::uint64_t word = 0;
+				::std::memcpy(&word, bytes, size);
+				hash = (hash ^ word) * 0xff51afd7ed558ccdu;
+			}
+
+			// MurmurHash3 finalizer: every input bit affects the low 7 bits stored in the control bytes.
+			hash ^= hash >> 33;
+			hash *= 0xc4ceb9fe1a85ec53u;
+			hash ^= hash >> 33;
+			return hash;
+		}
+
+	} // namespace detail
+
+	// Stable hash of a key's bytes. Keys must not contain padding, whose contents are indeterminate.
+	template <typename Key>
+	struct BytesHash
+	{
+		::std::uint64_t operator()(Key const& key) const noexcept { return detail::hash_bytes(&key, sizeof key); }
+	};
+
+	// Open addressing hash table (Swiss table layout) living in a file, so a restart maps it instead of rebuilding it.
+	// Keys and values are trivially copyable and stored in place; the metadata bytes of 16 slots are probed at once
+	// with SSE2 where available.
+	//
+	// One thread may modify the table while any number of threads call find() and contains() on the same object.
+	// Inserting a new key publishes the slot with a release store of its control byte; overwriting a value, erasing and
+	// growing go through a seqlock, so readers copy results out and retry if they raced with one of those. The
+	// mapping never moves: growth extends it inside a reservation of reserve bytes, writes a table of twice the size
+	// next to the current one and switches over, punching a hole where the old table was.
+	//
+	// Nothing is written back until sync() or the kernel decides to; a crash in between may leave a mix of old and new
+	// slots.
+	template <typename Key, typename Value, typename Hash = BytesHash<Key>, typename Equal = ::std::equal_to<Key>>
+	class HashIndex
+	{
+		static_assert(::std::is_trivially_copyable<Key>::value && ::std::is_trivially_copyable<Value>::value, "HashIndex stores keys and values as raw bytes");
+
+		struct Slot
+		{
+			Key key;
+			Value value;
+		};
+
+		static_assert(alignof(Slot) <= 64, "HashIndex slots are at most cache line aligned");
+
+	public:
+		// Opens or creates the file at path. capacity is the number of entries to make room for in a new file.
+		explicit HashIndex(char const* const path, ::std::size_t const capacity = 1024, ::std::size_t const reserve = ::std::size_t{1} << 40) :
+			m_file{open(path)},
+			m_map{m_file, reserve}
+		{
+			if (!m_map.size())
+			{
+				::std::size_t const slots = slots_for(capacity);
+				m_map.resize(page_size() + table_bytes(slots));
+
+				detail::HashIndexHeader& header = this->header();
+				::std::memcpy(header.magic, detail::hash_index_magic, sizeof header.magic);
+				header.version = detail::hash_index_version;
+				header.byte_order = detail::hash_index_byte_order;
+				header.key_size = sizeof(Key);
+				header.value_size = sizeof(Value);
+				header.table_offset = page_size();
+				header.capacity = slots;
+				clear_control(page_size(), slots);
+				return;
+			}
+
+			detail::HashIndexHeader& header = this->header();
+			if (m_map.size() < sizeof header || ::std::memcmp(header.magic, detail::hash_index_magic, sizeof header.magic))
+				throw ::std::runtime_error{u8"HashIndex: not a hash index"};
+			if (header.version != detail::hash_index_version)
+				throw ::std::runtime_error{u8"HashIndex: unsupported version"};
+			if (header.byte_order != detail::hash_index_byte_order)
+				throw ::std::runtime_error{u8"HashIndex: written with a different byte order"};
+			if (header.key_size != sizeof(Key) || header.value_size != sizeof(Value))
+				throw ::std::runtime_error{u8"HashIndex: key or value type mismatch"};
+			if (header.capacity < detail::group_size || header.capacity & (header.capacity - 1) || header.table_offset % page_size() || header.table_offset > m_map.size() || table_bytes(header.capacity) > m_map.size() - header.table_offset)
+				throw ::std::runtime_error{u8"HashIndex: corrupt header"};
+
+			// A writer that died inside an update left the seqlock odd.
+			header.sequence += header.sequence & 1;
+		}
+
+		HashIndex(HashIndex const&) = delete;
+		HashIndex& operator=(HashIndex const&) = delete;
+
+		::std::size_t size() const noexcept { return static_cast<::std::size_t>(__atomic_load_n(&header().count, __ATOMIC_RELAXED)); }
+		bool empty() const noexcept { return !size(); }
+		::std::size_t capacity() const noexcept { return static_cast<::std::size_t>(__atomic_load_n(&header().capacity, __ATOMIC_RELAXED)) / 8 * 7; }
+
+		// Copies the value of key to value. Safe to call concurrently with the writer.
+		bool find(Key const& key, Value& value) const
+		{
+			::std::uint64_t const hash = m_hash(key);
+			for (;;)
+			{
+				::std::uint64_t const sequence = __atomic_load_n(&header().sequence, __ATOMIC_ACQUIRE);
+				if (sequence & 1)
+					continue;
+
+				Slot slot;
+				bool const found = probe(key, hash, __atomic_load_n(&header().table_offset, __ATOMIC_RELAXED), __atomic_load_n(&header().capacity, __ATOMIC_RELAXED), &slot) != npos;
+
+				__atomic_thread_fence(__ATOMIC_ACQUIRE);
+				if (__atomic_load_n(&header().sequence, __ATOMIC_RELAXED) != sequence)
+					continue;
+				if (found)
+					value = slot.value;
+				return found;
+			}
+		}
+
+		bool contains(Key const& key) const
+		{
+			Value value;
+			return find(key, value);
+		}
+
+		// The writer functions below must not be called concurrently with each other.
+
+		// Adds key unless it is present already. Returns whether it was added.
+		bool insert(Key const& key, Value const& value)
+		{
+			::std::uint64_t const hash = m_hash(key);
+			if (probe(key, hash, header().table_offset, header().capacity, nullptr) != npos)
+				return false;
+			add(key, value, hash);
+			return true;
+		}
+
+		void insert_or_assign(Key const& key, Value const& value)
+		{
+			::std::uint64_t const hash = m_hash(key);
+			::std::size_t const index = probe(key, hash, header().table_offset, header().capacity, nullptr);
+			if (index == npos)
+			{
+				add(key, value, hash);
+				return;
+			}
+
+			begin_update();
+			slots(header().table_offset, header().capacity)[index].value = value;
+			end_update();
+		}
+
+		bool erase(Key const& key)
+		{
+			detail::HashIndexHeader& header = this->header();
+			::std::size_t const index = probe(key, m_hash(key), header.table_offset, header.capacity, nullptr);
+			if (index == npos)
+				return false;
+
+			begin_update();
+			__atomic_store_n(&control(header.table_offset)[index], detail::control_deleted, __ATOMIC_RELAXED);
+			__atomic_store_n(&header.count, header.count - 1, __ATOMIC_RELAXED);
+			end_update();
+			return true;
+		}
+
+		// Makes room for count entries without further growth.
+		void reserve(::std::size_t const count)
+		{
+			::std::size_t const slots = slots_for(count);
+			if (slots > header().capacity)
+				rehash(slots);
+		}
+
+		// Calls function(Key const&, Value const&) for every entry, in no particular order. Writer only.
+		template <typename Function>
+		void for_each(Function&& function) const
+		{
+			detail::HashIndexHeader const& header = this->header();
+			::std::int8_t const* const control = this->control(header.table_offset);
+			Slot const* const slots = this->slots(header.table_offset, header.capacity);
+			for (::std::size_t i = 0; i < header.capacity; ++i)
+			{
+				if (control[i] >= 0)
+					function(slots[i].key, slots[i].value);
+			}
+		}
+
+		// Writes the table back to the file and waits for it.
+		void sync() { m_map.sync(); }
+
+	private:
+		static constexpr ::std::size_t npos = ~::std::size_t{0};
+
+		static FilePtr open(char const* const path)
+		{
+			FilePtr file;
+			file->open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+			return file;
+		}
+
+		static ::std::size_t page_size() noexcept { return detail::page_size(); }
+
+		// Smallest power of two number of slots that holds count entries at the maximum load factor of 7/8.
+		static ::std::size_t slots_for(::std::size_t const count) noexcept
+		{
+			::std::size_t slots = detail::group_size;
+			while (slots / 8 * 7 < count)
+				slots *= 2;
+			return slots;
+		}
+
+		// Control bytes, then the slots, rounded up to pages so that the table can be punched out of the file.
+		static ::std::size_t slots_offset(::std::size_t const capacity) noexcept { return detail::align_up(capacity, 64); }
+		static ::std::size_t table_bytes(::std::size_t const capacity) noexcept { return detail::align_up(slots_offset(capacity) + capacity * sizeof(Slot), page_size()); }
+
+		detail::HashIndexHeader& header() const noexcept { return *reinterpret_cast<detail::HashIndexHeader*>(m_map.data()); }
+		::std::int8_t* control(::std::uint64_t const table_offset) const noexcept { return reinterpret_cast<::std::int8_t*>(m_map.data() + table_offset); }
+		Slot* slots(::std::uint64_t const table_offset, ::std::uint64_t const capacity) const noexcept { return reinterpret_cast<Slot*>(m_map.data() + table_offset + slots_offset(static_cast<::std::size_t>(capacity))); }
+
+		// Returns the slot index of key in the table at table_offset, copying the slot to copy if given. Readers may
+		// see a table that is being replaced, so at most every group is visited once.
+		::std::size_t probe(Key const& key, ::std::uint64_t const hash, ::std::uint64_t const table_offset, ::std::uint64_t const capacity, Slot* const copy) const
+		{
+			auto const h2 = static_cast<::std::int8_t>(hash & 0x7f);
+			::std::size_t const groups = static_cast<::std::size_t>(capacity) / detail::group_size;
+			::std::int8_t const* const control = this->control(table_offset);
+			Slot const* const slots = this->slots(table_offset, capacity);
+
+			// Triangular numbers visit every group of a power of two table exactly once.
+			::std::size_t group = static_cast<::std::size_t>(hash >> 7) & (groups - 1);
+			for (::std::size_t step = 1; step <= groups; group = (group + step++) & (groups - 1))
+			{
+				detail::ControlGroup const bytes{control + group * detail::group_size};
+				for (unsigned int mask = bytes.match(h2); mask; mask &= mask - 1)
+				{
+					::std::size_t const index = group * detail::group_size + static_cast<unsigned int>(__builtin_ctz(mask));
+					__atomic_thread_fence(__ATOMIC_ACQUIRE); // pairs with the release store publishing the slot
+
+					Slot slot;
+					::std::memcpy(&slot, &slots[index], sizeof slot);
+					if (m_equal(slot.key, key))
+					{
+						if (copy)
+							*copy = slot;
+						return index;
+					}
+				}
+				if (bytes.match_empty())
+					return npos;
+			}
+			return npos;
+		}
+
+		// Adds a key known to be absent.
+		void add(Key const& key, Value const& value, ::std::uint64_t const hash)
+		{
+			detail::HashIndexHeader& header = this->header();
+			if ((header.used + 1) > header.capacity / 8 * 7)
+			{
+				// Rehash at the same size if tombstones rather than live entries fill the table.
+				rehash(header.count + 1 > header.capacity / 16 * 7 ? header.capacity * 2 : header.capacity);
+			}
+
+			::std::size_t const index = place(header.table_offset, header.capacity, key, value, hash);
+			if (control(header.table_offset)[index] == detail::control_empty)
+				++header.used;
+			__atomic_store_n(&control(header.table_offset)[index], static_cast<::std::int8_t>(hash & 0x7f), __ATOMIC_RELEASE);
+			__atomic_store_n(&header.count, header.count + 1, __ATOMIC_RELAXED);
+		}
+
+		// Copies key and value into the first free slot along the probe sequence and returns its index without
+		// publishing it.
+		::std::size_t place(::std::uint64_t const table_offset, ::std::uint64_t const capacity, Key const& key, Value const& value, ::std::uint64_t const hash)
+		{
+			::std::size_t const groups = static_cast<::std::size_t>(capacity) / detail::group_size;
+			::std::int8_t const* const control = this->control(table_offset);
+			Slot* const slots = this->slots(table_offset, capacity);
+
+			::std::size_t group = static_cast<::std::size_t>(hash >> 7) & (groups - 1);
+			for (::std::size_t step = 1;; group = (group + step++) & (groups - 1))
+			{
+				unsigned int const mask = detail::ControlGroup{control + group * detail::group_size}.match_free();
+				if (mask)
+				{
+					::std::size_t const index = group * detail::group_size + static_cast<unsigned int>(__builtin_ctz(mask));
+					slots[index].key = key;
+					slots[index].value = value;
+					return index;
+				}
+			}
+		}
+
+		void clear_control(::std::uint64_t const table_offset, ::std::uint64_t const capacity) noexcept
+		{
+			::std::memset(control(table_offset), detail::control_empty, static_cast<::std::size_t>(capacity));
+		}
+
+		// Builds a table of capacity slots next to the current one and switches readers over to it. The new table goes
+		// to the start of the table area if the current one left enough room there and behind the current one
+		// otherwise, so rehashing at a steady size alternates between two regions instead of growing the file.
+		void rehash(::std::uint64_t const capacity)
+		{
+			detail::HashIndexHeader& header = this->header();
+			::std::uint64_t const old_offset = header.table_offset;
+			::std::uint64_t const old_capacity = header.capacity;
+			::std::uint64_t const offset = page_size() + table_bytes(static_cast<::std::size_t>(capacity)) <= old_offset ? page_size() : old_offset + table_bytes(static_cast<::std::size_t>(old_capacity));
+			::std::size_t const end = static_cast<::std::size_t>(offset) + table_bytes(static_cast<::std::size_t>(capacity));
+			if (end > m_map.size())
+				m_map.resize(end);
+
+			clear_control(offset, capacity);
+			::std::int8_t* const new_control = control(offset);
+			::std::int8_t const* const old_control = control(old_offset);
+			Slot const* const old_slots = slots(old_offset, old_capacity);
+			for (::std::size_t i = 0; i < old_capacity; ++i)
+			{
+				if (old_control[i] < 0)
+					continue;
+				::std::uint64_t const hash = m_hash(old_slots[i].key);
+				new_control[place(offset, capacity, old_slots[i].key, old_slots[i].value, hash)] = static_cast<::std::int8_t>(hash & 0x7f);
+			}
+
+			begin_update();
+			__atomic_store_n(&header.table_offset, offset, __ATOMIC_RELAXED);
+			__atomic_store_n(&header.capacity, capacity, __ATOMIC_RELAXED);
+			header.used = header.count;
+			end_update();
+
+			// Readers still probing the old table read zeros from here on and retry once they notice the sequence changed.
+			try
+			{
+				m_file->punch_hole(static_cast<::off_t>(old_offset), static_cast<::off_t>(table_bytes(static_cast<::std::size_t>(old_capacity))));
+			}
+			catch (::std::system_error const& error)
+			{
+				if (error.code().value() != EOPNOTSUPP)
+					throw;
+			}
+		}
+
+		void begin_update() noexcept
+		{
+			__atomic_store_n(&header().sequence, header().sequence + 1, __ATOMIC_RELAXED);
+			__atomic_thread_fence(__ATOMIC_RELEASE);
+		}
+
+		void end_update() noexcept { __atomic_store_n(&header().sequence, header().sequence + 1, __ATOMIC_RELEASE); }
+
+		FilePtr m_file;
+		GrowableMemoryMap m_map;
+		Hash m_hash;
+		Equal m_equal;
+	};
+
+} // namespace ext
+
+#endif // !HEADER_EXT_HASH_INDEX_HPP_INCLUDED
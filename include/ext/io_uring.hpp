@@ -0,0 +1,207 @@
+/*
+ * Copyright 2017 Mahdi Khanalizadeh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HEADER_EXT_IO_URING_HPP_INCLUDED
+#define HEADER_EXT_IO_URING_HPP_INCLUDED
+
+#include "file.hpp"
+#include "memory_map.hpp"
+
+#include <cassert>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <system_error>
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace ext
+{
+
+	// Raw io_uring instance without liburing: the ring file descriptor and the three shared mappings. Not thread safe.
+	class IoUring
+	{
+	public:
+		explicit IoUring(unsigned int const entries, unsigned int const flags = 0)
+		{
+			::io_uring_params params;
+			::std::memset(&params, 0, sizeof params);
+			params.flags = flags;
+
+			int const fd = static_cast<int>(::syscall(SYS_io_uring_setup, entries, &params));
+			if (fd == -1)
+				throw ::std::system_error{errno, ::std::system_category(), u8"io_uring_setup"};
+			m_fd.reset(fd);
+
+			m_sq_ring->map(nullptr, params.sq_off.array + params.sq_entries * sizeof(unsigned int), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+			m_cq_ring->map(nullptr, params.cq_off.cqes + params.cq_entries * sizeof(::io_uring_cqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+			m_sqe_map->map(nullptr, params.sq_entries * sizeof(::io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+
+			auto* const sq = static_cast<unsigned char*>(m_sq_ring.get().first);
+			m_sq_head = reinterpret_cast<unsigned int*>(sq + params.sq_off.head);
+			m_sq_tail = reinterpret_cast<unsigned int*>(sq + params.sq_off.tail);
+			m_sq_mask = *reinterpret_cast<unsigned int*>(sq + params.sq_off.ring_mask);
+			m_sq_entries = params.sq_entries;
+			m_sqes = static_cast<::io_uring_sqe*>(m_sqe_map.get().first);
+
+			// Submission slot i always refers to sqe i, so the indirection array is set up once.
+			auto* const array = reinterpret_cast<unsigned int*>(sq + params.sq_off.array);
+			for (unsigned int i = 0; i < m_sq_entries; ++i)
+				array[i] = i;
+
+			auto* const cq = static_cast<unsigned char*>(m_cq_ring.get().first);
+			m_cq_head = reinterpret_cast<unsigned int*>(cq + params.cq_off.head);
+			m_cq_tail = reinterpret_cast<unsigned int*>(cq + params.cq_off.tail);
+			m_cq_mask = *reinterpret_cast<unsigned int*>(cq + params.cq_off.ring_mask);
+			m_cq_entries = params.cq_entries;
+			m_cqes = reinterpret_cast<::io_uring_cqe*>(cq + params.cq_off.cqes);
+
+			m_features = params.features;
+			m_sqe_tail = *m_sq_tail;
+		}
+
+		IoUring(IoUring const&) = delete;
+		IoUring& operator=(IoUring const&) = delete;
+
+		int fd() const noexcept { return m_fd.get(); }
+		unsigned int features() const noexcept { return m_features; }
+		unsigned int sq_entries() const noexcept { return m_sq_entries; }
+		unsigned int cq_entries() const noexcept { return m_cq_entries; }
+
+		// Returns a zeroed submission entry or nullptr if the submission queue is full. Entries become visible to the
+		// kernel with the next submit().
+		::io_uring_sqe* get_sqe() noexcept
+		{
+			if (m_sqe_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE) >= m_sq_entries)
+				return nullptr;
+
+			::io_uring_sqe* const sqe = &m_sqes[m_sqe_tail & m_sq_mask];
+			++m_sqe_tail;
+			::std::memset(sqe, 0, sizeof *sqe);
+			return sqe;
+		}
+
+		// Number of entries obtained by get_sqe() that the kernel has not consumed yet.
+		unsigned int pending() const noexcept { return m_sqe_tail - __atomic_load_n(m_sq_head, __ATOMIC_ACQUIRE); }
+
+		// Publishes all pending entries and optionally waits for wait_nr completions. The kernel may consume fewer
+		// entries than it is offered; the rest is offered again until it stops taking any, and whatever is left stays
+		// pending for the next call. Returns the number of entries the kernel consumed. Throws only if it consumed none.
+		unsigned int submit(unsigned int const wait_nr = 0)
+		{
+			__atomic_store_n(m_sq_tail, m_sqe_tail, __ATOMIC_RELEASE);
+
+			unsigned int consumed = 0;
+			bool waited = !wait_nr;
+			for (;;)
+			{
+				unsigned int const count = pending();
+				if (!count && waited)
+					return consumed;
+
+				long const ret = ::syscall(SYS_io_uring_enter, m_fd.get(), count, wait_nr, wait_nr ? IORING_ENTER_GETEVENTS : 0u, nullptr, 0);
+				if (ret == -1)
+				{
+					if (errno == EINTR)
+						continue;
+					if (consumed)
+						return consumed;
+					throw ::std::system_error{errno, ::std::system_category(), u8"io_uring_enter"};
+				}
+
+				waited = true;
+				consumed += static_cast<unsigned int>(ret);
+				if (!ret)
+					return consumed;
+			}
+		}
+
+		// Hands every available completion to function(io_uring_cqe const&) and marks them consumed. Returns how many
+		// there were.
+		template <typename Function>
+		unsigned int for_each_completion(Function&& function, unsigned int const max = ~0u)
+		{
+			unsigned int head = *m_cq_head;
+			unsigned int const tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+			unsigned int count = 0;
+			for (; head != tail && count < max; ++head, ++count)
+				function(static_cast<::io_uring_cqe const&>(m_cqes[head & m_cq_mask]));
+			__atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+			return count;
+		}
+
+		void register_buffers(::iovec const* const buffers, unsigned int const count) { enroll(IORING_REGISTER_BUFFERS, buffers, count, u8"IORING_REGISTER_BUFFERS"); }
+		void unregister_buffers() { enroll(IORING_UNREGISTER_BUFFERS, nullptr, 0, u8"IORING_UNREGISTER_BUFFERS"); }
+		void register_files(int const* const fds, unsigned int const count) { enroll(IORING_REGISTER_FILES, fds, count, u8"IORING_REGISTER_FILES"); }
+		void unregister_files() { enroll(IORING_UNREGISTER_FILES, nullptr, 0, u8"IORING_UNREGISTER_FILES"); }
+
+		// Whether the kernel implements opcode. Kernels before 5.6 cannot tell, and this returns false: io_uring_setup
+		// succeeds there even where IORING_OP_READ and IORING_OP_WRITE are missing, and such requests fail with EINVAL.
+		bool supports(::std::uint8_t const opcode) const noexcept
+		{
+			alignas(::io_uring_probe) unsigned char buffer[sizeof(::io_uring_probe) + 256 * sizeof(::io_uring_probe_op)] = {};
+			auto* const probe = reinterpret_cast<::io_uring_probe*>(buffer);
+			if (::syscall(SYS_io_uring_register, m_fd.get(), IORING_REGISTER_PROBE, probe, 256) == -1)
+				return false;
+			return opcode <= probe->last_op && (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED);
+		}
+
+		static void prepare(::io_uring_sqe& sqe, ::std::uint8_t const opcode, int const fd, void const* const address, ::std::uint32_t const length, ::std::uint64_t const offset) noexcept
+		{
+			sqe.opcode = opcode;
+			sqe.fd = fd;
+			sqe.addr = reinterpret_cast<::std::uintptr_t>(address);
+			sqe.len = length;
+			sqe.off = offset;
+		}
+
+	private:
+		void enroll(unsigned int const opcode, void const* const argument, unsigned int const count, char const* const what)
+		{
+			if (::syscall(SYS_io_uring_register, m_fd.get(), opcode, argument, count) == -1)
+				throw ::std::system_error{errno, ::std::system_category(), what};
+		}
+
+		FilePtr m_fd;
+		MemoryMapPtr m_sq_ring;
+		MemoryMapPtr m_cq_ring;
+		MemoryMapPtr m_sqe_map;
+
+		unsigned int* m_sq_head;
+		unsigned int* m_sq_tail;
+		unsigned int m_sq_mask;
+		unsigned int m_sq_entries;
+		::io_uring_sqe* m_sqes;
+		unsigned int m_sqe_tail; // next entry handed out by get_sqe()
+
+		unsigned int* m_cq_head;
+		unsigned int* m_cq_tail;
+		unsigned int m_cq_mask;
+		unsigned int m_cq_entries;
+		::io_uring_cqe* m_cqes;
+
+		unsigned int m_features;
+	};
+
+} // namespace ext
+
+#endif // !HEADER_EXT_IO_URING_HPP_INCLUDED
@@ -0,0 +1,94 @@
+/*
+ * Copyright 2017 Mahdi Khanalizadeh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef HEADER_EXT_LAZY_MEMORY_MAP_HPP_INCLUDED
+#define HEADER_EXT_LAZY_MEMORY_MAP_HPP_INCLUDED
+
+#include "file.hpp"
+#include "memory_map.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace ext
+{
+
+	// Produces the contents of [offset, offset + length) of a LazyMemoryMap into buffer. Both offset and length are
+	// multiples of the page size. Runs on the handler thread, so it must not touch unfilled pages of the same map, and
+	// concurrently on threads calling LazyMemoryMap::prefill().
+	using PageFiller = ::std::function<void(::std::size_t offset, void* buffer, ::std::size_t length)>;
+
+	// Anonymous memory whose pages are produced on first touch: the mapping is registered with userfaultfd and a
+	// handler thread answers each missing page fault by calling fill and installing the result atomically with
+	// UFFDIO_COPY. Creating the map costs the same whatever its size, and only touched pages (plus prefill_pages
+	// neighbours per fault, which saves a fault per page for sequential access) use memory. Pages are installed once;
+	// if prefill() and a fault race for a page, both may produce it but only one copy is kept.
+	//
+	// Where unprivileged userfaultfd is disabled the handler only sees faults from user space; system calls reading
+	// unfilled pages then fail with EFAULT instead of waiting.
+	class LazyMemoryMap
+	{
+	public:
+		LazyMemoryMap(::std::size_t length, PageFiller fill, ::std::size_t prefill_pages = 0);
+
+		// Stops the handler thread. No thread may touch unfilled pages any more.
+		~LazyMemoryMap() noexcept;
+
+		LazyMemoryMap(LazyMemoryMap const&) = delete;
+		LazyMemoryMap& operator=(LazyMemoryMap const&) = delete;
+
+		char* data() const noexcept { return static_cast<char*>(m_map->data()); }
+		::std::size_t size() const noexcept { return m_map->size(); }
+		MemoryMap const& map() const noexcept { return *m_map.operator->(); }
+
+		// Fills the unfilled pages of [offset, offset + length) from the calling thread ahead of access, for example
+		// from a ThreadPool to warm a range in parallel.
+		void prefill(::std::size_t offset, ::std::size_t length);
+
+		::std::size_t filled_pages() const noexcept { return m_filled.load(::std::memory_order_relaxed); }
+
+		// A fill that throws leaves zeros in its pages so the faulting thread can go on. Rethrows the first such error.
+		void check();
+
+	private:
+		void run() noexcept;
+		void handle_fault(::std::size_t page, void* buffer) noexcept;
+		void fill_range(::std::size_t first, ::std::size_t last, void* buffer);
+		void install(::std::size_t first, ::std::size_t last, void const* buffer);
+		bool present(::std::size_t const page) const noexcept { return __atomic_load_n(static_cast<unsigned char const*>(m_present->data()) + page, __ATOMIC_RELAXED); }
+		void set_present(::std::size_t const page) noexcept { __atomic_store_n(static_cast<unsigned char*>(m_present->data()) + page, 1, __ATOMIC_RELAXED); }
+
+		PageFiller const m_fill;
+		::std::size_t const m_page_size;
+		::std::size_t const m_batch; // pages per fault
+		MemoryMapPtr m_map;
+		FilePtr m_uffd;
+		FilePtr m_stop;
+		MemoryMapPtr m_present; // a byte per page, lazily zeroed by the kernel; only a hint since UFFDIO_COPY decides who fills a page
+		::std::atomic<::std::size_t> m_filled{0};
+		::std::mutex m_mutex;
+		::std::exception_ptr m_error;
+		::std::thread m_thread;
+	};
+
+} // namespace ext
+
+#endif // !HEADER_EXT_LAZY_MEMORY_MAP_HPP_INCLUDED
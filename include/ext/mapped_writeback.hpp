@@ -0,0 +1,114 @@
+/*
+ * Copyright 2017 Mahdi Khanalizadeh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef HEADER_EXT_MAPPED_WRITEBACK_HPP_INCLUDED
+#define HEADER_EXT_MAPPED_WRITEBACK_HPP_INCLUDED
+
+#include "file.hpp"
+#include "memory_map.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include <sys/types.h>
+
+namespace ext
+{
+
+	struct WritebackOptions
+	{
+		// How often dirty ranges are handed to the kernel for writeback.
+		::std::chrono::milliseconds interval{100};
+
+		// Starts writeback early once this many bytes are dirty, which keeps bursts from piling up dirty pages.
+		::std::size_t dirty_limit = 64 * 1024 * 1024;
+	};
+
+	// Tracks which parts of a writable shared mapping were modified and writes back only those. Writers report
+	// changes with mark_dirty(); a background thread coalesces the ranges and periodically starts writeback for them,
+	// and checkpoint()/wait() make everything marked so far durable. With the file known that is writeback of all
+	// dirty ranges, waiting for each and one fdatasync(); otherwise msync(MS_SYNC) per range. Either way a checkpoint
+	// costs what changed rather than the size of the mapping. Thread safe.
+	class MappedWriteback
+	{
+	public:
+		// Background writeback with msync(MS_ASYNC). Linux treats that as a no-op since dirty pages are tracked anyway,
+		// so only checkpoints write anything; pass the file to get real background writeback.
+		explicit MappedWriteback(MemoryMap const& map, WritebackOptions const& options = WritebackOptions{});
+
+		// Background writeback with sync_file_range(SYNC_FILE_RANGE_WRITE). map must map file starting at file_offset,
+		// and file must stay open while this object exists.
+		MappedWriteback(MemoryMap const& map, FilePtr const& file, ::off_t file_offset, WritebackOptions const& options = WritebackOptions{});
+
+		// Makes outstanding changes durable, ignoring errors; call sync() first to see them.
+		~MappedWriteback() noexcept;
+
+		MappedWriteback(MappedWriteback const&) = delete;
+		MappedWriteback& operator=(MappedWriteback const&) = delete;
+
+		// Records that [offset, offset + length) of the mapping was modified. Call it after the stores.
+		void mark_dirty(::std::size_t offset, ::std::size_t length);
+
+		// Asks for everything marked dirty so far to be made durable and returns a ticket for wait().
+		::std::uint64_t checkpoint();
+
+		// Blocks until the checkpoint with the given ticket is durable. Rethrows a writeback error.
+		void wait(::std::uint64_t ticket);
+
+		// Durability barrier: wait(checkpoint()).
+		void sync() { wait(checkpoint()); }
+
+		// Bytes marked dirty that writeback was not started for yet.
+		::std::size_t dirty_bytes() const;
+
+	private:
+		using Ranges = ::std::map<::std::size_t, ::std::size_t>; // page aligned [first, last) keyed by first
+
+		static void add_range(Ranges& ranges, ::std::size_t first, ::std::size_t last);
+		void run() noexcept;
+		void start_writeback(Ranges const& ranges);
+		void make_durable(Ranges const& ranges);
+
+		char* const m_data;
+		::std::size_t const m_size;
+		int const m_fd = -1;
+		::off_t const m_file_offset = 0;
+		WritebackOptions const m_options;
+
+		mutable ::std::mutex m_mutex;
+		::std::condition_variable m_wake;
+		::std::condition_variable m_done;
+		Ranges m_dirty;    // writeback not started
+		Ranges m_unsynced; // writeback started, not durable
+		::std::size_t m_dirty_bytes = 0;
+		::std::uint64_t m_requested = 0;
+		::std::uint64_t m_completed = 0;
+		::std::exception_ptr m_error;
+		bool m_stop = false;
+		::std::thread m_thread;
+	};
+
+} // namespace ext
+
+#endif // !HEADER_EXT_MAPPED_WRITEBACK_HPP_INCLUDED
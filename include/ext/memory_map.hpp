@@ -21,11 +21,14 @@
 
 #include <cassert>
 #include <cerrno>
+#include <cstddef>
+#include <cstdint>
 
 #include <utility>
 #include <system_error>
 
 #include <sys/mman.h>
+#include <unistd.h>
 
 namespace ext
 {
@@ -40,8 +43,47 @@ namespace ext
 			static void destroy(RawHandle const& handle) noexcept { ::munmap(handle.first, handle.second); }
 		};
 
+		inline ::std::size_t page_size() noexcept
+		{
+			static ::std::size_t const size = static_cast<::std::size_t>(::sysconf(_SC_PAGESIZE));
+			return size;
+		}
+
+		// MADV_POPULATE_READ/WRITE (Linux 5.14) fault in a range with one syscall; older kernels get one access per
+		// page. Write faults touch each page with an atomic add of zero so concurrent writers are not disturbed.
+		inline void populate(char* const address, ::std::size_t const length, bool const write)
+		{
+			char* const begin = reinterpret_cast<char*>(reinterpret_cast<::std::uintptr_t>(address) & ~(page_size() - 1));
+			char* const end = address + length;
+			if (begin == end)
+				return;
+
+#ifdef MADV_POPULATE_READ
+			if (::madvise(begin, static_cast<::std::size_t>(end - begin), write ? MADV_POPULATE_WRITE : MADV_POPULATE_READ) == 0)
+				return;
+			if (errno != EINVAL)
+				throw ::std::system_error{errno, ::std::system_category(), u8"madvise(MADV_POPULATE)"};
+#endif
+
+			for (char* page = begin; page < end; page += page_size())
+			{
+				if (write)
+					__atomic_fetch_add(page, 0, __ATOMIC_RELAXED);
+				else
+					static_cast<void>(*static_cast<char const volatile*>(page));
+			}
+		}
+
 	} // namespace detail
 
+	enum class HugePages
+	{
+		None,
+		Transparent, // MADV_HUGEPAGE: the kernel backs the mapping with huge pages where it can
+		Explicit,    // MAP_HUGETLB: fails unless enough huge pages are reserved (vm.nr_hugepages)
+		Preferred,   // Explicit, falling back to Transparent
+	};
+
 	class MemoryMap :
 		public Handle<detail::MemoryMapTraits>
 	{
@@ -57,6 +99,21 @@ namespace ext
 				throw ::std::system_error{errno, ::std::system_category(), u8"mmap"};
 		}
 
+		// Mappings have no short transfers, so the error_code overloads are all that is needed for exception free use.
+		void map(void* addr, size_t length, int prot, int flags, int fd, off_t offset, ::std::error_code& ec) noexcept
+		{
+			assert(raw_handle() == Traits::invalid());
+
+			void* const address = ::mmap(addr, length, prot, flags, fd, offset);
+			if (address == MAP_FAILED)
+			{
+				ec.assign(errno, ::std::system_category());
+				return;
+			}
+			m_raw_handle = ::std::make_pair(address, length);
+			ec.clear();
+		}
+
 		void unmap()
 		{
 			assert(raw_handle() != Traits::invalid());
@@ -66,6 +123,115 @@ namespace ext
 				throw ::std::system_error{errno, ::std::system_category(), u8"munmap"};
 			m_raw_handle = Traits::invalid();
 		}
+
+		void unmap(::std::error_code& ec) noexcept
+		{
+			assert(raw_handle() != Traits::invalid());
+
+			if (::munmap(m_raw_handle.first, m_raw_handle.second) == -1)
+			{
+				ec.assign(errno, ::std::system_category());
+				return;
+			}
+			m_raw_handle = Traits::invalid();
+			ec.clear();
+		}
+
+		// Resizes the mapping with mremap(). With MREMAP_MAYMOVE the kernel may move it, which invalidates pointers
+		// into it but never copies the pages.
+		void remap(::std::size_t const length, int const flags = MREMAP_MAYMOVE)
+		{
+			assert(raw_handle() != Traits::invalid());
+
+			void* const address = ::mremap(m_raw_handle.first, m_raw_handle.second, length, flags);
+			if (address == MAP_FAILED)
+				throw ::std::system_error{errno, ::std::system_category(), u8"mremap"};
+			m_raw_handle = ::std::make_pair(address, length);
+		}
+
+		void* data() const noexcept { return raw_handle().first; }
+		::std::size_t size() const noexcept { return raw_handle().second; }
+
+		// Flags for map() that request explicit huge pages of page_size bytes (a power of two, 0 for the default
+		// size, typically 2 MiB). Also pass length as a multiple of the page size.
+		static int huge_page_flags(::std::size_t const page_size = 0) noexcept
+		{
+			int shift = 0;
+			while (page_size >> shift > 1)
+				++shift;
+			return MAP_HUGETLB | (page_size ? shift << MAP_HUGE_SHIFT : 0);
+		}
+
+		// Private anonymous memory, optionally backed by huge pages. With populate every page is faulted in up front
+		// (MAP_POPULATE), which is slower to map but faster to use.
+		void map_anonymous(::std::size_t const length, int const prot = PROT_READ | PROT_WRITE, HugePages const huge_pages = HugePages::None, bool const populate = false)
+		{
+			int const flags = MAP_PRIVATE | MAP_ANONYMOUS | (populate ? MAP_POPULATE : 0);
+			if (huge_pages == HugePages::Explicit || huge_pages == HugePages::Preferred)
+			{
+				::std::error_code ec;
+				map(nullptr, length, prot, flags | huge_page_flags(), -1, 0, ec);
+				if (!ec)
+					return;
+				if (huge_pages == HugePages::Explicit)
+					throw ::std::system_error{ec, u8"mmap(MAP_HUGETLB)"};
+			}
+
+			map(nullptr, length, prot, flags, -1, 0);
+			if (huge_pages != HugePages::None)
+				madvise(MADV_HUGEPAGE);
+		}
+
+		// Passes advice for [offset, offset + length) to the kernel: MADV_SEQUENTIAL and MADV_RANDOM tune readahead,
+		// MADV_WILLNEED starts reading, MADV_DONTNEED and MADV_FREE release pages, MADV_HUGEPAGE enables transparent
+		// huge pages. offset must be page aligned.
+		void madvise(::std::size_t const offset, ::std::size_t const length, int const advice)
+		{
+			assert(raw_handle() != Traits::invalid());
+			assert(offset % detail::page_size() == 0);
+			assert(offset + length <= size());
+
+			if (::madvise(static_cast<char*>(data()) + offset, length, advice) == -1)
+				throw ::std::system_error{errno, ::std::system_category(), u8"madvise"};
+		}
+
+		void madvise(int const advice) { madvise(0, size(), advice); }
+
+		// Keeps [offset, offset + length) resident. With on_fault pages are locked as they are touched instead of all
+		// at once (Linux 4.4). Subject to RLIMIT_MEMLOCK.
+		void lock(::std::size_t const offset, ::std::size_t const length, bool const on_fault = false)
+		{
+			assert(raw_handle() != Traits::invalid());
+			assert(offset + length <= size());
+
+			void* const address = static_cast<char*>(data()) + offset;
+#ifdef MLOCK_ONFAULT
+			int const ret = on_fault ? ::mlock2(address, length, MLOCK_ONFAULT) : ::mlock(address, length);
+#else
+			int const ret = on_fault ? (errno = ENOSYS, -1) : ::mlock(address, length);
+#endif
+			if (ret == -1)
+				throw ::std::system_error{errno, ::std::system_category(), u8"mlock"};
+		}
+
+		void unlock(::std::size_t const offset, ::std::size_t const length)
+		{
+			assert(raw_handle() != Traits::invalid());
+			assert(offset + length <= size());
+
+			if (::munlock(static_cast<char*>(data()) + offset, length) == -1)
+				throw ::std::system_error{errno, ::std::system_category(), u8"munlock"};
+		}
+
+		// Faults in [offset, offset + length) on the calling thread, for writing if write is set, so later accesses
+		// do not take page faults. See prefault() in prefault.hpp for doing this on many threads.
+		void populate(::std::size_t const offset, ::std::size_t const length, bool const write = false)
+		{
+			assert(raw_handle() != Traits::invalid());
+			assert(offset + length <= size());
+
+			detail::populate(static_cast<char*>(data()) + offset, length, write);
+		}
 	};
 
 	using MemoryMapPtr = HandlePtr<MemoryMap>;
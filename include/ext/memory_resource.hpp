@@ -0,0 +1,100 @@
+/*
+ * Copyright 2017 Mahdi Khanalizadeh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef HEADER_EXT_MEMORY_RESOURCE_HPP_INCLUDED
+#define HEADER_EXT_MEMORY_RESOURCE_HPP_INCLUDED
+
+#include "arena.hpp"
+
+#include <cstddef>
+
+// Polymorphic allocators are standard since C++17; C++14 standard libraries ship them as a TS.
+#if __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#define EXT_PMR_NAMESPACE ::std::pmr
+#endif
+#endif
+
+#if !defined(EXT_PMR_NAMESPACE)
+#include <experimental/memory_resource>
+#define EXT_PMR_NAMESPACE ::std::experimental::pmr
+#endif
+
+namespace ext
+{
+
+	namespace pmr = EXT_PMR_NAMESPACE;
+
+	// Lets standard containers allocate from an Arena, e.g. pmr::vector<int> v{&resource}. Deallocation is a no-op;
+	// the memory comes back with Arena::reset().
+	class ArenaResource :
+		public pmr::memory_resource
+	{
+	public:
+		explicit ArenaResource(Arena& arena) noexcept : m_arena(arena) {}
+
+		Arena& arena() const noexcept { return m_arena; }
+
+	private:
+		void* do_allocate(::std::size_t const bytes, ::std::size_t const alignment) override { return m_arena.allocate(bytes, alignment); }
+		void do_deallocate(void*, ::std::size_t, ::std::size_t) override {}
+		bool do_is_equal(pmr::memory_resource const& other) const noexcept override { return this == &other; }
+
+		Arena& m_arena;
+	};
+
+	// Serves requests that fit a Pool block from the pool and passes everything else to upstream, so node based
+	// containers (list, map, unordered_map nodes) use the pool while their occasional bucket arrays do not.
+	class PoolResource :
+		public pmr::memory_resource
+	{
+	public:
+		explicit PoolResource(Pool& pool, pmr::memory_resource* const upstream = pmr::get_default_resource()) noexcept :
+			m_pool(pool),
+			m_upstream{upstream}
+		{
+		}
+
+		Pool& pool() const noexcept { return m_pool; }
+		pmr::memory_resource* upstream_resource() const noexcept { return m_upstream; }
+
+	private:
+		bool fits(::std::size_t const bytes, ::std::size_t const alignment) const noexcept { return bytes <= m_pool.block_size() && alignment <= m_pool.alignment(); }
+
+		void* do_allocate(::std::size_t const bytes, ::std::size_t const alignment) override
+		{
+			return fits(bytes, alignment) ? m_pool.allocate() : m_upstream->allocate(bytes, alignment);
+		}
+
+		void do_deallocate(void* const pointer, ::std::size_t const bytes, ::std::size_t const alignment) override
+		{
+			if (fits(bytes, alignment))
+				m_pool.deallocate(pointer);
+			else
+				m_upstream->deallocate(pointer, bytes, alignment);
+		}
+
+		bool do_is_equal(pmr::memory_resource const& other) const noexcept override { return this == &other; }
+
+		Pool& m_pool;
+		pmr::memory_resource* const m_upstream;
+	};
+
+} // namespace ext
+
+#endif // !HEADER_EXT_MEMORY_RESOURCE_HPP_INCLUDED
@@ -0,0 +1,336 @@
+/*
+ * Copyright 2017 Mahdi Khanalizadeh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HEADER_EXT_PER_CPU_HPP_INCLUDED
+#define HEADER_EXT_PER_CPU_HPP_INCLUDED
+
+#include "cache_line.hpp"
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+
+#include <atomic>
+#include <iterator>
+#include <mutex>
+#include <new>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include <sched.h>
+#include <unistd.h>
+
+namespace ext
+{
+
+	// Number of processors the kernel may ever schedule on; processor indices are below this value.
+	inline unsigned int possible_cpus() noexcept
+	{
+		static unsigned int const count = []
+		{
+			long const ret = ::sysconf(_SC_NPROCESSORS_CONF);
+			return ret > 0 ? static_cast<unsigned int>(ret) : 1u;
+		}();
+		return count;
+	}
+
+	// Processor the calling thread runs on right now. The thread may migrate immediately afterwards, so the value is
+	// only a hint for picking a shard. With glibc 2.35 and later this is a read from the thread's rseq area.
+	inline unsigned int current_cpu() noexcept
+	{
+		int const cpu = ::sched_getcpu();
+		return cpu < 0 ? 0u : static_cast<unsigned int>(cpu);
+	}
+
+	// One T per possible processor, each on its own cache lines.
+	template <typename T>
+	class PerCpu
+	{
+	public:
+		template <typename... Args>
+		explicit PerCpu(Args const&... args) :
+			m_count{possible_cpus()}
+		{
+			void* memory;
+			int const ret = ::posix_memalign(&memory, cache_line_size, m_count * stride);
+			if (ret)
+				throw ::std::system_error{ret, ::std::system_category(), u8"posix_memalign"};
+			m_slots = static_cast<unsigned char*>(memory);
+
+			unsigned int i = 0;
+			try
+			{
+				for (; i < m_count; ++i)
+					::new (static_cast<void*>(m_slots + i * stride)) T(args...);
+			}
+			catch (...)
+			{
+				while (i--)
+					(*this)[i].~T();
+				::free(m_slots);
+				throw;
+			}
+		}
+
+		~PerCpu() noexcept
+		{
+			for (unsigned int i = 0; i < m_count; ++i)
+				(*this)[i].~T();
+			::free(m_slots);
+		}
+
+		PerCpu(PerCpu const&) = delete;
+		PerCpu& operator=(PerCpu const&) = delete;
+
+		unsigned int size() const noexcept { return m_count; }
+
+		T& operator[](unsigned int const cpu) noexcept { assert(cpu < m_count); return *reinterpret_cast<T*>(m_slots + cpu * stride); }
+		T const& operator[](unsigned int const cpu) const noexcept { assert(cpu < m_count); return *reinterpret_cast<T const*>(m_slots + cpu * stride); }
+
+		// Slot of the processor the calling thread runs on.
+		T& local() noexcept { return (*this)[current_cpu() % m_count]; }
+
+		template <typename Function>
+		void for_each(Function&& function)
+		{
+			for (unsigned int i = 0; i < m_count; ++i)
+				function((*this)[i]);
+		}
+
+		template <typename Function>
+		void for_each(Function&& function) const
+		{
+			for (unsigned int i = 0; i < m_count; ++i)
+				function((*this)[i]);
+		}
+
+	private:
+		static constexpr ::std::size_t stride = (sizeof(T) + cache_line_size - 1) / cache_line_size * cache_line_size;
+		static_assert(alignof(T) <= cache_line_size, "T is over-aligned");
+
+		unsigned int const m_count;
+		unsigned char* m_slots;
+	};
+
+	// A counter that scales with the number of writers: every processor increments its own shard and reads sum all
+	// shards. Threads can migrate between picking a shard and updating it, so the shards are still updated
+	// atomically, but the update almost never contends.
+	class ShardedCounter
+	{
+	public:
+		ShardedCounter() : m_shards{::std::int64_t{0}} {}
+
+		void add(::std::int64_t const value) noexcept { m_shards.local().fetch_add(value, ::std::memory_order_relaxed); }
+		void increment() noexcept { add(1); }
+		void decrement() noexcept { add(-1); }
+
+		// Not a snapshot: concurrent updates may or may not be included.
+		::std::int64_t load() const noexcept
+		{
+			::std::int64_t sum = 0;
+			m_shards.for_each([&](::std::atomic<::std::int64_t> const& shard){ sum += shard.load(::std::memory_order_relaxed); });
+			return sum;
+		}
+
+		// Returns the sum and resets all shards to zero without losing concurrent updates.
+		::std::int64_t exchange() noexcept
+		{
+			::std::int64_t sum = 0;
+			m_shards.for_each([&](::std::atomic<::std::int64_t>& shard){ sum += shard.exchange(0, ::std::memory_order_relaxed); });
+			return sum;
+		}
+
+	private:
+		PerCpu<::std::atomic<::std::int64_t>> m_shards;
+	};
+
+	namespace detail
+	{
+
+		inline void cpu_relax() noexcept
+		{
+#if defined(__x86_64__) || defined(__i386__)
+			__builtin_ia32_pause();
+#elif defined(__aarch64__)
+			asm volatile("yield");
+#endif
+		}
+
+		// Spins on a read-only load so waiters do not bounce the cache line, and yields after a while in case the holder
+		// was preempted.
+		class SpinLock
+		{
+		public:
+			void lock() noexcept
+			{
+				for (unsigned int spins = 0; m_locked.exchange(true, ::std::memory_order_acquire); )
+				{
+					while (m_locked.load(::std::memory_order_relaxed))
+					{
+						if (++spins < 64)
+							cpu_relax();
+						else
+							::sched_yield();
+					}
+				}
+			}
+			bool try_lock() noexcept { return !m_locked.load(::std::memory_order_relaxed) && !m_locked.exchange(true, ::std::memory_order_acquire); }
+			void unlock() noexcept { m_locked.store(false, ::std::memory_order_release); }
+
+		private:
+			::std::atomic<bool> m_locked{false};
+		};
+
+		// Makes room for one more element in items, which lock protects, without allocating while holding the lock.
+		// The previous storage ends up in spare, to be freed after unlocking.
+		template <typename T>
+		void reserve_one(::std::unique_lock<SpinLock>& lock, ::std::vector<T>& items, ::std::vector<T>& spare)
+		{
+			while (items.size() == items.capacity())
+			{
+				::std::size_t const capacity = items.capacity() ? items.capacity() * 2 : 16;
+				lock.unlock();
+				::std::vector<T>{}.swap(spare);
+				spare.reserve(capacity);
+				lock.lock();
+
+				if (items.size() == items.capacity() && spare.capacity() > items.size())
+				{
+					spare.insert(spare.end(), ::std::make_move_iterator(items.begin()), ::std::make_move_iterator(items.end()));
+					items.swap(spare);
+					spare.clear();
+				}
+			}
+		}
+
+	} // namespace detail
+
+	// Caches free objects per processor. The per processor locks are practically never contended; pop() falls back to
+	// the other processors' lists before reporting empty.
+	template <typename T>
+	class PerCpuFreelist
+	{
+	public:
+		explicit PerCpuFreelist(::std::size_t const max_per_cpu = 1024) : m_max{max_per_cpu} {}
+
+		// Returns false if the local list is full; the caller keeps ownership in that case.
+		bool push(T* const item)
+		{
+			List& list = m_lists.local();
+			::std::vector<T*> spare;
+			::std::unique_lock<detail::SpinLock> lock{list.lock};
+			if (list.items.size() >= m_max)
+				return false;
+			detail::reserve_one(lock, list.items, spare);
+			if (list.items.size() >= m_max)
+				return false;
+			list.items.push_back(item);
+			return true;
+		}
+
+		T* pop() noexcept
+		{
+			unsigned int const self = current_cpu() % m_lists.size();
+			for (unsigned int i = 0; i < m_lists.size(); ++i)
+			{
+				List& list = m_lists[(self + i) % m_lists.size()];
+				::std::lock_guard<detail::SpinLock> lock{list.lock};
+				if (!list.items.empty())
+				{
+					T* const item = list.items.back();
+					list.items.pop_back();
+					return item;
+				}
+			}
+			return nullptr;
+		}
+
+		// Hands every cached object to function, e.g. for deleting them.
+		template <typename Function>
+		void drain(Function&& function)
+		{
+			m_lists.for_each([&](List& list)
+			{
+				::std::vector<T*> items;
+				{
+					::std::lock_guard<detail::SpinLock> lock{list.lock};
+					items.swap(list.items);
+				}
+				for (T* const item : items)
+					function(item);
+			});
+		}
+
+	private:
+		struct List
+		{
+			detail::SpinLock lock;
+			::std::vector<T*> items;
+		};
+
+		::std::size_t const m_max;
+		PerCpu<List> m_lists;
+	};
+
+	// Collects records per processor without a shared lock; drain() gathers them, e.g. for a periodic flush of trace
+	// events or statistics.
+	template <typename T>
+	class PerCpuBuffer
+	{
+	public:
+		// Constructs the record and makes room for it before taking the lock, so allocations never happen under it.
+		template <typename... Args>
+		void emplace(Args&&... args)
+		{
+			T item(::std::forward<Args>(args)...);
+			Buffer& buffer = m_buffers.local();
+			::std::vector<T> spare;
+			::std::unique_lock<detail::SpinLock> lock{buffer.lock};
+			detail::reserve_one(lock, buffer.items, spare);
+			buffer.items.push_back(::std::move(item));
+		}
+
+		// Calls function(std::vector<T>&) once per processor with everything recorded since the last drain().
+		template <typename Function>
+		void drain(Function&& function)
+		{
+			m_buffers.for_each([&](Buffer& buffer)
+			{
+				::std::vector<T> items;
+				{
+					::std::lock_guard<detail::SpinLock> lock{buffer.lock};
+					items.swap(buffer.items);
+				}
+				if (!items.empty())
+					function(items);
+			});
+		}
+
+	private:
+		struct Buffer
+		{
+			detail::SpinLock lock;
+			::std::vector<T> items;
+		};
+
+		PerCpu<Buffer> m_buffers;
+	};
+
+} // namespace ext
+
+#endif // !HEADER_EXT_PER_CPU_HPP_INCLUDED
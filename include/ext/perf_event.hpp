@@ -0,0 +1,325 @@
+/*
+ * Copyright 2017 Mahdi Khanalizadeh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HEADER_EXT_PERF_EVENT_HPP_INCLUDED
+#define HEADER_EXT_PERF_EVENT_HPP_INCLUDED
+
+#include "handle.hpp"
+#include "file.hpp"
+
+#include <cassert>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <array>
+#include <chrono>
+#include <initializer_list>
+#include <system_error>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+namespace ext
+{
+
+	// A single perf event. Perf events are file descriptors, so this shares File's traits.
+	class PerfEvent :
+		public Handle<detail::FileTraits>
+	{
+	public:
+		using Handle::Handle; // import ctors
+
+		void open(::perf_event_attr& attr, ::pid_t const pid, int const cpu, int const group_fd, unsigned long const flags)
+		{
+			assert(raw_handle() == Traits::invalid());
+
+			m_raw_handle = static_cast<int>(::syscall(SYS_perf_event_open, &attr, pid, cpu, group_fd, flags));
+			if (raw_handle() == Traits::invalid())
+				throw ::std::system_error{errno, ::std::system_category(), u8"perf_event_open"};
+		}
+
+		void close()
+		{
+			assert(raw_handle() != Traits::invalid());
+
+			auto const ret = ::close(raw_handle());
+			if (ret == -1)
+				throw ::std::system_error{errno, ::std::system_category(), u8"close"};
+			m_raw_handle = Traits::invalid();
+		}
+
+		// With group set the operation applies to every event of the group this event leads.
+		void enable(bool const group = false) { control(PERF_EVENT_IOC_ENABLE, group, u8"PERF_EVENT_IOC_ENABLE"); }
+		void disable(bool const group = false) { control(PERF_EVENT_IOC_DISABLE, group, u8"PERF_EVENT_IOC_DISABLE"); }
+		void reset(bool const group = false) { control(PERF_EVENT_IOC_RESET, group, u8"PERF_EVENT_IOC_RESET"); }
+
+		::std::uint64_t id()
+		{
+			assert(raw_handle() != Traits::invalid());
+
+			::std::uint64_t ret;
+			if (::ioctl(raw_handle(), PERF_EVENT_IOC_ID, &ret) == -1)
+				throw ::std::system_error{errno, ::std::system_category(), u8"PERF_EVENT_IOC_ID"};
+			return ret;
+		}
+
+		::std::size_t read(void* const buffer, ::std::size_t const count)
+		{
+			assert(raw_handle() != Traits::invalid());
+
+			auto const ret = ::read(raw_handle(), buffer, count);
+			if (ret == -1)
+				throw ::std::system_error{errno, ::std::system_category(), u8"read"};
+			return static_cast<::std::size_t>(ret);
+		}
+
+	private:
+		void control(unsigned long const request, bool const group, char const* const what)
+		{
+			assert(raw_handle() != Traits::invalid());
+
+			if (::ioctl(raw_handle(), request, group ? static_cast<unsigned int>(PERF_IOC_FLAG_GROUP) : 0u) == -1)
+				throw ::std::system_error{errno, ::std::system_category(), what};
+		}
+	};
+
+	using PerfEventPtr = HandlePtr<PerfEvent>;
+
+	enum class PerfCounter
+	{
+		Cycles,
+		Instructions,
+		CacheReferences,
+		CacheMisses,
+		BranchInstructions,
+		BranchMisses,
+		StalledCyclesFrontend,
+		StalledCyclesBackend,
+		L1DReadMisses,
+		LLCReadMisses,
+		DTLBReadMisses,
+		TaskClock,
+		ContextSwitches,
+		PageFaults,
+	};
+
+	struct PerfReading
+	{
+		static constexpr ::std::size_t max_counters = 8;
+
+		::std::chrono::nanoseconds elapsed{0};
+		::std::uint64_t time_enabled = 0;
+		::std::uint64_t time_running = 0;
+		::std::size_t count = 0;
+		::std::array<PerfCounter, max_counters> counters{};
+		::std::array<bool, max_counters> valid{};
+		// Values are scaled by time_enabled / time_running to make up for multiplexing.
+		::std::array<::std::uint64_t, max_counters> values{};
+
+		// Returns false if the counter was not requested or could not be opened.
+		bool get(PerfCounter const counter, ::std::uint64_t& value) const noexcept
+		{
+			for (::std::size_t i = 0; i < count; ++i)
+			{
+				if (counters[i] == counter && valid[i])
+				{
+					value = values[i];
+					return true;
+				}
+			}
+			return false;
+		}
+
+		// Fraction of the enabled time the counters were actually on the PMU; below 1 the values are estimates.
+		double coverage() const noexcept { return time_enabled ? static_cast<double>(time_running) / static_cast<double>(time_enabled) : 0.0; }
+	};
+
+	// Measures a set of hardware counters as one perf group, so they are scheduled onto the PMU together and can be
+	// read with a single read(). If perf_event_open is not permitted (perf_event_paranoid, seccomp, missing PMU in a
+	// VM) the group degrades to measuring wall clock time only.
+	class PerfCounterGroup
+	{
+	public:
+		// pid == 0 && cpu == -1 measures the calling thread on any processor, pid == -1 && cpu >= 0 measures every
+		// thread on one processor (usually requires CAP_PERFMON).
+		explicit PerfCounterGroup(
+			::std::initializer_list<PerfCounter> const counters = {PerfCounter::Cycles, PerfCounter::Instructions, PerfCounter::CacheMisses, PerfCounter::BranchMisses},
+			::pid_t const pid = 0, int const cpu = -1, bool const include_kernel = false)
+		{
+			assert(counters.size() <= PerfReading::max_counters);
+
+			for (PerfCounter const counter : counters)
+			{
+				if (m_count == PerfReading::max_counters)
+					break;
+				m_counters[m_count] = counter;
+
+				::perf_event_attr attr;
+				::std::memset(&attr, 0, sizeof attr);
+				attr.size = sizeof attr;
+				describe(counter, attr);
+				attr.disabled = available() ? 0 : 1; // only the leader controls the group
+				attr.exclude_kernel = include_kernel ? 0 : 1;
+				attr.exclude_hv = 1;
+				attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_ID | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+				try
+				{
+					PerfEventPtr event;
+					event->open(attr, pid, cpu, available() ? *m_events[m_leader] : -1, PERF_FLAG_FD_CLOEXEC);
+					m_ids[m_count] = event->id();
+					m_events[m_count] = ::std::move(event);
+					if (!available())
+						m_leader = m_count;
+				}
+				catch (::std::system_error const& e)
+				{
+					// A counter that cannot be opened (e.g. Cycles without a PMU in a VM) is skipped, and the next one
+					// tries to lead the group instead. Only the first error is kept.
+					if (!available() && !m_error)
+						m_error = e.code();
+				}
+				++m_count;
+			}
+		}
+
+		// False if the group fell back to clock-only timing because none of the counters could be opened.
+		bool available() const noexcept { return m_leader != PerfReading::max_counters; }
+
+		// Why the first counter tried as leader failed to open; the reason the group is not available if it is not.
+		::std::error_code const& error() const noexcept { return m_error; }
+
+		void start()
+		{
+			if (available())
+			{
+				m_events[m_leader]->reset(true);
+				m_events[m_leader]->enable(true);
+			}
+			m_start = ::std::chrono::steady_clock::now();
+		}
+
+		PerfReading stop()
+		{
+			auto const now = ::std::chrono::steady_clock::now();
+			if (available())
+				m_events[m_leader]->disable(true);
+			return reading(now);
+		}
+
+		// Reads the counters without stopping them.
+		PerfReading read()
+		{
+			return reading(::std::chrono::steady_clock::now());
+		}
+
+	private:
+		static void describe(PerfCounter const counter, ::perf_event_attr& attr) noexcept
+		{
+			auto const cache = [&](::std::uint64_t const cache_id)
+			{
+				attr.type = PERF_TYPE_HW_CACHE;
+				attr.config = cache_id | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+			};
+
+			attr.type = PERF_TYPE_HARDWARE;
+			switch (counter)
+			{
+				case PerfCounter::Cycles: attr.config = PERF_COUNT_HW_CPU_CYCLES; break;
+				case PerfCounter::Instructions: attr.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+				case PerfCounter::CacheReferences: attr.config = PERF_COUNT_HW_CACHE_REFERENCES; break;
+				case PerfCounter::CacheMisses: attr.config = PERF_COUNT_HW_CACHE_MISSES; break;
+				case PerfCounter::BranchInstructions: attr.config = PERF_COUNT_HW_BRANCH_INSTRUCTIONS; break;
+				case PerfCounter::BranchMisses: attr.config = PERF_COUNT_HW_BRANCH_MISSES; break;
+				case PerfCounter::StalledCyclesFrontend: attr.config = PERF_COUNT_HW_STALLED_CYCLES_FRONTEND; break;
+				case PerfCounter::StalledCyclesBackend: attr.config = PERF_COUNT_HW_STALLED_CYCLES_BACKEND; break;
+				case PerfCounter::L1DReadMisses: cache(PERF_COUNT_HW_CACHE_L1D); break;
+				case PerfCounter::LLCReadMisses: cache(PERF_COUNT_HW_CACHE_LL); break;
+				case PerfCounter::DTLBReadMisses: cache(PERF_COUNT_HW_CACHE_DTLB); break;
+				case PerfCounter::TaskClock: attr.type = PERF_TYPE_SOFTWARE; attr.config = PERF_COUNT_SW_TASK_CLOCK; break;
+				case PerfCounter::ContextSwitches: attr.type = PERF_TYPE_SOFTWARE; attr.config = PERF_COUNT_SW_CONTEXT_SWITCHES; break;
+				case PerfCounter::PageFaults: attr.type = PERF_TYPE_SOFTWARE; attr.config = PERF_COUNT_SW_PAGE_FAULTS; break;
+			}
+		}
+
+		PerfReading reading(::std::chrono::steady_clock::time_point const now)
+		{
+			PerfReading ret;
+			ret.elapsed = ::std::chrono::duration_cast<::std::chrono::nanoseconds>(now - m_start);
+			ret.count = m_count;
+			ret.counters = m_counters;
+			if (!available())
+				return ret;
+
+			// struct read_format { u64 nr; u64 time_enabled; u64 time_running; struct { u64 value; u64 id; } values[nr]; }
+			::std::uint64_t buffer[3 + 2 * PerfReading::max_counters];
+			m_events[m_leader]->read(buffer, sizeof buffer);
+			ret.time_enabled = buffer[1];
+			ret.time_running = buffer[2];
+
+			for (::std::uint64_t i = 0; i < buffer[0] && i < PerfReading::max_counters; ++i)
+			{
+				::std::uint64_t const value = buffer[3 + 2 * i];
+				::std::uint64_t const id = buffer[4 + 2 * i];
+				for (::std::size_t j = 0; j < m_count; ++j)
+				{
+					if (m_events[j] && m_ids[j] == id)
+					{
+						ret.valid[j] = true;
+						ret.values[j] = ret.time_running && ret.time_running < ret.time_enabled
+							? static_cast<::std::uint64_t>(static_cast<double>(value) * static_cast<double>(ret.time_enabled) / static_cast<double>(ret.time_running))
+							: value;
+					}
+				}
+			}
+			return ret;
+		}
+
+		::std::size_t m_count = 0;
+		::std::size_t m_leader = PerfReading::max_counters; // the first counter that opened
+		::std::array<PerfCounter, PerfReading::max_counters> m_counters{};
+		::std::array<PerfEventPtr, PerfReading::max_counters> m_events;
+		::std::array<::std::uint64_t, PerfReading::max_counters> m_ids{};
+		::std::error_code m_error;
+		::std::chrono::steady_clock::time_point m_start = ::std::chrono::steady_clock::now();
+	};
+
+	// Measures the enclosing scope and stores the result in reading when it ends.
+	class PerfScope
+	{
+	public:
+		PerfScope(PerfCounterGroup& group, PerfReading& reading) : m_group(group), m_reading(reading) { m_group.start(); }
+		~PerfScope() noexcept
+		{
+			try { m_reading = m_group.stop(); } catch (...) {}
+		}
+
+		PerfScope(PerfScope const&) = delete;
+		PerfScope& operator=(PerfScope const&) = delete;
+
+	private:
+		PerfCounterGroup& m_group;
+		PerfReading& m_reading;
+	};
+
+} // namespace ext
+
+#endif // !HEADER_EXT_PERF_EVENT_HPP_INCLUDED
@@ -0,0 +1,61 @@
+/*
+ * Copyright 2017 Mahdi Khanalizadeh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef HEADER_EXT_PREFAULT_HPP_INCLUDED
+#define HEADER_EXT_PREFAULT_HPP_INCLUDED
+
+#include "memory_map.hpp"
+#include "thread_pool.hpp"
+
+#include <cstddef>
+
+#include <algorithm>
+
+namespace ext
+{
+
+	// Faults in [address, address + length) from all workers of pool at once. Page faults on a file mapping are
+	// mostly waiting for I/O and page table locks are per table, so warming a large mapping this way is much faster
+	// than a single MAP_POPULATE or MADV_WILLNEED. With write set pages are faulted in writable, which also breaks
+	// copy-on-write sharing up front.
+	inline void prefault(ThreadPool& pool, void* const address, ::std::size_t const length, bool const write = false)
+	{
+		::std::size_t const page = detail::page_size();
+		::std::size_t const pages = (length + page - 1) / page;
+
+		// Ranges of at least 2 MiB keep whole page tables (and huge pages) with one worker.
+		::std::size_t const grain = ::std::max<::std::size_t>(pages / (pool.size() * 4ul), 2 * 1024 * 1024 / page);
+		auto* const base = static_cast<char*>(address);
+		parallel_for(pool, 0, pages, grain, [=](::std::size_t const first, ::std::size_t const last)
+		{
+			detail::populate(base + first * page, ::std::min(last * page, length) - first * page, write);
+		});
+	}
+
+	inline void prefault(ThreadPool& pool, MemoryMap const& map, bool const write = false)
+	{
+		prefault(pool, map.data(), map.size(), write);
+	}
+
+	inline void prefault(MemoryMap const& map, bool const write = false)
+	{
+		prefault(ThreadPool::global(), map, write);
+	}
+
+} // namespace ext
+
+#endif // !HEADER_EXT_PREFAULT_HPP_INCLUDED
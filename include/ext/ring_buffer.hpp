@@ -0,0 +1,160 @@
+/*
+ * Copyright 2017 Mahdi Khanalizadeh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef HEADER_EXT_RING_BUFFER_HPP_INCLUDED
+#define HEADER_EXT_RING_BUFFER_HPP_INCLUDED
+
+#include "aligned_buffer.hpp"
+#include "cache_line.hpp"
+#include "file.hpp"
+#include "memory_map.hpp"
+
+#include <cassert>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+
+#include <algorithm>
+#include <atomic>
+#include <system_error>
+
+#include <sys/mman.h>
+
+namespace ext
+{
+
+	// Byte ring buffer whose memory is mapped twice back to back, so the readable and the writable part are always
+	// contiguous no matter where they wrap: no copying at the wrap point and any window up to capacity() can be
+	// handed to a parser or a syscall as one pointer. One producer and one consumer thread may use it concurrently.
+	class MirroredRingBuffer
+	{
+	public:
+		// capacity is rounded up to a multiple of the page size.
+		explicit MirroredRingBuffer(::std::size_t const capacity) :
+			m_capacity{detail::align_up(::std::max<::std::size_t>(capacity, 1), detail::page_size())}
+		{
+			m_file->memfd_create(u8"ext::MirroredRingBuffer");
+			m_file->truncate(static_cast<::off_t>(m_capacity));
+
+			// Reserve both halves first so nothing else can be mapped in between, then map the file over each of them.
+			m_map->map(nullptr, 2 * m_capacity, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+			m_data = static_cast<char*>(m_map->data());
+			for (char* const half : {m_data, m_data + m_capacity})
+			{
+				if (::mmap(half, m_capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, m_file.get(), 0) == MAP_FAILED)
+					throw ::std::system_error{errno, ::std::system_category(), u8"mmap(MAP_FIXED)"};
+			}
+		}
+
+		MirroredRingBuffer(MirroredRingBuffer const&) = delete;
+		MirroredRingBuffer& operator=(MirroredRingBuffer const&) = delete;
+
+		::std::size_t capacity() const noexcept { return m_capacity; }
+
+		// Producer side.
+
+		::std::size_t writable() const noexcept
+		{
+			return m_capacity - (m_tail.load(::std::memory_order_relaxed) - m_head.load(::std::memory_order_acquire));
+		}
+
+		// Start of writable() contiguous free bytes.
+		char* write_pointer() const noexcept { return m_data + m_tail.load(::std::memory_order_relaxed) % m_capacity; }
+
+		// Publishes count bytes written at write_pointer() to the consumer.
+		void commit(::std::size_t const count) noexcept
+		{
+			assert(count <= writable());
+
+			m_tail.store(m_tail.load(::std::memory_order_relaxed) + count, ::std::memory_order_release);
+		}
+
+		// Copies as much of data as fits. Returns the number of bytes copied.
+		::std::size_t write(void const* const data, ::std::size_t const count) noexcept
+		{
+			::std::size_t const n = ::std::min(count, writable());
+			::std::memcpy(write_pointer(), data, n);
+			commit(n);
+			return n;
+		}
+
+		// Reads from file straight into the free space with a single read(). Returns 0 at end of file or if the
+		// buffer is full.
+		::std::size_t read_from(File& file, ::std::size_t const max = ~::std::size_t{0})
+		{
+			::std::size_t const n = ::std::min(max, writable());
+			if (!n)
+				return 0;
+			::std::size_t const ret = file.read(write_pointer(), n);
+			commit(ret);
+			return ret;
+		}
+
+		// Consumer side.
+
+		::std::size_t readable() const noexcept
+		{
+			return m_tail.load(::std::memory_order_acquire) - m_head.load(::std::memory_order_relaxed);
+		}
+
+		// Start of readable() contiguous bytes.
+		char const* read_pointer() const noexcept { return m_data + m_head.load(::std::memory_order_relaxed) % m_capacity; }
+
+		// Releases count bytes at read_pointer() to the producer.
+		void consume(::std::size_t const count) noexcept
+		{
+			assert(count <= readable());
+
+			m_head.store(m_head.load(::std::memory_order_relaxed) + count, ::std::memory_order_release);
+		}
+
+		::std::size_t read(void* const data, ::std::size_t const count) noexcept
+		{
+			::std::size_t const n = ::std::min(count, readable());
+			::std::memcpy(data, read_pointer(), n);
+			consume(n);
+			return n;
+		}
+
+		// Writes buffered bytes to file with a single write(). Returns the number of bytes written.
+		::std::size_t write_to(File& file, ::std::size_t const max = ~::std::size_t{0})
+		{
+			::std::size_t const n = ::std::min(max, readable());
+			if (!n)
+				return 0;
+			::std::size_t const ret = file.write(read_pointer(), n);
+			consume(ret);
+			return ret;
+		}
+
+	private:
+		::std::size_t const m_capacity;
+		FilePtr m_file;
+		MemoryMapPtr m_map; // the reservation; unmapping it removes both views
+		char* m_data;
+
+		// Free running positions; their difference is the fill level.
+		char m_padding0[cache_line_size];
+		::std::atomic<::std::size_t> m_head{0}; // written by the consumer
+		char m_padding1[cache_line_size];
+		::std::atomic<::std::size_t> m_tail{0}; // written by the producer
+		char m_padding2[cache_line_size];
+	};
+
+} // namespace ext
+
+#endif // !HEADER_EXT_RING_BUFFER_HPP_INCLUDED
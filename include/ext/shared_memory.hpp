@@ -0,0 +1,106 @@
+/*
+ * Copyright 2017 Mahdi Khanalizadeh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef HEADER_EXT_SHARED_MEMORY_HPP_INCLUDED
+#define HEADER_EXT_SHARED_MEMORY_HPP_INCLUDED
+
+#include "aligned_buffer.hpp"
+#include "file.hpp"
+#include "memory_map.hpp"
+
+#include <cassert>
+#include <cerrno>
+#include <cstddef>
+
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+
+namespace ext
+{
+
+	// Creates an anonymous memory file of size bytes. Unlike a file in /dev/shm it has no name to clean up, and
+	// it disappears with its last descriptor or mapping, also if the process crashes.
+	inline FilePtr make_memfd(char const* const name, ::std::size_t const size, unsigned int const flags = MFD_CLOEXEC | MFD_ALLOW_SEALING)
+	{
+		FilePtr file;
+		file->memfd_create(name, flags);
+		file->truncate(static_cast<::off_t>(size));
+		return file;
+	}
+
+	// A memfd together with a shared mapping of it: one call gives the descriptor to pass to another process (for
+	// example to wl::Shm::create_pool()) and the local view of the same memory. allocate() carves the segment into
+	// aligned blocks, e.g. one per buffer of a pool.
+	class SharedMemory
+	{
+	public:
+		// seals are added right away. The default F_SEAL_SHRINK guarantees receivers that their mappings never
+		// raise SIGBUS because the segment shrank, while still allowing resize() to grow it.
+		explicit SharedMemory(::std::size_t const size, unsigned int const seals = F_SEAL_SHRINK, char const* const name = u8"ext::SharedMemory") :
+			m_file{make_memfd(name, size)}
+		{
+			if (seals)
+				m_file->add_seals(seals);
+			m_map->map(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, m_file.get(), 0);
+		}
+
+		SharedMemory(SharedMemory const&) = delete;
+		SharedMemory& operator=(SharedMemory const&) = delete;
+
+		int fd() const noexcept { return m_file.get(); }
+		File& file() noexcept { return *m_file.operator->(); }
+		char* data() const noexcept { return static_cast<char*>(m_map->data()); }
+		::std::size_t size() const noexcept { return m_map->size(); }
+
+		// Adds more seals, e.g. F_SEAL_GROW | F_SEAL_SEAL once the segment has its final size.
+		void seal(unsigned int const seals) { m_file->add_seals(seals); }
+
+		// Grows the segment and the local mapping, which may move; blocks handed out by allocate() keep their
+		// offsets. Others have to be told the new size, e.g. with wl::ShmPool::resize().
+		void resize(::std::size_t const size)
+		{
+			m_file->truncate(static_cast<::off_t>(size));
+			m_map->remap(size);
+		}
+
+		// Returns the offset of size free bytes aligned to alignment (a power of two). Throws ENOMEM when the segment
+		// is exhausted; resize() and retry.
+		::std::size_t allocate(::std::size_t const size, ::std::size_t const alignment = 64)
+		{
+			assert(alignment && !(alignment & (alignment - 1)));
+
+			::std::size_t const offset = detail::align_up(m_used, alignment);
+			if (offset > this->size() || size > this->size() - offset)
+				throw ::std::system_error{ENOMEM, ::std::system_category(), u8"SharedMemory::allocate"};
+			m_used = offset + size;
+			return offset;
+		}
+
+		// Makes the whole segment available to allocate() again.
+		void reset() noexcept { m_used = 0; }
+
+	private:
+		FilePtr m_file;
+		MemoryMapPtr m_map;
+		::std::size_t m_used = 0;
+	};
+
+} // namespace ext
+
+#endif // !HEADER_EXT_SHARED_MEMORY_HPP_INCLUDED
@@ -0,0 +1,145 @@
+/*
+ * Copyright 2017 Mahdi Khanalizadeh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef HEADER_EXT_SPAN_HPP_INCLUDED
+#define HEADER_EXT_SPAN_HPP_INCLUDED
+
+#include "memory_map.hpp"
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+
+namespace ext
+{
+
+	// Non-owning view of count contiguous objects, a C++14 stand-in for std::span<T>. operator[] only asserts;
+	// at(), first(), last() and subspan() check their arguments and throw std::out_of_range.
+	template <typename T>
+	class Span
+	{
+	public:
+		using element_type = T;
+		using value_type = typename ::std::remove_cv<T>::type;
+		using size_type = ::std::size_t;
+		using pointer = T*;
+		using reference = T&;
+		using iterator = T*;
+
+		constexpr Span() noexcept = default;
+		constexpr Span(T* const data, ::std::size_t const size) noexcept : m_data{data}, m_size{size} {}
+		template <::std::size_t N>
+		constexpr Span(T (&array)[N]) noexcept : m_data{array}, m_size{N} {}
+
+		// Span<T> converts to Span<T const>.
+		template <typename U, typename = typename ::std::enable_if<::std::is_convertible<U(*)[], T(*)[]>::value>::type>
+		constexpr Span(Span<U> const& other) noexcept : m_data{other.data()}, m_size{other.size()} {}
+
+		constexpr T* data() const noexcept { return m_data; }
+		constexpr ::std::size_t size() const noexcept { return m_size; }
+		constexpr ::std::size_t size_bytes() const noexcept { return m_size * sizeof(T); }
+		constexpr bool empty() const noexcept { return !m_size; }
+
+		constexpr T* begin() const noexcept { return m_data; }
+		constexpr T* end() const noexcept { return m_data + m_size; }
+
+		T& operator[](::std::size_t const index) const noexcept
+		{
+			assert(index < m_size);
+			return m_data[index];
+		}
+
+		T& at(::std::size_t const index) const
+		{
+			if (index >= m_size)
+				throw ::std::out_of_range{u8"Span::at"};
+			return m_data[index];
+		}
+
+		T& front() const noexcept { return (*this)[0]; }
+		T& back() const noexcept { return (*this)[m_size - 1]; }
+
+		Span first(::std::size_t const count) const { return subspan(0, count); }
+		Span last(::std::size_t const count) const
+		{
+			if (count > m_size)
+				throw ::std::out_of_range{u8"Span::last"};
+			return {m_data + (m_size - count), count};
+		}
+
+		Span subspan(::std::size_t const offset, ::std::size_t const count) const
+		{
+			if (offset > m_size || count > m_size - offset)
+				throw ::std::out_of_range{u8"Span::subspan"};
+			return {m_data + offset, count};
+		}
+
+		Span subspan(::std::size_t const offset) const { return subspan(offset, m_size - ::std::min(offset, m_size)); }
+
+	private:
+		T* m_data = nullptr;
+		::std::size_t m_size = 0;
+	};
+
+	template <typename T>
+	constexpr Span<T> make_span(T* const data, ::std::size_t const size) noexcept
+	{
+		return {data, size};
+	}
+
+	// Reinterprets size bytes at data as objects of type T, which must be trivially copyable. Throws
+	// std::invalid_argument if data is not aligned for T or size is not a multiple of sizeof(T).
+	template <typename T>
+	Span<T> span_cast(void* const data, ::std::size_t const size)
+	{
+		static_assert(::std::is_trivially_copyable<T>::value, "span_cast requires a trivially copyable type");
+
+		if (reinterpret_cast<::std::uintptr_t>(data) % alignof(T))
+			throw ::std::invalid_argument{u8"span_cast: misaligned data"};
+		if (size % sizeof(T))
+			throw ::std::invalid_argument{u8"span_cast: size is not a multiple of the element size"};
+		return {static_cast<T*>(data), size / sizeof(T)};
+	}
+
+	template <typename T>
+	Span<T const> span_cast(void const* const data, ::std::size_t const size)
+	{
+		return span_cast<T const>(const_cast<void*>(data), size);
+	}
+
+	// Views count objects of type T at byte offset offset of map, the whole rest of the mapping by default.
+	// Throws std::out_of_range if the range exceeds the mapping.
+	template <typename T>
+	Span<T> as_span(MemoryMap const& map, ::std::size_t const offset = 0, ::std::size_t count = ~::std::size_t{0})
+	{
+		if (offset > map.size())
+			throw ::std::out_of_range{u8"as_span: offset beyond the mapping"};
+		::std::size_t const available = (map.size() - offset) / sizeof(T);
+		if (count == ~::std::size_t{0})
+			count = available;
+		else if (count > available)
+			throw ::std::out_of_range{u8"as_span: range beyond the mapping"};
+		return span_cast<T>(static_cast<char*>(map.data()) + offset, count * sizeof(T));
+	}
+
+} // namespace ext
+
+#endif // !HEADER_EXT_SPAN_HPP_INCLUDED
@@ -0,0 +1,394 @@
+/*
+ * Copyright 2017 Mahdi Khanalizadeh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef HEADER_EXT_THREAD_POOL_HPP_INCLUDED
+#define HEADER_EXT_THREAD_POOL_HPP_INCLUDED
+
+#include "cache_line.hpp"
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace ext
+{
+
+	namespace detail
+	{
+
+		// Chase-Lev work-stealing deque as described in "Correct and Efficient Work-Stealing for Weak Memory Models"
+		// by Lê, Pop, Cohen and Zappa Nardelli. The owner pushes and pops at the bottom, thieves steal from the top.
+		template <typename T>
+		class WorkStealingDeque
+		{
+			static_assert(::std::is_pointer<T>::value, "WorkStealingDeque only stores pointers");
+
+		public:
+			explicit WorkStealingDeque(::std::int64_t const capacity = 256)
+			{
+				assert(capacity > 0 && !(capacity & (capacity - 1)));
+
+				m_arrays.emplace_back(new Array{capacity});
+				m_array.store(m_arrays.back().get(), ::std::memory_order_relaxed);
+			}
+
+			WorkStealingDeque(WorkStealingDeque const&) = delete;
+			WorkStealingDeque& operator=(WorkStealingDeque const&) = delete;
+
+			// Owner only.
+			void push(T const item)
+			{
+				::std::int64_t const bottom = m_bottom.load(::std::memory_order_relaxed);
+				::std::int64_t const top = m_top.load(::std::memory_order_acquire);
+				Array* array = m_array.load(::std::memory_order_relaxed);
+				if (bottom - top > array->capacity - 1)
+					array = grow(array, bottom, top);
+				array->put(bottom, item);
+				::std::atomic_thread_fence(::std::memory_order_release);
+				m_bottom.store(bottom + 1, ::std::memory_order_relaxed);
+			}
+
+			// Owner only. Returns nullptr if the deque is empty.
+			T pop()
+			{
+				::std::int64_t const bottom = m_bottom.load(::std::memory_order_relaxed) - 1;
+				Array* const array = m_array.load(::std::memory_order_relaxed);
+				m_bottom.store(bottom, ::std::memory_order_relaxed);
+				::std::atomic_thread_fence(::std::memory_order_seq_cst);
+				::std::int64_t top = m_top.load(::std::memory_order_relaxed);
+
+				if (top > bottom)
+				{
+					m_bottom.store(bottom + 1, ::std::memory_order_relaxed);
+					return nullptr;
+				}
+
+				T item = array->get(bottom);
+				if (top == bottom)
+				{
+					// Last item, race against thieves.
+					if (!m_top.compare_exchange_strong(top, top + 1, ::std::memory_order_seq_cst, ::std::memory_order_relaxed))
+						item = nullptr;
+					m_bottom.store(bottom + 1, ::std::memory_order_relaxed);
+				}
+				return item;
+			}
+
+			// Any thread. Returns nullptr if the deque is empty or the steal lost a race.
+			T steal()
+			{
+				::std::int64_t top = m_top.load(::std::memory_order_acquire);
+				::std::atomic_thread_fence(::std::memory_order_seq_cst);
+				::std::int64_t const bottom = m_bottom.load(::std::memory_order_acquire);
+				if (top >= bottom)
+					return nullptr;
+
+				Array* const array = m_array.load(::std::memory_order_acquire);
+				T const item = array->get(top);
+				if (!m_top.compare_exchange_strong(top, top + 1, ::std::memory_order_seq_cst, ::std::memory_order_relaxed))
+					return nullptr;
+				return item;
+			}
+
+			bool empty() const noexcept
+			{
+				return m_bottom.load(::std::memory_order_relaxed) <= m_top.load(::std::memory_order_relaxed);
+			}
+
+		private:
+			struct Array
+			{
+				explicit Array(::std::int64_t const size) : capacity{size}, items{new ::std::atomic<T>[static_cast<::std::size_t>(size)]} {}
+
+				T get(::std::int64_t const index) const noexcept { return items[static_cast<::std::size_t>(index & (capacity - 1))].load(::std::memory_order_relaxed); }
+				void put(::std::int64_t const index, T const item) noexcept { items[static_cast<::std::size_t>(index & (capacity - 1))].store(item, ::std::memory_order_relaxed); }
+
+				::std::int64_t const capacity;
+				::std::unique_ptr<::std::atomic<T>[]> items;
+			};
+
+			Array* grow(Array* const old, ::std::int64_t const bottom, ::std::int64_t const top)
+			{
+				// Thieves may still read from the old array, so it is kept alive until the deque is destroyed.
+				m_arrays.emplace_back(new Array{old->capacity * 2});
+				Array* const array = m_arrays.back().get();
+				for (::std::int64_t i = top; i < bottom; ++i)
+					array->put(i, old->get(i));
+				m_array.store(array, ::std::memory_order_release);
+				return array;
+			}
+
+			// Padding instead of alignas: over-aligned new is not available before C++17.
+			::std::atomic<::std::int64_t> m_top{0};
+			char m_padding[cache_line_size];
+			::std::atomic<::std::int64_t> m_bottom{0};
+			::std::atomic<Array*> m_array;
+			::std::vector<::std::unique_ptr<Array>> m_arrays;
+		};
+
+		class Task
+		{
+		public:
+			virtual ~Task() = default;
+			virtual void run() noexcept = 0;
+		};
+
+		template <typename Function>
+		class FunctionTask final :
+			public Task
+		{
+		public:
+			explicit FunctionTask(Function function) : m_function(::std::move(function)) {}
+			void run() noexcept override { m_function(); }
+
+		private:
+			Function m_function;
+		};
+
+	} // namespace detail
+
+	class ThreadPool
+	{
+	public:
+		// threads == 0 sizes the pool from ext_num_effective_cores(). With pin set worker i is bound to the i-th
+		// processor of the process' affinity mask.
+		explicit ThreadPool(unsigned int threads = 0, bool pin = false);
+		~ThreadPool() noexcept;
+
+		ThreadPool(ThreadPool const&) = delete;
+		ThreadPool& operator=(ThreadPool const&) = delete;
+
+		unsigned int size() const noexcept { return static_cast<unsigned int>(m_workers.size()); }
+
+		// Schedules function for execution. An escaping exception terminates the program; use TaskGroup to
+		// propagate exceptions.
+		template <typename Function>
+		void submit(Function&& function)
+		{
+			::std::unique_ptr<detail::Task> task{new detail::FunctionTask<typename ::std::decay<Function>::type>{::std::forward<Function>(function)}};
+			push(task.get());
+			task.release();
+		}
+
+		// Executes one pending task on the calling thread. Returns false if there was nothing to do.
+		bool run_one();
+
+		// Returns the pool the calling thread is a worker of or nullptr.
+		static ThreadPool* current() noexcept;
+
+		// Returns the index of the calling worker thread or size() if it does not belong to this pool.
+		unsigned int current_index() const noexcept;
+
+		// Process wide pool sized from ext_num_effective_cores(), created on first use.
+		static ThreadPool& global();
+
+	private:
+		struct Worker
+		{
+			detail::WorkStealingDeque<detail::Task*> deque;
+			::std::thread thread;
+		};
+
+		void push(detail::Task* task);
+		detail::Task* find_task(unsigned int self);
+		void work(unsigned int index, int cpu);
+
+		::std::vector<::std::unique_ptr<Worker>> m_workers;
+
+		::std::mutex m_injected_mutex;
+		::std::deque<detail::Task*> m_injected;
+		::std::atomic<::std::size_t> m_injected_size{0};
+
+		::std::mutex m_sleep_mutex;
+		::std::condition_variable m_sleep_cv;
+		char m_padding[cache_line_size];
+		::std::atomic<::std::uint64_t> m_epoch{0};
+		::std::atomic<unsigned int> m_sleepers{0};
+		::std::atomic<bool> m_stop{false};
+	};
+
+	// A set of tasks that can be waited on. Exceptions thrown by the tasks are rethrown by wait().
+	class TaskGroup
+	{
+	public:
+		explicit TaskGroup(ThreadPool& pool = ThreadPool::global()) noexcept : m_pool(pool) {}
+		~TaskGroup() noexcept
+		{
+			try { wait(); } catch (...) {}
+		}
+
+		TaskGroup(TaskGroup const&) = delete;
+		TaskGroup& operator=(TaskGroup const&) = delete;
+
+		ThreadPool& pool() noexcept { return m_pool; }
+
+		template <typename Function>
+		void run(Function&& function)
+		{
+			m_pending.fetch_add(1, ::std::memory_order_relaxed);
+			try
+			{
+				m_pool.submit(Wrapper<typename ::std::decay<Function>::type>{this, ::std::forward<Function>(function)});
+			}
+			catch (...)
+			{
+				finish();
+				throw;
+			}
+		}
+
+		// Blocks until all tasks finished. The calling thread executes pending tasks of the pool while waiting, so
+		// waiting from inside a task cannot deadlock the pool.
+		void wait();
+
+	private:
+		template <typename Function>
+		struct Wrapper
+		{
+			void operator()() noexcept
+			{
+				try
+				{
+					function();
+				}
+				catch (...)
+				{
+					::std::lock_guard<::std::mutex> lock{group->m_mutex};
+					if (!group->m_exception)
+						group->m_exception = ::std::current_exception();
+				}
+				group->finish();
+			}
+
+			TaskGroup* group;
+			Function function;
+		};
+
+		void finish() noexcept;
+
+		ThreadPool& m_pool;
+		::std::atomic<::std::size_t> m_pending{0};
+		::std::mutex m_mutex;
+		::std::condition_variable m_cv;
+		::std::exception_ptr m_exception;
+	};
+
+	namespace detail
+	{
+
+		// Keeps std::vector from packing bool results into shared words that workers would write concurrently.
+		template <typename T>
+		struct Partial
+		{
+			T value;
+		};
+
+		template <typename Function>
+		void parallel_for_split(TaskGroup& group, ::std::size_t first, ::std::size_t last, ::std::size_t const grain, Function const& function)
+		{
+			// Hand off the upper halves so that thieves take large ranges and the owner keeps splitting locally.
+			while (last - first > grain)
+			{
+				::std::size_t const middle = first + (last - first) / 2;
+				group.run([&group, middle, last, grain, &function]{ parallel_for_split(group, middle, last, grain, function); });
+				last = middle;
+			}
+			function(first, last);
+		}
+
+		inline ::std::size_t default_grain(ThreadPool const& pool, ::std::size_t const count) noexcept
+		{
+			// Roughly eight chunks per worker leaves enough slack for load balancing.
+			::std::size_t const grain = count / (static_cast<::std::size_t>(pool.size()) * 8);
+			return grain ? grain : 1;
+		}
+
+	} // namespace detail
+
+	// Calls function(begin, end) for disjoint subranges covering [first, last) of at most grain elements each.
+	// grain == 0 picks a grain from the pool size.
+	template <typename Function>
+	void parallel_for(ThreadPool& pool, ::std::size_t const first, ::std::size_t const last, ::std::size_t grain, Function const& function)
+	{
+		if (first >= last)
+			return;
+		if (!grain)
+			grain = detail::default_grain(pool, last - first);
+		if (last - first <= grain)
+		{
+			function(first, last);
+			return;
+		}
+
+		TaskGroup group{pool};
+		detail::parallel_for_split(group, first, last, grain, function);
+		group.wait();
+	}
+
+	template <typename Function>
+	void parallel_for(::std::size_t const first, ::std::size_t const last, Function const& function)
+	{
+		parallel_for(ThreadPool::global(), first, last, 0, function);
+	}
+
+	// Reduces [first, last) by computing map(begin, end) for chunks of at most grain elements and folding the
+	// partial results with combine(T, T) in ascending order. The result is deterministic for a given grain, which
+	// matters for floating point sums.
+	template <typename T, typename Map, typename Combine>
+	T parallel_reduce(ThreadPool& pool, ::std::size_t const first, ::std::size_t const last, ::std::size_t grain, T identity, Map const& map, Combine const& combine)
+	{
+		if (first >= last)
+			return identity;
+		if (!grain)
+			grain = detail::default_grain(pool, last - first);
+
+		::std::size_t const chunks = (last - first + grain - 1) / grain;
+		::std::vector<detail::Partial<T>> partials(chunks, detail::Partial<T>{identity});
+		parallel_for(pool, 0, chunks, 1, [&](::std::size_t const begin, ::std::size_t const end)
+		{
+			for (::std::size_t i = begin; i < end; ++i)
+			{
+				::std::size_t const chunk_first = first + i * grain;
+				::std::size_t const chunk_last = last - chunk_first < grain ? last : chunk_first + grain;
+				partials[i].value = map(chunk_first, chunk_last);
+			}
+		});
+
+		for (auto& partial : partials)
+			identity = combine(::std::move(identity), ::std::move(partial.value));
+		return identity;
+	}
+
+	template <typename T, typename Map, typename Combine>
+	T parallel_reduce(::std::size_t const first, ::std::size_t const last, T identity, Map const& map, Combine const& combine)
+	{
+		return parallel_reduce(ThreadPool::global(), first, last, 0, ::std::move(identity), map, combine);
+	}
+
+} // namespace ext
+
+#endif // !HEADER_EXT_THREAD_POOL_HPP_INCLUDED
@@ -0,0 +1,135 @@
+/*
+ * Copyright 2017 Mahdi Khanalizadeh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef HEADER_EXT_WAL_HPP_INCLUDED
+#define HEADER_EXT_WAL_HPP_INCLUDED
+
+#include "file.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace ext
+{
+
+	struct WalOptions
+	{
+		// Segments are allocated and zero-filled to this size when they are created, so that appends overwrite
+		// blocks that are already written and fdatasync() does not have to write metadata. Preallocation alone
+		// would not do: file systems still record the first write to an unwritten extent in metadata. A record
+		// larger than this gets a segment of its own.
+		::std::size_t segment_size = 64 * 1024 * 1024;
+
+		// How long a commit leader waits for more appenders to join its group before writing. 0 commits at once,
+		// which still batches everything appended while the previous commit was running; a few hundred
+		// microseconds trade latency for fewer, larger syncs when many threads commit concurrently.
+		::std::chrono::microseconds commit_window{0};
+
+		// Ends the commit window early once this many bytes are pending.
+		::std::size_t commit_bytes = 1024 * 1024;
+	};
+
+	// Append-only log of checksummed records in a directory of segment files named after the sequence number (LSN)
+	// of their first record. Threads append() concurrently and sync() makes records durable: one of the waiting
+	// threads becomes the leader and writes and fdatasync()s everything pending for all of them, so N concurrent
+	// commits cost one sync instead of N.
+	//
+	// Each record is a header {crc32c, size, lsn} followed by the payload; the checksum covers the payload, size and
+	// lsn. Opening a log scans only the last segment and stops at the first record that is missing or fails its
+	// checksum, which is where a crash interrupted the log.
+	class Wal
+	{
+	public:
+		using Lsn = ::std::uint64_t;
+
+		// Opens the log in directory, creating both if necessary.
+		explicit Wal(::std::string directory, WalOptions const& options = WalOptions{});
+		~Wal() noexcept;
+
+		Wal(Wal const&) = delete;
+		Wal& operator=(Wal const&) = delete;
+
+		// Queues a record and returns its LSN. The record is not durable before sync() covering it returns. Throws
+		// std::length_error for records of 4 GiB or more.
+		Lsn append(void const* data, ::std::size_t size);
+
+		// Blocks until all records up to and including lsn are durable. Rethrows the error of a failed commit; the
+		// log is unusable afterwards.
+		void sync(Lsn lsn);
+
+		Lsn commit(void const* const data, ::std::size_t const size)
+		{
+			Lsn const lsn = append(data, size);
+			sync(lsn);
+			return lsn;
+		}
+
+		// LSN the next append() returns.
+		Lsn next_lsn() const;
+
+		// Every record below this LSN is durable.
+		Lsn durable_lsn() const;
+
+		// Calls function(lsn, data, size) for every durable record with an LSN of at least first, in order.
+		void replay(Lsn first, ::std::function<void(Lsn, char const*, ::std::size_t)> const& function) const;
+
+		// Deletes the segments that only hold records below lsn, e.g. after they were checkpointed.
+		void remove_before(Lsn lsn);
+
+	private:
+		struct Segment
+		{
+			Lsn first;
+			::std::string path;
+		};
+
+		void recover();
+		void create_segment(Lsn first);
+		void write_batch(::std::vector<char> const& batch, ::std::vector<::std::size_t> const& records);
+
+		::std::string const m_directory;
+		WalOptions const m_options;
+		FilePtr m_directory_file;
+
+		mutable ::std::mutex m_mutex;
+		::std::condition_variable m_cv;
+		::std::vector<char> m_batch;
+		::std::vector<::std::size_t> m_records; // start of each record in m_batch
+		Lsn m_next_lsn = 0;
+		Lsn m_durable_lsn = 0;
+		bool m_committing = false;
+		::std::exception_ptr m_error;
+		::std::vector<Segment> m_segments;
+
+		// Owned by the commit leader.
+		FilePtr m_file;
+		::std::size_t m_offset = 0;
+		::std::vector<char> m_spare;
+		::std::vector<::std::size_t> m_spare_records;
+	};
+
+} // namespace ext
+
+#endif // !HEADER_EXT_WAL_HPP_INCLUDED
@@ -3,6 +3,7 @@
 
 #include "handle.hpp"
 #include "file.hpp"
+#include "shared_memory.hpp"
 
 #include <cassert>
 #include <cerrno>
@@ -688,6 +689,14 @@ namespace ext
 
 				return ShmPoolPtr{::wl_shm_create_pool(raw_handle(), fd, size)};
 			}
+
+			// Shares the whole segment with the compositor.
+			ShmPoolPtr create_pool(SharedMemory const& memory)
+			{
+				assert(memory.size() <= INT32_MAX);
+
+				return create_pool(memory.fd(), static_cast<::std::int32_t>(memory.size()));
+			}
 		};
 
 		using ShmPtr = ::ext::HandlePtr<Shm>;
@@ -0,0 +1,326 @@
+/*
+ * Copyright 2017 Mahdi Khanalizadeh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef HEADER_EXT_WINDOW_MAP_HPP_INCLUDED
+#define HEADER_EXT_WINDOW_MAP_HPP_INCLUDED
+
+#include "aligned_buffer.hpp"
+#include "file.hpp"
+#include "memory_map.hpp"
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include <sys/mman.h>
+
+namespace ext
+{
+
+	struct WindowMapOptions
+	{
+		::std::size_t window_size = 64 * 1024 * 1024; // rounded up to whole pages
+		::std::size_t overlap = 1024 * 1024;           // mapped past the end of each window: the longest view that never splits
+		unsigned int max_windows = 4;                  // mapped at once, unless cursors pin more
+		bool sequential = true;                        // MADV_SEQUENTIAL, and cursors start reading the next window ahead
+	};
+
+	// Reads a file of any size through a bounded number of mappings. Window i maps the window_size bytes at
+	// i * window_size plus overlap bytes of the next one; windows are mapped on first use and the least recently used
+	// one is unmapped when max_windows are in use, so address space and page tables stay bounded by
+	// max_windows * (window_size + overlap) however large the file is. Not thread safe.
+	class WindowMap
+	{
+		struct Window
+		{
+			::std::uint64_t index;
+			MemoryMapPtr map;
+			unsigned int pins;
+			::std::uint64_t last_use;
+		};
+
+	public:
+		// Streams through the file with views that are valid as long as the cursor stays in the same window. A
+		// cursor keeps its window mapped; move it rather than copying.
+		class Cursor
+		{
+		public:
+			Cursor(Cursor&& rhs) noexcept :
+				m_map{rhs.m_map},
+				m_window{rhs.m_window},
+				m_position{rhs.m_position}
+			{
+				rhs.m_window = nullptr;
+			}
+
+			Cursor& operator=(Cursor&& rhs) noexcept
+			{
+				::std::swap(m_map, rhs.m_map);
+				::std::swap(m_window, rhs.m_window);
+				::std::swap(m_position, rhs.m_position);
+				return *this;
+			}
+
+			~Cursor() noexcept { unpin(); }
+
+			::std::uint64_t position() const noexcept { return m_position; }
+			bool eof() const noexcept { return m_position >= m_map->size(); }
+
+			void seek(::std::uint64_t const position) noexcept { m_position = position; }
+			void advance(::std::size_t const count) noexcept { m_position += count; }
+
+			// The bytes from position() to the end of the current window; nullptr at the end of the file.
+			char const* data()
+			{
+				if (eof())
+					return nullptr;
+				if (!covers(1))
+					move_to(m_position / m_map->window_size());
+				return window_data() + (m_position - window_begin());
+			}
+
+			::std::size_t available()
+			{
+				if (!data())
+					return 0;
+				return static_cast<::std::size_t>(window_begin() + m_window->map->size() - m_position);
+			}
+
+			// Makes count bytes from position() available contiguously. Returns nullptr if the file ends first or if
+			// count exceeds what the window holding position() maps, which never happens for count <= overlap + 1.
+			char const* peek(::std::size_t const count)
+			{
+				if (count > m_map->size() || m_position > m_map->size() - count)
+					return nullptr;
+				if (!count)
+					return empty_view();
+				if (!covers(count))
+				{
+					move_to(m_position / m_map->window_size());
+					if (!covers(count))
+						return nullptr;
+				}
+				return window_data() + (m_position - window_begin());
+			}
+
+			// Copies up to count bytes across windows and advances past them. Returns how many were copied.
+			::std::size_t read(void* const buffer, ::std::size_t const count)
+			{
+				auto* out = static_cast<char*>(buffer);
+				::std::size_t done = 0;
+				while (done < count)
+				{
+					char const* const in = data();
+					if (!in)
+						break;
+					::std::size_t const n = ::std::min(count - done, available());
+					::std::memcpy(out + done, in, n);
+					done += n;
+					m_position += n;
+				}
+				return done;
+			}
+
+		private:
+			friend class WindowMap;
+
+			Cursor(WindowMap& map, ::std::uint64_t const position) noexcept :
+				m_map{&map},
+				m_position{position}
+			{
+			}
+
+			::std::uint64_t window_begin() const noexcept { return m_window->index * m_map->window_size(); }
+			char const* window_data() const noexcept { return static_cast<char const*>(m_window->map->data()); }
+
+			bool covers(::std::size_t const count) const noexcept
+			{
+				return m_window && m_position >= window_begin() && m_position - window_begin() + count <= m_window->map->size();
+			}
+
+			void move_to(::std::uint64_t const index)
+			{
+				Window& window = m_map->acquire(index);
+				++window.pins;
+				unpin();
+				m_window = &window;
+				if (m_map->m_options.sequential)
+					m_map->prefetch(index + 1);
+			}
+
+			void unpin() noexcept
+			{
+				if (m_window)
+					m_map->unpin(*m_window);
+				m_window = nullptr;
+			}
+
+			WindowMap* m_map;
+			Window* m_window = nullptr;
+			::std::uint64_t m_position;
+		};
+
+		explicit WindowMap(FilePtr const& file, WindowMapOptions const& options = {}) :
+			m_file{&file},
+			m_options(options),
+			m_size{static_cast<::std::uint64_t>(file->size())}
+		{
+			assert(options.max_windows);
+
+			m_options.window_size = detail::align_up(::std::max<::std::size_t>(options.window_size, 1), detail::page_size());
+		}
+
+		WindowMap(WindowMap const&) = delete;
+		WindowMap& operator=(WindowMap const&) = delete;
+
+		// All cursors must be gone before the map.
+		~WindowMap() noexcept
+		{
+			assert(::std::none_of(m_windows.begin(), m_windows.end(), [](::std::unique_ptr<Window> const& window){ return window->pins; }));
+		}
+
+		::std::uint64_t size() const noexcept { return m_size; }
+		::std::size_t window_size() const noexcept { return m_options.window_size; }
+		::std::size_t mapped_windows() const noexcept { return m_windows.size(); }
+
+		// Picks up a file that grew. Windows that ended at the old size are mapped again when next used; those a cursor
+		// still holds stay valid for it until it leaves them, and go away with their last cursor.
+		void refresh_size()
+		{
+			m_size = static_cast<::std::uint64_t>((*m_file)->size());
+			m_windows.erase(::std::remove_if(m_windows.begin(), m_windows.end(), [this](::std::unique_ptr<Window> const& window)
+			{
+				return !window->pins && stale(*window);
+			}), m_windows.end());
+		}
+
+		Cursor cursor(::std::uint64_t const position = 0) noexcept { return Cursor{*this, position}; }
+
+		// Returns count contiguous bytes at offset, or nullptr if they do not fit the window holding offset, which
+		// never happens for count <= overlap + 1. The view is only valid until the next call on the map or a cursor.
+		char const* view(::std::uint64_t const offset, ::std::size_t const count)
+		{
+			if (count > m_size || offset > m_size - count)
+				throw ::std::out_of_range{u8"WindowMap: view past the end of the file"};
+			if (!count)
+				return empty_view();
+
+			::std::uint64_t const index = offset / window_size();
+			::std::size_t const start = static_cast<::std::size_t>(offset - index * window_size());
+			if (start + count > window_length(index))
+				return nullptr;
+			return static_cast<char const*>(acquire(index).map->data()) + start;
+		}
+
+	private:
+		::std::size_t window_length(::std::uint64_t const index) const noexcept
+		{
+			::std::uint64_t const begin = index * window_size();
+			return static_cast<::std::size_t>(::std::min<::std::uint64_t>(window_size() + m_options.overlap, m_size - begin));
+		}
+
+		// A window that ended at the end of the file before it grew; never handed out again.
+		bool stale(Window const& window) const noexcept { return window.map->size() < window_length(window.index); }
+
+		Window& acquire(::std::uint64_t const index)
+		{
+			assert(index * window_size() < m_size);
+
+			Window* victim = nullptr;
+			for (auto& window : m_windows)
+			{
+				if (window->index == index && !stale(*window))
+				{
+					window->last_use = ++m_clock;
+					return *window;
+				}
+				if (!window->pins && (!victim || window->last_use < victim->last_use))
+					victim = window.get();
+			}
+
+			// Nothing changes before the new mapping exists, so a failing mmap() leaves every window intact.
+			MemoryMapPtr map;
+			map->map(nullptr, window_length(index), PROT_READ, MAP_SHARED, m_file->get(), static_cast<::off_t>(index * window_size()));
+			if (m_options.sequential)
+				map->madvise(MADV_SEQUENTIAL);
+
+			if (m_windows.size() < m_options.max_windows || !victim)
+			{
+				::std::unique_ptr<Window> window{new Window{index, ::std::move(map), 0, ++m_clock}};
+				m_windows.push_back(::std::move(window));
+				return *m_windows.back();
+			}
+
+			victim->map = ::std::move(map);
+			victim->index = index;
+			victim->last_use = ++m_clock;
+			return *victim;
+		}
+
+		// What views of zero bytes point to; they need no window, and at the end of the file there is none to map.
+		static char const* empty_view() noexcept
+		{
+			static char const byte = 0;
+			return &byte;
+		}
+
+		// Maps the window and starts reading it in the background: MADV_WILLNEED queues readahead and returns. Never
+		// maps more than max_windows for it.
+		void prefetch(::std::uint64_t const index)
+		{
+			if (index * window_size() >= m_size)
+				return;
+			bool evictable = m_windows.size() < m_options.max_windows;
+			for (auto const& window : m_windows)
+			{
+				if (window->index == index && !stale(*window))
+					return;
+				evictable |= !window->pins;
+			}
+			if (!evictable)
+				return;
+			acquire(index).map->madvise(MADV_WILLNEED);
+		}
+
+		// Windows mapped beyond max_windows because all others were pinned go away with their last cursor, and so do
+		// stale ones.
+		void unpin(Window& window) noexcept
+		{
+			assert(window.pins);
+
+			if (--window.pins || (m_windows.size() <= m_options.max_windows && !stale(window)))
+				return;
+			m_windows.erase(::std::find_if(m_windows.begin(), m_windows.end(), [&window](::std::unique_ptr<Window> const& w){ return w.get() == &window; }));
+		}
+
+		FilePtr const* const m_file;
+		WindowMapOptions m_options;
+		::std::uint64_t m_size;
+		::std::vector<::std::unique_ptr<Window>> m_windows;
+		::std::uint64_t m_clock = 0;
+	};
+
+} // namespace ext
+
+#endif // !HEADER_EXT_WINDOW_MAP_HPP_INCLUDED
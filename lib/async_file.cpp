@@ -0,0 +1,269 @@
+/*
+ * Copyright 2017 Mahdi Khanalizadeh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ext/async_file.hpp"
+#include "ext/cores.h"
+
+#include <cassert>
+#include <cerrno>
+#include <climits>
+
+#include <algorithm>
+#include <system_error>
+
+#include <unistd.h>
+
+namespace ext
+{
+
+	AsyncIo::AsyncIo(unsigned int const queue_depth, AsyncBackend const backend) :
+		m_depth{queue_depth ? queue_depth : 1}
+	{
+		if (backend != AsyncBackend::Threads)
+		{
+			try
+			{
+				m_ring.reset(new IoUring{m_depth});
+				if (!m_ring->supports(IORING_OP_READ) || !m_ring->supports(IORING_OP_WRITE))
+					throw ::std::system_error{ENOSYS, ::std::system_category(), u8"io_uring without IORING_OP_READ and IORING_OP_WRITE"};
+			}
+			catch (::std::system_error const&)
+			{
+				m_ring.reset();
+				if (backend == AsyncBackend::IoUring)
+					throw;
+			}
+		}
+
+		if (!m_ring)
+		{
+			// Blocking I/O threads mostly sleep, so allow more of them than there are cores.
+			unsigned int const threads = ::std::max(4u, 2 * ::ext_num_effective_cores());
+			m_pool.reset(new ThreadPool{::std::min(threads, m_depth)});
+			m_operations.reserve(m_depth);
+		}
+	}
+
+	AsyncIo::~AsyncIo() noexcept
+	{
+		// The kernel or the pool may still write into user buffers and into this object.
+		try
+		{
+			AsyncCompletion completions[64];
+			while (in_flight())
+				wait(completions, 64);
+		}
+		catch (...)
+		{
+		}
+
+		// If draining failed, workers may still be executing operations that record their completion in members
+		// destroyed before m_pool; the pool's destructor runs what is left and joins them.
+		m_pool.reset();
+	}
+
+	void AsyncIo::register_buffers(::iovec const* const buffers, unsigned int const count)
+	{
+		assert(!in_flight());
+
+		if (m_ring)
+			m_ring->register_buffers(buffers, count);
+	}
+
+	void AsyncIo::unregister_buffers()
+	{
+		assert(!in_flight());
+
+		if (m_ring)
+			m_ring->unregister_buffers();
+	}
+
+	void AsyncIo::register_files(int const* const fds, unsigned int const count)
+	{
+		assert(!in_flight());
+
+		if (m_ring)
+			m_ring->register_files(fds, count);
+		else
+			m_files.assign(fds, fds + count);
+	}
+
+	void AsyncIo::unregister_files()
+	{
+		assert(!in_flight());
+
+		if (m_ring)
+			m_ring->unregister_files();
+		else
+			m_files.clear();
+	}
+
+	bool AsyncIo::enqueue(Operation const& operation)
+	{
+		if (in_flight() >= m_depth)
+			return false;
+
+		if (m_ring)
+		{
+			// The ring has at least m_depth submission entries, so this cannot fail.
+			::io_uring_sqe* const sqe = m_ring->get_sqe();
+			assert(sqe);
+
+			auto const length = static_cast<::std::uint32_t>(::std::min<::std::size_t>(operation.count, UINT_MAX)); // short transfer
+			bool const fixed = operation.buffer_index != -1;
+			switch (operation.opcode)
+			{
+				case Read:
+					IoUring::prepare(*sqe, fixed ? IORING_OP_READ_FIXED : IORING_OP_READ, operation.fd, operation.buffer, length, static_cast<::std::uint64_t>(operation.offset));
+					break;
+				case Write:
+					IoUring::prepare(*sqe, fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE, operation.fd, operation.buffer, length, static_cast<::std::uint64_t>(operation.offset));
+					break;
+				case Sync:
+				case DataSync:
+					IoUring::prepare(*sqe, IORING_OP_FSYNC, operation.fd, nullptr, 0, 0);
+					sqe->fsync_flags = operation.opcode == DataSync ? IORING_FSYNC_DATASYNC : 0u;
+					break;
+			}
+			if (fixed)
+				sqe->buf_index = static_cast<::std::uint16_t>(operation.buffer_index);
+			if (operation.registered_file)
+				sqe->flags |= IOSQE_FIXED_FILE;
+			sqe->user_data = operation.user_data;
+		}
+		else
+			m_operations.push_back(operation);
+
+		++m_queued;
+		return true;
+	}
+
+	unsigned int AsyncIo::submit()
+	{
+		if (!m_queued)
+			return 0;
+		return flush(0);
+	}
+
+	unsigned int AsyncIo::flush(unsigned int const wait_nr)
+	{
+		unsigned int consumed = 0;
+		if (m_ring)
+			consumed = m_ring->submit(wait_nr);
+		else
+		{
+			try
+			{
+				for (Operation const& operation : m_operations)
+				{
+					m_pool->submit([this, operation]{ execute(operation); });
+					++consumed;
+				}
+			}
+			catch (...)
+			{
+				m_operations.erase(m_operations.begin(), m_operations.begin() + consumed);
+				account(consumed);
+				throw;
+			}
+			m_operations.clear();
+		}
+
+		account(consumed);
+		return consumed;
+	}
+
+	void AsyncIo::account(unsigned int const consumed) noexcept
+	{
+		assert(consumed <= m_queued);
+
+		m_queued -= consumed;
+		m_submitted += consumed;
+	}
+
+	void AsyncIo::execute(Operation const& operation) noexcept
+	{
+		int const fd = operation.registered_file ? m_files[static_cast<::std::size_t>(operation.fd)] : operation.fd;
+
+		long result = 0;
+		do
+		{
+			switch (operation.opcode)
+			{
+				case Read: result = ::pread(fd, operation.buffer, operation.count, operation.offset); break;
+				case Write: result = ::pwrite(fd, operation.buffer, operation.count, operation.offset); break;
+				case Sync: result = ::fsync(fd); break;
+				case DataSync: result = ::fdatasync(fd); break;
+			}
+		} while (result == -1 && errno == EINTR);
+		if (result == -1)
+			result = -errno;
+
+		::std::lock_guard<::std::mutex> lock{m_mutex};
+		m_completions.push_back({operation.user_data, result});
+		m_cv.notify_one();
+	}
+
+	unsigned int AsyncIo::harvest(AsyncCompletion* const completions, unsigned int const max)
+	{
+		unsigned int count = 0;
+		if (m_ring)
+		{
+			AsyncCompletion* out = completions;
+			count = m_ring->for_each_completion([&out](::io_uring_cqe const& cqe)
+			{
+				*out++ = {cqe.user_data, static_cast<long>(cqe.res)};
+			}, max);
+		}
+		else
+		{
+			::std::lock_guard<::std::mutex> lock{m_mutex};
+			count = static_cast<unsigned int>(::std::min<::std::size_t>(m_completions.size(), max));
+			::std::copy_n(m_completions.begin(), count, completions);
+			m_completions.erase(m_completions.begin(), m_completions.begin() + count);
+		}
+
+		m_submitted -= count;
+		return count;
+	}
+
+	unsigned int AsyncIo::wait(AsyncCompletion* const completions, unsigned int const max, unsigned int min_complete)
+	{
+		submit();
+		min_complete = ::std::min({min_complete, max, m_submitted});
+
+		unsigned int count = harvest(completions, max);
+		while (count < min_complete)
+		{
+			if (m_ring)
+				flush(min_complete - count);
+			else
+			{
+				::std::unique_lock<::std::mutex> lock{m_mutex};
+				m_cv.wait(lock, [&]{ return m_completions.size() >= min_complete - count; });
+			}
+			count += harvest(completions + count, max - count);
+		}
+		return count;
+	}
+
+	unsigned int AsyncIo::poll(AsyncCompletion* const completions, unsigned int const max)
+	{
+		submit();
+		return harvest(completions, max);
+	}
+
+} // namespace ext
@@ -14,11 +14,16 @@
  * limitations under the License.
  */
 
-#include "ext/cores.h"
+#ifndef _WIN32
+#define _GNU_SOURCE // sched_getaffinity, CPU_COUNT_S
+#endif // !_WIN32
 
-#ifdef _WIN32
+#include "ext/cores.h"
 
 #include <limits.h>
+#include <stddef.h>
+
+#ifdef _WIN32
 
 #include <Windows.h>
 
@@ -32,9 +37,33 @@ unsigned int ext_num_cores(void)
 		return info.dwNumberOfProcessors;
 }
 
+unsigned int ext_num_effective_cores(void)
+{
+	DWORD_PTR process_mask;
+	DWORD_PTR system_mask;
+	if (!GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask) || !process_mask)
+		return 1;
+
+	unsigned int ret = 0;
+	for (; process_mask; process_mask &= process_mask - 1)
+		++ret;
+	return ret;
+}
+
+static SRWLOCK listeners_lock = SRWLOCK_INIT;
+
+static void lock_listeners(void) { AcquireSRWLockExclusive(&listeners_lock); }
+static void unlock_listeners(void) { ReleaseSRWLockExclusive(&listeners_lock); }
+
 #else // _WIN32
 
+#include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+#include <sched.h>
 
 unsigned int ext_num_cores(void)
 {
@@ -56,4 +85,320 @@ unsigned int ext_num_cores(void)
 	return ret;
 }
 
+static unsigned int min_cores(unsigned int const a, unsigned int const b)
+{
+	return a < b ? a : b;
+}
+
+static unsigned int affinity_cores(void)
+{
+	// The kernel rejects masks smaller than its own cpumask with EINVAL, so grow until it fits.
+	for (int cpus = CPU_SETSIZE; cpus <= (1 << 20); cpus *= 2)
+	{
+		cpu_set_t* const set = CPU_ALLOC((size_t)cpus);
+		if (!set)
+			return UINT_MAX;
+
+		size_t const size = CPU_ALLOC_SIZE((size_t)cpus);
+		if (sched_getaffinity(0, size, set) == 0)
+		{
+			int const count = CPU_COUNT_S(size, set);
+			CPU_FREE(set);
+			return count > 0 ? (unsigned int)count : UINT_MAX;
+		}
+
+		CPU_FREE(set);
+		if (errno != EINVAL)
+			break;
+	}
+	return UINT_MAX;
+}
+
+// Reads a small pseudo file into buffer. Returns 0 on success.
+static int read_file(char const* const path, char* const buffer, size_t const size)
+{
+	FILE* const file = fopen(path, "r");
+	if (!file)
+		return -1;
+
+	size_t const count = fread(buffer, 1, size - 1, file);
+	int const failed = ferror(file);
+	fclose(file);
+	if (failed)
+		return -1;
+
+	buffer[count] = '\0';
+	return 0;
+}
+
+// Counts the processors in a cpu list like "0-3,8,10-11".
+static unsigned int count_cpu_list(char const* list)
+{
+	unsigned int ret = 0;
+	while (*list && *list != '\n')
+	{
+		char* end;
+		unsigned long const first = strtoul(list, &end, 10);
+		if (end == list)
+			return UINT_MAX;
+
+		unsigned long last = first;
+		if (*end == '-')
+		{
+			list = end + 1;
+			last = strtoul(list, &end, 10);
+			if (end == list || last < first)
+				return UINT_MAX;
+		}
+		ret += (unsigned int)(last - first + 1);
+
+		list = end;
+		if (*list == ',')
+			++list;
+	}
+	return ret ? ret : UINT_MAX;
+}
+
+static unsigned int quota_cores(long long const quota, long long const period)
+{
+	if (quota <= 0 || period <= 0)
+		return UINT_MAX;
+
+	long long const cores = (quota + period - 1) / period;
+	return cores > UINT_MAX ? UINT_MAX : (unsigned int)cores;
+}
+
+static unsigned int cpuset_cores(char const* const path)
+{
+	char buffer[4096];
+	if (read_file(path, buffer, sizeof buffer))
+		return UINT_MAX;
+	return count_cpu_list(buffer);
+}
+
+// cgroup v2: "cpu.max" holds "$MAX $PERIOD" where $MAX may be "max". Every ancestor can impose its own limit.
+static unsigned int cgroup2_cores(char const* const cgroup)
+{
+	char dir[PATH_MAX];
+	if (snprintf(dir, sizeof dir, u8"/sys/fs/cgroup%s", cgroup) >= (int)sizeof dir)
+		return UINT_MAX;
+
+	char path[PATH_MAX + 32];
+	snprintf(path, sizeof path, u8"%s/cpuset.cpus.effective", dir);
+	unsigned int ret = cpuset_cores(path);
+
+	size_t const root = strlen(u8"/sys/fs/cgroup");
+	for (;;)
+	{
+		char buffer[64];
+		snprintf(path, sizeof path, u8"%s/cpu.max", dir);
+		if (!read_file(path, buffer, sizeof buffer))
+		{
+			long long quota = 0;
+			long long period = 0;
+			if (sscanf(buffer, "%lld %lld", &quota, &period) == 2)
+				ret = min_cores(ret, quota_cores(quota, period));
+		}
+
+		char* const slash = strrchr(dir, '/');
+		if (!slash || (size_t)(slash - dir) < root)
+			break;
+		*slash = '\0';
+	}
+	return ret;
+}
+
+// cgroup v1: the controller hierarchies are mounted separately. Inside a container the path from /proc/self/cgroup
+// usually does not exist because the container sees its own cgroup as the root, so fall back to the mount root.
+static int cgroup1_file(char const* const controller, char const* const cgroup, char const* const name, char* const buffer, size_t const size)
+{
+	char path[PATH_MAX];
+	if (snprintf(path, sizeof path, u8"/sys/fs/cgroup/%s%s/%s", controller, cgroup, name) < (int)sizeof path && !read_file(path, buffer, size))
+		return 0;
+	snprintf(path, sizeof path, u8"/sys/fs/cgroup/%s/%s", controller, name);
+	return read_file(path, buffer, size);
+}
+
+static unsigned int cgroup1_cores(char const* const cpu_cgroup, char const* const cpuset_cgroup)
+{
+	unsigned int ret = UINT_MAX;
+	char buffer[4096];
+
+	if (cpu_cgroup)
+	{
+		long long quota = 0;
+		long long period = 0;
+		if (!cgroup1_file(u8"cpu", cpu_cgroup, u8"cpu.cfs_quota_us", buffer, sizeof buffer))
+			quota = strtoll(buffer, NULL, 10);
+		if (!cgroup1_file(u8"cpu", cpu_cgroup, u8"cpu.cfs_period_us", buffer, sizeof buffer))
+			period = strtoll(buffer, NULL, 10);
+		ret = min_cores(ret, quota_cores(quota, period));
+	}
+
+	if (cpuset_cgroup)
+	{
+		if (!cgroup1_file(u8"cpuset", cpuset_cgroup, u8"cpuset.effective_cpus", buffer, sizeof buffer) ||
+			!cgroup1_file(u8"cpuset", cpuset_cgroup, u8"cpuset.cpus", buffer, sizeof buffer))
+			ret = min_cores(ret, count_cpu_list(buffer));
+	}
+
+	return ret;
+}
+
+// Returns whether the comma separated controller list contains controller.
+static int has_controller(char const* list, char const* const controller)
+{
+	size_t const length = strlen(controller);
+	while (*list)
+	{
+		if (!strncmp(list, controller, length) && (list[length] == ',' || list[length] == '\0'))
+			return 1;
+		list = strchr(list, ',');
+		if (!list)
+			break;
+		++list;
+	}
+	return 0;
+}
+
+static unsigned int cgroup_cores(void)
+{
+	FILE* const file = fopen(u8"/proc/self/cgroup", "r");
+	if (!file)
+		return UINT_MAX;
+
+	unsigned int ret = UINT_MAX;
+	char cpu_cgroup[PATH_MAX];
+	char cpuset_cgroup[PATH_MAX];
+	int have_cpu = 0;
+	int have_cpuset = 0;
+
+	// Lines look like "hierarchy-ID:controller-list:cgroup-path"; the v2 hierarchy has ID 0 and an empty list.
+	char line[PATH_MAX + 256];
+	while (fgets(line, sizeof line, file))
+	{
+		line[strcspn(line, "\n")] = '\0';
+
+		char* const controllers = strchr(line, ':');
+		if (!controllers)
+			continue;
+		*controllers = '\0';
+		char* const cgroup = strchr(controllers + 1, ':');
+		if (!cgroup)
+			continue;
+		*cgroup = '\0';
+
+		if (!strcmp(line, "0") && controllers[1] == '\0')
+			ret = min_cores(ret, cgroup2_cores(cgroup + 1));
+		else
+		{
+			if (has_controller(controllers + 1, u8"cpu"))
+			{
+				snprintf(cpu_cgroup, sizeof cpu_cgroup, "%s", cgroup + 1);
+				have_cpu = 1;
+			}
+			if (has_controller(controllers + 1, u8"cpuset"))
+			{
+				snprintf(cpuset_cgroup, sizeof cpuset_cgroup, "%s", cgroup + 1);
+				have_cpuset = 1;
+			}
+		}
+	}
+	fclose(file);
+
+	if (have_cpu || have_cpuset)
+		ret = min_cores(ret, cgroup1_cores(have_cpu ? cpu_cgroup : NULL, have_cpuset ? cpuset_cgroup : NULL));
+	return ret;
+}
+
+unsigned int ext_num_effective_cores(void)
+{
+	unsigned int ret = min_cores(affinity_cores(), cgroup_cores());
+	if (ret == UINT_MAX)
+	{
+		ret = ext_num_cores();
+		if (!ret)
+			ret = 1;
+	}
+	return ret;
+}
+
+static pthread_mutex_t listeners_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void lock_listeners(void) { pthread_mutex_lock(&listeners_lock); }
+static void unlock_listeners(void) { pthread_mutex_unlock(&listeners_lock); }
+
 #endif // _WIN32
+
+#define EXT_MAX_CORES_LISTENERS 16
+
+struct listener
+{
+	ext_cores_listener function;
+	void* data;
+};
+
+static struct listener listeners[EXT_MAX_CORES_LISTENERS];
+static unsigned int last_effective_cores;
+
+int ext_add_cores_listener(ext_cores_listener const listener, void* const data)
+{
+	// Establish the baseline before taking the lock so the listener only sees real changes.
+	unsigned int const cores = ext_num_effective_cores();
+
+	int ret = -1;
+	lock_listeners();
+	if (!last_effective_cores)
+		last_effective_cores = cores;
+	for (size_t i = 0; i < EXT_MAX_CORES_LISTENERS; ++i)
+	{
+		if (!listeners[i].function)
+		{
+			listeners[i].function = listener;
+			listeners[i].data = data;
+			ret = 0;
+			break;
+		}
+	}
+	unlock_listeners();
+	return ret;
+}
+
+void ext_remove_cores_listener(ext_cores_listener const listener, void* const data)
+{
+	lock_listeners();
+	for (size_t i = 0; i < EXT_MAX_CORES_LISTENERS; ++i)
+	{
+		if (listeners[i].function == listener && listeners[i].data == data)
+		{
+			listeners[i].function = NULL;
+			listeners[i].data = NULL;
+			break;
+		}
+	}
+	unlock_listeners();
+}
+
+unsigned int ext_poll_effective_cores(void)
+{
+	unsigned int const cores = ext_num_effective_cores();
+
+	// Listeners are called without holding the lock so they may (un)register themselves.
+	struct listener pending[EXT_MAX_CORES_LISTENERS];
+	size_t count = 0;
+	lock_listeners();
+	if (last_effective_cores && last_effective_cores != cores)
+	{
+		for (size_t i = 0; i < EXT_MAX_CORES_LISTENERS; ++i)
+		{
+			if (listeners[i].function)
+				pending[count++] = listeners[i];
+		}
+	}
+	last_effective_cores = cores;
+	unlock_listeners();
+
+	for (size_t i = 0; i < count; ++i)
+		pending[i].function(cores, pending[i].data);
+	return cores;
+}
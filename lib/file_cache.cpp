@@ -0,0 +1,185 @@
+/*
+ * Copyright 2017 Mahdi Khanalizadeh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "ext/file_cache.hpp"
+
+#include <cerrno>
+
+#include <algorithm>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+
+namespace
+{
+
+	::std::size_t descriptor_budget(::std::size_t const capacity)
+	{
+		::rlimit limit;
+		if (::getrlimit(RLIMIT_NOFILE, &limit) == -1 || limit.rlim_cur == RLIM_INFINITY)
+			return capacity ? capacity : 1024;
+
+		auto const budget = ::std::max<::std::size_t>(static_cast<::std::size_t>(limit.rlim_cur / 2), 1);
+		return capacity ? ::std::min(capacity, budget) : budget;
+	}
+
+	bool same_file(struct ::stat const& st, ::dev_t const device, ::ino_t const inode, ::timespec const& mtime, ::off_t const size) noexcept
+	{
+		return st.st_dev == device && st.st_ino == inode && st.st_mtim.tv_sec == mtime.tv_sec && st.st_mtim.tv_nsec == mtime.tv_nsec && st.st_size == size;
+	}
+
+} // namespace
+
+namespace ext
+{
+
+	FileCache::FileCache(::std::size_t const capacity, int const flags, ::mode_t const mode, ::std::chrono::milliseconds const validate_after) :
+		m_capacity{descriptor_budget(capacity)},
+		m_flags{flags},
+		m_mode{mode},
+		m_validate_after{validate_after}
+	{
+		m_index.reserve(m_capacity);
+	}
+
+	FileCache::FileRef FileCache::open(::std::string const& path)
+	{
+		{
+			::std::lock_guard<::std::mutex> lock{m_mutex};
+			auto const it = m_index.find(path);
+			if (it != m_index.end())
+			{
+				if (is_current(*it->second))
+				{
+					++m_stats.hits;
+					m_lru.splice(m_lru.begin(), m_lru, it->second);
+					return it->second->file;
+				}
+				++m_stats.invalidations;
+				m_lru.erase(it->second);
+				m_index.erase(it);
+			}
+			++m_stats.misses;
+		}
+
+		// Open without holding the lock; a racing thread may have inserted the same path meanwhile, insert() keeps
+		// whichever comes first.
+		Entry entry = open_entry(path);
+		FileRef file = entry.file;
+		insert(::std::move(entry));
+		return file;
+	}
+
+	FileCache::Entry FileCache::open_entry(::std::string const& path)
+	{
+		int fd = ::open(path.c_str(), m_flags, m_mode);
+		if (fd == -1 && (errno == EMFILE || errno == ENFILE))
+		{
+			// Out of descriptors: give back the least recently used half and retry once.
+			{
+				::std::lock_guard<::std::mutex> lock{m_mutex};
+				evict(m_lru.size() / 2 + 1);
+			}
+			fd = ::open(path.c_str(), m_flags, m_mode);
+		}
+		if (fd == -1)
+			throw ::std::system_error{errno, ::std::system_category(), u8"open"};
+		File file{fd}; // closes fd if anything below throws
+
+		Entry entry;
+		entry.file = ::std::make_shared<File>(::std::move(file));
+
+		struct ::stat st;
+		if (::fstat(fd, &st) == -1)
+			throw ::std::system_error{errno, ::std::system_category(), u8"fstat"};
+		entry.path = path;
+		entry.device = st.st_dev;
+		entry.inode = st.st_ino;
+		entry.mtime = st.st_mtim;
+		entry.size = st.st_size;
+		entry.validated = ::std::chrono::steady_clock::now();
+		return entry;
+	}
+
+	// Called with the lock held. The stat() happens under the lock too, but only once per validate_after per entry.
+	bool FileCache::is_current(Entry& entry)
+	{
+		if (m_validate_after.count() < 0)
+			return true;
+
+		auto const now = ::std::chrono::steady_clock::now();
+		if (now - entry.validated < m_validate_after)
+			return true;
+
+		struct ::stat st;
+		if (::stat(entry.path.c_str(), &st) == -1 || !same_file(st, entry.device, entry.inode, entry.mtime, entry.size))
+			return false;
+		entry.validated = now;
+		return true;
+	}
+
+	void FileCache::insert(Entry entry)
+	{
+		::std::lock_guard<::std::mutex> lock{m_mutex};
+		if (m_index.count(entry.path))
+			return;
+
+		if (m_lru.size() >= m_capacity)
+			evict(m_lru.size() - m_capacity + 1);
+		m_lru.push_front(::std::move(entry));
+		m_index.emplace(m_lru.front().path, m_lru.begin());
+	}
+
+	void FileCache::evict(::std::size_t count)
+	{
+		for (; count && !m_lru.empty(); --count)
+		{
+			m_index.erase(m_lru.back().path);
+			m_lru.pop_back();
+			++m_stats.evictions;
+		}
+	}
+
+	void FileCache::invalidate(::std::string const& path)
+	{
+		::std::lock_guard<::std::mutex> lock{m_mutex};
+		auto const it = m_index.find(path);
+		if (it == m_index.end())
+			return;
+		m_lru.erase(it->second);
+		m_index.erase(it);
+	}
+
+	void FileCache::clear()
+	{
+		::std::lock_guard<::std::mutex> lock{m_mutex};
+		m_index.clear();
+		m_lru.clear();
+	}
+
+	FileCacheStats FileCache::stats() const
+	{
+		::std::lock_guard<::std::mutex> lock{m_mutex};
+		FileCacheStats stats = m_stats;
+		stats.size = m_lru.size();
+		return stats;
+	}
+
+} // namespace ext
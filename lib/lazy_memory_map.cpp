@@ -0,0 +1,232 @@
+/*
+ * Copyright 2017 Mahdi Khanalizadeh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "ext/lazy_memory_map.hpp"
+#include "ext/aligned_buffer.hpp"
+
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#include <algorithm>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <linux/userfaultfd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace ext
+{
+
+	LazyMemoryMap::LazyMemoryMap(::std::size_t const length, PageFiller fill, ::std::size_t const prefill_pages) :
+		m_fill{::std::move(fill)},
+		m_page_size{detail::page_size()},
+		m_batch{1 + prefill_pages}
+	{
+		assert(length);
+
+		m_map->map(nullptr, detail::align_up(length, m_page_size), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+		int fd = static_cast<int>(::syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK));
+#ifdef UFFD_USER_MODE_ONLY
+		if (fd == -1 && errno == EPERM) // vm.unprivileged_userfaultfd = 0
+			fd = static_cast<int>(::syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY));
+#endif
+		if (fd == -1)
+			throw ::std::system_error{errno, ::std::system_category(), u8"userfaultfd"};
+		m_uffd.reset(fd);
+
+		::uffdio_api api;
+		::std::memset(&api, 0, sizeof api);
+		api.api = UFFD_API;
+		if (::ioctl(fd, UFFDIO_API, &api) == -1)
+			throw ::std::system_error{errno, ::std::system_category(), u8"UFFDIO_API"};
+
+		::uffdio_register registration;
+		::std::memset(&registration, 0, sizeof registration);
+		registration.range.start = reinterpret_cast<::std::uintptr_t>(m_map->data());
+		registration.range.len = m_map->size();
+		registration.mode = UFFDIO_REGISTER_MODE_MISSING;
+		if (::ioctl(fd, UFFDIO_REGISTER, &registration) == -1)
+			throw ::std::system_error{errno, ::std::system_category(), u8"UFFDIO_REGISTER"};
+
+		fd = ::eventfd(0, EFD_CLOEXEC);
+		if (fd == -1)
+			throw ::std::system_error{errno, ::std::system_category(), u8"eventfd"};
+		m_stop.reset(fd);
+
+		m_present->map(nullptr, m_map->size() / m_page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		m_thread = ::std::thread{[this] { run(); }};
+	}
+
+	LazyMemoryMap::~LazyMemoryMap() noexcept
+	{
+		::std::uint64_t const one = 1;
+		while (::write(m_stop.get(), &one, sizeof one) == -1 && errno == EINTR)
+		{
+		}
+		m_thread.join();
+	}
+
+	void LazyMemoryMap::prefill(::std::size_t const offset, ::std::size_t const length)
+	{
+		assert(offset <= size() && length <= size() - offset);
+
+		::std::size_t const pages = size() / m_page_size;
+		::std::size_t first = offset / m_page_size;
+		::std::size_t const end = ::std::min(detail::align_up(offset + length, m_page_size) / m_page_size, pages);
+
+		// Runs of missing pages are filled in chunks of a few batches, so one fill call covers many pages.
+		::std::size_t const chunk = ::std::max<::std::size_t>(m_batch, 16);
+		AlignedBuffer buffer{chunk * m_page_size, m_page_size};
+		while (first < end)
+		{
+			if (present(first))
+			{
+				++first;
+				continue;
+			}
+			::std::size_t last = first + 1;
+			while (last < end && last - first < chunk && !present(last))
+				++last;
+			fill_range(first, last, buffer.data());
+			first = last;
+		}
+	}
+
+	void LazyMemoryMap::check()
+	{
+		::std::lock_guard<::std::mutex> lock{m_mutex};
+		if (m_error)
+			::std::rethrow_exception(m_error);
+	}
+
+	void LazyMemoryMap::run() noexcept
+	{
+		AlignedBuffer buffer{m_batch * m_page_size, m_page_size};
+		auto const base = reinterpret_cast<::std::uintptr_t>(m_map->data());
+		::pollfd fds[2] = {{m_uffd.get(), POLLIN, 0}, {m_stop.get(), POLLIN, 0}};
+		for (;;)
+		{
+			if (::poll(fds, 2, -1) == -1)
+			{
+				if (errno == EINTR)
+					continue;
+				::std::lock_guard<::std::mutex> lock{m_mutex};
+				m_error = ::std::make_exception_ptr(::std::system_error{errno, ::std::system_category(), u8"poll"});
+				return;
+			}
+			if (fds[1].revents)
+				return;
+
+			::uffd_msg messages[16];
+			long const ret = ::read(m_uffd.get(), messages, sizeof messages);
+			if (ret == -1)
+				continue; // EAGAIN: another fault resolution woke the thread first, or EINTR
+
+			for (long i = 0; i < ret / static_cast<long>(sizeof *messages); ++i)
+			{
+				if (messages[i].event == UFFD_EVENT_PAGEFAULT)
+					handle_fault(static_cast<::std::size_t>(messages[i].arg.pagefault.address - base) / m_page_size, buffer.data());
+			}
+		}
+	}
+
+	void LazyMemoryMap::handle_fault(::std::size_t const page, void* const buffer) noexcept
+	{
+		// Prefill the following pages of the batch up to the first one that is already there.
+		::std::size_t const pages = size() / m_page_size;
+		::std::size_t last = page + 1;
+		while (last < pages && last - page < m_batch && !present(last))
+			++last;
+
+		try
+		{
+			fill_range(page, last, buffer);
+		}
+		catch (...)
+		{
+			{
+				::std::lock_guard<::std::mutex> lock{m_mutex};
+				if (!m_error)
+					m_error = ::std::current_exception();
+			}
+
+			try
+			{
+				::std::memset(buffer, 0, (last - page) * m_page_size);
+				install(page, last, buffer);
+			}
+			catch (...)
+			{
+				// Nothing else can resolve the fault.
+				::std::terminate();
+			}
+		}
+	}
+
+	void LazyMemoryMap::fill_range(::std::size_t const first, ::std::size_t const last, void* const buffer)
+	{
+		m_fill(first * m_page_size, buffer, (last - first) * m_page_size);
+		install(first, last, buffer);
+	}
+
+	void LazyMemoryMap::install(::std::size_t const first, ::std::size_t const last, void const* const buffer)
+	{
+		auto const base = reinterpret_cast<::std::uintptr_t>(m_map->data());
+		auto const source = reinterpret_cast<::std::uintptr_t>(buffer);
+		::std::size_t done = first;
+		while (done < last)
+		{
+			::uffdio_copy copy;
+			::std::memset(&copy, 0, sizeof copy);
+			copy.dst = base + done * m_page_size;
+			copy.src = source + (done - first) * m_page_size;
+			copy.len = (last - done) * m_page_size;
+
+			// Copies the pages and wakes the threads waiting for them.
+			int const ret = ::ioctl(m_uffd.get(), UFFDIO_COPY, &copy);
+			int const error = errno;
+			::std::size_t const copied = copy.copy > 0 ? static_cast<::std::size_t>(copy.copy) / m_page_size : 0;
+			for (::std::size_t i = done; i < done + copied; ++i)
+				set_present(i);
+			m_filled.fetch_add(copied, ::std::memory_order_relaxed);
+			done += copied;
+			if (ret != -1 || copied)
+				continue;
+
+			if (error == EEXIST)
+			{
+				// Someone else filled this page first; make sure its waiters run.
+				set_present(done);
+				::uffdio_range range{base + done * m_page_size, m_page_size};
+				::ioctl(m_uffd.get(), UFFDIO_WAKE, &range);
+				++done;
+			}
+			else if (error != EAGAIN)
+				throw ::std::system_error{error, ::std::system_category(), u8"UFFDIO_COPY"};
+		}
+	}
+
+} // namespace ext
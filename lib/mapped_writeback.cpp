@@ -0,0 +1,226 @@
+/*
+ * Copyright 2017 Mahdi Khanalizadeh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "ext/mapped_writeback.hpp"
+#include "ext/aligned_buffer.hpp"
+
+#include <cassert>
+#include <cerrno>
+
+#include <algorithm>
+#include <system_error>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace ext
+{
+
+	MappedWriteback::MappedWriteback(MemoryMap const& map, WritebackOptions const& options) :
+		m_data{static_cast<char*>(map.data())},
+		m_size{map.size()},
+		m_options(options),
+		m_thread{[this] { run(); }}
+	{
+	}
+
+	MappedWriteback::MappedWriteback(MemoryMap const& map, FilePtr const& file, ::off_t const file_offset, WritebackOptions const& options) :
+		m_data{static_cast<char*>(map.data())},
+		m_size{map.size()},
+		m_fd{file.get()},
+		m_file_offset{file_offset},
+		m_options(options),
+		m_thread{[this] { run(); }}
+	{
+	}
+
+	MappedWriteback::~MappedWriteback() noexcept
+	{
+		try
+		{
+			sync();
+		}
+		catch (...)
+		{
+		}
+
+		{
+			::std::lock_guard<::std::mutex> lock{m_mutex};
+			m_stop = true;
+		}
+		m_wake.notify_one();
+		m_thread.join();
+	}
+
+	void MappedWriteback::add_range(Ranges& ranges, ::std::size_t first, ::std::size_t last)
+	{
+		// Merge with every range that overlaps or touches [first, last).
+		auto it = ranges.upper_bound(first);
+		if (it != ranges.begin() && ::std::prev(it)->second >= first)
+			--it;
+		while (it != ranges.end() && it->first <= last)
+		{
+			first = ::std::min(first, it->first);
+			last = ::std::max(last, it->second);
+			it = ranges.erase(it);
+		}
+		ranges.emplace_hint(it, first, last);
+	}
+
+	void MappedWriteback::mark_dirty(::std::size_t const offset, ::std::size_t const length)
+	{
+		assert(offset + length <= m_size);
+
+		if (!length)
+			return;
+
+		::std::size_t const page = detail::page_size();
+		::std::size_t const first = offset / page * page;
+		::std::size_t const last = ::std::min(detail::align_up(offset + length, page), m_size);
+
+		bool wake;
+		{
+			::std::lock_guard<::std::mutex> lock{m_mutex};
+			add_range(m_dirty, first, last);
+			m_dirty_bytes += last - first; // an upper bound, overlaps are counted twice until the next writeback
+			wake = m_dirty_bytes >= m_options.dirty_limit;
+		}
+		if (wake)
+			m_wake.notify_one();
+	}
+
+	::std::uint64_t MappedWriteback::checkpoint()
+	{
+		::std::uint64_t ticket;
+		{
+			::std::lock_guard<::std::mutex> lock{m_mutex};
+			ticket = ++m_requested;
+		}
+		m_wake.notify_one();
+		return ticket;
+	}
+
+	void MappedWriteback::wait(::std::uint64_t const ticket)
+	{
+		::std::unique_lock<::std::mutex> lock{m_mutex};
+		m_done.wait(lock, [&] { return m_completed >= ticket || m_error; });
+		if (m_completed < ticket)
+			::std::rethrow_exception(m_error);
+	}
+
+	::std::size_t MappedWriteback::dirty_bytes() const
+	{
+		::std::lock_guard<::std::mutex> lock{m_mutex};
+		::std::size_t bytes = 0;
+		for (auto const& range : m_dirty)
+			bytes += range.second - range.first;
+		return bytes;
+	}
+
+	void MappedWriteback::run() noexcept
+	{
+		::std::unique_lock<::std::mutex> lock{m_mutex};
+		while (!m_stop)
+		{
+			m_wake.wait_for(lock, m_options.interval, [this] { return m_stop || m_requested > m_completed || m_dirty_bytes >= m_options.dirty_limit; });
+
+			try
+			{
+				if (m_requested > m_completed)
+				{
+					// Everything marked before the checkpoint was requested is in one of the two sets.
+					::std::uint64_t const target = m_requested;
+					Ranges ranges = ::std::move(m_unsynced);
+					m_unsynced.clear();
+					for (auto const& range : m_dirty)
+						add_range(ranges, range.first, range.second);
+					m_dirty.clear();
+					m_dirty_bytes = 0;
+
+					lock.unlock();
+					make_durable(ranges);
+					lock.lock();
+
+					m_completed = target;
+					m_done.notify_all();
+				}
+				else if (!m_dirty.empty())
+				{
+					// Moved before writeback starts so that a checkpoint racing with it still covers these ranges.
+					Ranges ranges = ::std::move(m_dirty);
+					m_dirty.clear();
+					m_dirty_bytes = 0;
+					for (auto const& range : ranges)
+						add_range(m_unsynced, range.first, range.second);
+
+					lock.unlock();
+					start_writeback(ranges);
+					lock.lock();
+				}
+			}
+			catch (...)
+			{
+				if (!lock.owns_lock())
+					lock.lock();
+				m_error = ::std::current_exception();
+				m_done.notify_all();
+				return;
+			}
+		}
+	}
+
+	void MappedWriteback::start_writeback(Ranges const& ranges)
+	{
+		for (auto const& range : ranges)
+		{
+			::std::size_t const length = range.second - range.first;
+			int const ret = m_fd != -1
+				? ::sync_file_range(m_fd, m_file_offset + static_cast<::off_t>(range.first), static_cast<::off_t>(length), SYNC_FILE_RANGE_WRITE)
+				: ::msync(m_data + range.first, length, MS_ASYNC);
+			if (ret == -1)
+				throw ::std::system_error{errno, ::std::system_category(), m_fd != -1 ? u8"sync_file_range" : u8"msync"};
+		}
+	}
+
+	void MappedWriteback::make_durable(Ranges const& ranges)
+	{
+		if (m_fd == -1)
+		{
+			// msync(MS_SYNC) writes and waits for the range and flushes the metadata needed to read it back.
+			for (auto const& range : ranges)
+			{
+				if (::msync(m_data + range.first, range.second - range.first, MS_SYNC) == -1)
+					throw ::std::system_error{errno, ::std::system_category(), u8"msync"};
+			}
+			return;
+		}
+
+		// Start writeback of every range before waiting for any, so the device sees all of them at once, then let a
+		// single fdatasync() flush the metadata and the disk cache instead of one msync() doing so per range.
+		start_writeback(ranges);
+		for (auto const& range : ranges)
+		{
+			if (::sync_file_range(m_fd, m_file_offset + static_cast<::off_t>(range.first), static_cast<::off_t>(range.second - range.first), SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER) == -1)
+				throw ::std::system_error{errno, ::std::system_category(), u8"sync_file_range"};
+		}
+		if (::fdatasync(m_fd) == -1)
+			throw ::std::system_error{errno, ::std::system_category(), u8"fdatasync"};
+	}
+
+} // namespace ext
@@ -0,0 +1,289 @@
+/*
+ * Copyright 2017 Mahdi Khanalizadeh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ext/thread_pool.hpp"
+#include "ext/cores.h"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+namespace
+{
+
+	thread_local ::ext::ThreadPool* current_pool = nullptr;
+	thread_local unsigned int current_worker = 0;
+
+	struct CpuSetDeleter
+	{
+		void operator()(::cpu_set_t* const set) const noexcept { CPU_FREE(set); }
+	};
+
+	using CpuSetPtr = ::std::unique_ptr<::cpu_set_t, CpuSetDeleter>;
+
+	// Processors a mask has to cover. A plain cpu_set_t only holds the first CPU_SETSIZE.
+	int configured_cpus() noexcept
+	{
+		long const configured = ::sysconf(_SC_NPROCESSORS_CONF);
+		return configured > CPU_SETSIZE ? static_cast<int>(configured) : CPU_SETSIZE;
+	}
+
+	// Returns the n-th processor of the affinity mask or -1.
+	int nth_allowed_cpu(unsigned int n)
+	{
+		int const cpus = ::configured_cpus();
+		CpuSetPtr const set{CPU_ALLOC(cpus)};
+		if (!set)
+			return -1;
+
+		::std::size_t const size = CPU_ALLOC_SIZE(cpus);
+		CPU_ZERO_S(size, set.get());
+		if (::sched_getaffinity(0, size, set.get()) == -1)
+			return -1;
+
+		unsigned int const count = static_cast<unsigned int>(CPU_COUNT_S(size, set.get()));
+		if (!count)
+			return -1;
+		n %= count;
+		for (int cpu = 0; cpu < cpus; ++cpu)
+		{
+			if (CPU_ISSET_S(static_cast<::std::size_t>(cpu), size, set.get()) && !n--)
+				return cpu;
+		}
+		return -1;
+	}
+
+} // namespace
+
+namespace ext
+{
+
+	ThreadPool::ThreadPool(unsigned int threads, bool const pin)
+	{
+		if (!threads)
+			threads = ::ext_num_effective_cores();
+
+		m_workers.reserve(threads);
+		for (unsigned int i = 0; i < threads; ++i)
+			m_workers.emplace_back(new Worker);
+
+		try
+		{
+			for (unsigned int i = 0; i < threads; ++i)
+				m_workers[i]->thread = ::std::thread{&ThreadPool::work, this, i, pin ? ::nth_allowed_cpu(i) : -1};
+		}
+		catch (...)
+		{
+			m_stop.store(true);
+			{
+				::std::lock_guard<::std::mutex> lock{m_sleep_mutex};
+				m_sleep_cv.notify_all();
+			}
+			for (auto& worker : m_workers)
+			{
+				if (worker->thread.joinable())
+					worker->thread.join();
+			}
+			throw;
+		}
+	}
+
+	ThreadPool::~ThreadPool() noexcept
+	{
+		// Drain remaining work before shutting down; submitted tasks may own resources.
+		while (run_one())
+			;
+
+		m_stop.store(true);
+		{
+			::std::lock_guard<::std::mutex> lock{m_sleep_mutex};
+			m_sleep_cv.notify_all();
+		}
+		for (auto& worker : m_workers)
+			worker->thread.join();
+
+		for (auto& worker : m_workers)
+		{
+			while (detail::Task* const task = worker->deque.pop())
+				delete task;
+		}
+		for (detail::Task* const task : m_injected)
+			delete task;
+	}
+
+	ThreadPool* ThreadPool::current() noexcept
+	{
+		return ::current_pool;
+	}
+
+	unsigned int ThreadPool::current_index() const noexcept
+	{
+		return ::current_pool == this ? ::current_worker : size();
+	}
+
+	ThreadPool& ThreadPool::global()
+	{
+		static ThreadPool pool;
+		return pool;
+	}
+
+	void ThreadPool::push(detail::Task* const task)
+	{
+		if (::current_pool == this)
+			m_workers[::current_worker]->deque.push(task);
+		else
+		{
+			::std::lock_guard<::std::mutex> lock{m_injected_mutex};
+			m_injected.push_back(task);
+			m_injected_size.fetch_add(1, ::std::memory_order_relaxed);
+		}
+
+		// A sleeper registers itself before it rechecks the epoch, so either it sees the new epoch or we see it.
+		m_epoch.fetch_add(1, ::std::memory_order_seq_cst);
+		if (m_sleepers.load(::std::memory_order_seq_cst))
+		{
+			::std::lock_guard<::std::mutex> lock{m_sleep_mutex};
+			m_sleep_cv.notify_one();
+		}
+	}
+
+	detail::Task* ThreadPool::find_task(unsigned int const self)
+	{
+		if (self < size())
+		{
+			if (detail::Task* const task = m_workers[self]->deque.pop())
+				return task;
+		}
+
+		if (m_injected_size.load(::std::memory_order_relaxed))
+		{
+			::std::lock_guard<::std::mutex> lock{m_injected_mutex};
+			if (!m_injected.empty())
+			{
+				detail::Task* const task = m_injected.front();
+				m_injected.pop_front();
+				m_injected_size.fetch_sub(1, ::std::memory_order_relaxed);
+				return task;
+			}
+		}
+
+		// Start stealing at a different victim for every worker to spread contention.
+		unsigned int const count = size();
+		unsigned int const start = self < count ? self + 1 : 0;
+		for (unsigned int i = 0; i < count; ++i)
+		{
+			unsigned int const victim = (start + i) % count;
+			if (victim == self)
+				continue;
+			if (detail::Task* const task = m_workers[victim]->deque.steal())
+				return task;
+		}
+		return nullptr;
+	}
+
+	bool ThreadPool::run_one()
+	{
+		detail::Task* const task = find_task(current_index());
+		if (!task)
+			return false;
+
+		task->run();
+		delete task;
+		return true;
+	}
+
+	void ThreadPool::work(unsigned int const index, int const cpu)
+	{
+		::current_pool = this;
+		::current_worker = index;
+
+		if (cpu != -1)
+		{
+			// Pinning is best effort.
+			int const cpus = ::std::max(cpu + 1, ::configured_cpus());
+			::CpuSetPtr const set{CPU_ALLOC(cpus)};
+			if (set)
+			{
+				::std::size_t const size = CPU_ALLOC_SIZE(cpus);
+				CPU_ZERO_S(size, set.get());
+				CPU_SET_S(static_cast<::std::size_t>(cpu), size, set.get());
+				::pthread_setaffinity_np(::pthread_self(), size, set.get());
+			}
+		}
+
+		while (!m_stop.load(::std::memory_order_relaxed))
+		{
+			::std::uint64_t const epoch = m_epoch.load(::std::memory_order_seq_cst);
+			if (detail::Task* const task = find_task(index))
+			{
+				task->run();
+				delete task;
+				continue;
+			}
+
+			// Spin briefly before going to sleep; new work tends to arrive in bursts.
+			bool found = false;
+			for (int i = 0; i < 64 && !found; ++i)
+			{
+				::std::this_thread::yield();
+				found = m_epoch.load(::std::memory_order_relaxed) != epoch;
+			}
+			if (found)
+				continue;
+
+			::std::unique_lock<::std::mutex> lock{m_sleep_mutex};
+			m_sleepers.fetch_add(1, ::std::memory_order_seq_cst);
+			m_sleep_cv.wait(lock, [&]{ return m_stop.load(::std::memory_order_relaxed) || m_epoch.load(::std::memory_order_seq_cst) != epoch; });
+			m_sleepers.fetch_sub(1, ::std::memory_order_relaxed);
+		}
+
+		::current_pool = nullptr;
+	}
+
+	void TaskGroup::finish() noexcept
+	{
+		// Decrement under the lock: wait() takes the lock before returning, so the group outlives this call.
+		::std::lock_guard<::std::mutex> lock{m_mutex};
+		if (m_pending.fetch_sub(1, ::std::memory_order_acq_rel) == 1)
+			m_cv.notify_all();
+	}
+
+	void TaskGroup::wait()
+	{
+		while (m_pending.load(::std::memory_order_acquire))
+		{
+			if (m_pool.run_one())
+				continue;
+
+			// Our tasks are running elsewhere. Do not block indefinitely: they may spawn tasks we could help with.
+			::std::unique_lock<::std::mutex> lock{m_mutex};
+			m_cv.wait_for(lock, ::std::chrono::microseconds{100}, [&]{ return !m_pending.load(::std::memory_order_acquire); });
+		}
+
+		::std::exception_ptr exception;
+		{
+			::std::lock_guard<::std::mutex> lock{m_mutex};
+			::std::swap(exception, m_exception);
+		}
+		if (exception)
+			::std::rethrow_exception(exception);
+	}
+
+} // namespace ext
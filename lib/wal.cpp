@@ -0,0 +1,403 @@
+/*
+ * Copyright 2017 Mahdi Khanalizadeh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "ext/wal.hpp"
+#include "ext/buffered_file.hpp"
+#include "ext/crc32c.hpp"
+
+#include <cassert>
+#include <cerrno>
+#include <cinttypes>
+#include <climits>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <memory>
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+
+	using Lsn = ::ext::Wal::Lsn;
+
+	struct Header
+	{
+		::std::uint32_t crc;
+		::std::uint32_t size;
+		Lsn lsn;
+	};
+
+	static_assert(sizeof(Header) == 16, "Header must not contain padding");
+
+	// The payload checksum is extended by size and lsn, so appenders can checksum the payload before taking the lock.
+	::std::uint32_t record_crc(::std::uint32_t const payload_crc, Header const& header) noexcept
+	{
+		return ::ext::crc32c(payload_crc, &header.size, sizeof header - offsetof(Header, size));
+	}
+
+	::std::string segment_name(Lsn const first)
+	{
+		char name[32];
+		::std::snprintf(name, sizeof name, "%016" PRIx64 ".wal", first);
+		return name;
+	}
+
+	bool parse_segment_name(char const* const name, Lsn& first) noexcept
+	{
+		if (::std::strlen(name) != 20 || ::std::strcmp(name + 16, ".wal"))
+			return false;
+		char* end;
+		first = ::std::strtoull(name, &end, 16);
+		return end == name + 16;
+	}
+
+	bool is_zero(char const* const data, ::std::size_t const size) noexcept
+	{
+		return ::std::all_of(data, data + size, [](char const c) { return !c; });
+	}
+
+	void write_zeros(::ext::File& file, ::off_t const offset, ::off_t const length)
+	{
+		::std::vector<char> const zeros(static_cast<::std::size_t>(::std::min<::off_t>(length, 1024 * 1024)));
+		for (::off_t done = 0; done < length; done += static_cast<::off_t>(zeros.size()))
+			file.pwrite_all(zeros.data(), static_cast<::std::size_t>(::std::min<::off_t>(length - done, static_cast<::off_t>(zeros.size()))), offset + done);
+	}
+
+	// Hands the valid records of a segment with LSNs below limit to function(lsn, data, size). Advances next and
+	// offset past them. Returns false if the records are followed by garbage rather than zeros or the end of the file,
+	// which is what a torn write leaves behind.
+	template <typename Function>
+	bool scan(::ext::BufferedReader& reader, ::std::uint64_t const file_size, Lsn& next, ::std::size_t& offset, Lsn const limit, Function const& function)
+	{
+		while (next < limit)
+		{
+			char const* data = reader.peek(sizeof(Header));
+			if (!data)
+				return is_zero(reader.data(), reader.size());
+
+			Header header;
+			::std::memcpy(&header, data, sizeof header);
+			if (is_zero(data, sizeof header))
+				return true;
+			if (header.lsn != next || header.size > file_size - offset - sizeof header)
+				return false;
+
+			data = reader.peek(sizeof header + header.size);
+			if (!data || record_crc(::ext::crc32c(0, data + sizeof header, header.size), header) != header.crc)
+				return false;
+
+			function(next, data + sizeof header, static_cast<::std::size_t>(header.size));
+			reader.consume(sizeof header + header.size);
+			offset += sizeof header + header.size;
+			++next;
+		}
+		return true;
+	}
+
+	struct DirCloser
+	{
+		void operator()(DIR* const dir) const noexcept { ::closedir(dir); }
+	};
+
+} // namespace
+
+namespace ext
+{
+
+	Wal::Wal(::std::string directory, WalOptions const& options) :
+		m_directory{::std::move(directory)},
+		m_options(options)
+	{
+		if (::mkdir(m_directory.c_str(), 0755) == -1 && errno != EEXIST)
+			throw ::std::system_error{errno, ::std::system_category(), u8"mkdir"};
+		m_directory_file->open(m_directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC, 0);
+
+		recover();
+	}
+
+	Wal::~Wal() noexcept
+	{
+		// Best effort, like BufferedWriter: records nobody waited for are still written.
+		try
+		{
+			if (next_lsn() != durable_lsn())
+				sync(next_lsn() - 1);
+		}
+		catch (...)
+		{
+		}
+	}
+
+	void Wal::recover()
+	{
+		::std::unique_ptr<DIR, DirCloser> const dir{::opendir(m_directory.c_str())};
+		if (!dir)
+			throw ::std::system_error{errno, ::std::system_category(), u8"opendir"};
+		errno = 0;
+		while (::dirent const* const entry = ::readdir(dir.get()))
+		{
+			Lsn first;
+			if (parse_segment_name(entry->d_name, first))
+				m_segments.push_back({first, m_directory + '/' + entry->d_name});
+		}
+		if (errno)
+			throw ::std::system_error{errno, ::std::system_category(), u8"readdir"};
+
+		if (m_segments.empty())
+		{
+			create_segment(0);
+			return;
+		}
+		::std::sort(m_segments.begin(), m_segments.end(), [](Segment const& lhs, Segment const& rhs) { return lhs.first < rhs.first; });
+
+		// Every segment but the last was synced before the next one was created, so only the last needs a scan.
+		Segment const& last = m_segments.back();
+		m_file->open(last.path.c_str(), O_RDWR | O_CLOEXEC, 0);
+		File& file = *m_file.operator->();
+		auto const file_size = static_cast<::std::uint64_t>(file.size());
+
+		Lsn next = last.first;
+		::std::size_t offset = 0;
+		bool clean;
+		{
+			BufferedReader reader{file};
+			clean = scan(reader, file_size, next, offset, ~Lsn{0}, [](Lsn, char const*, ::std::size_t) {});
+		}
+
+		if (!clean)
+		{
+			// Clear the torn tail so that stale records behind it can never line up with future ones.
+			auto const length = static_cast<::off_t>(file_size - offset);
+			try
+			{
+				file.zero_range(static_cast<::off_t>(offset), length, true);
+			}
+			catch (::std::system_error const&)
+			{
+				write_zeros(file, static_cast<::off_t>(offset), length);
+			}
+			file.fdatasync();
+		}
+
+		m_offset = offset;
+		m_next_lsn = next;
+		m_durable_lsn = next;
+	}
+
+	void Wal::create_segment(Lsn const first)
+	{
+		Segment segment{first, m_directory + '/' + segment_name(first)};
+
+		FilePtr file;
+		file->open(segment.path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		auto const size = static_cast<::off_t>(m_options.segment_size);
+		try
+		{
+			// Asks for contiguous blocks up front; the zeros below are what spares fdatasync() the metadata.
+			file->preallocate(0, size);
+		}
+		catch (::std::system_error const& error)
+		{
+			if (error.code().value() != EOPNOTSUPP)
+				throw;
+		}
+		write_zeros(*file.operator->(), 0, size);
+		file->fsync();
+		m_directory_file->fsync();
+
+		m_file = ::std::move(file);
+		m_offset = 0;
+
+		::std::lock_guard<::std::mutex> lock{m_mutex};
+		m_segments.push_back(::std::move(segment));
+	}
+
+	Wal::Lsn Wal::append(void const* const data, ::std::size_t const size)
+	{
+		if (size > UINT32_MAX)
+			throw ::std::length_error{u8"Wal::append: record too large"};
+
+		::std::uint32_t const payload_crc = crc32c(0, data, size);
+
+		::std::lock_guard<::std::mutex> lock{m_mutex};
+		if (m_error)
+			::std::rethrow_exception(m_error);
+
+		Header header{0, static_cast<::std::uint32_t>(size), m_next_lsn};
+		header.crc = record_crc(payload_crc, header);
+
+		::std::size_t const start = m_batch.size();
+		m_batch.resize(start + sizeof header + size);
+		::std::memcpy(m_batch.data() + start, &header, sizeof header);
+		::std::memcpy(m_batch.data() + start + sizeof header, data, size);
+		m_records.push_back(start);
+
+		// Cut a running commit window short.
+		if (m_committing && start < m_options.commit_bytes && m_batch.size() >= m_options.commit_bytes)
+			m_cv.notify_all();
+
+		return m_next_lsn++;
+	}
+
+	void Wal::sync(Lsn const lsn)
+	{
+		::std::unique_lock<::std::mutex> lock{m_mutex};
+		assert(lsn < m_next_lsn);
+
+		while (m_durable_lsn <= lsn)
+		{
+			if (m_error)
+				::std::rethrow_exception(m_error);
+			if (m_committing)
+			{
+				m_cv.wait(lock);
+				continue;
+			}
+
+			// Become the leader and commit everything appended so far on behalf of all waiting threads.
+			m_committing = true;
+			if (m_options.commit_window.count())
+			{
+				auto const deadline = ::std::chrono::steady_clock::now() + m_options.commit_window;
+				m_cv.wait_until(lock, deadline, [this] { return m_batch.size() >= m_options.commit_bytes; });
+			}
+
+			m_batch.swap(m_spare);
+			m_records.swap(m_spare_records);
+			Lsn const end = m_next_lsn;
+			lock.unlock();
+
+			try
+			{
+				write_batch(m_spare, m_spare_records);
+			}
+			catch (...)
+			{
+				lock.lock();
+				m_error = ::std::current_exception();
+				m_committing = false;
+				m_cv.notify_all();
+				throw;
+			}
+			m_spare.clear();
+			m_spare_records.clear();
+
+			lock.lock();
+			m_durable_lsn = end;
+			m_committing = false;
+			m_cv.notify_all();
+		}
+	}
+
+	void Wal::write_batch(::std::vector<char> const& batch, ::std::vector<::std::size_t> const& records)
+	{
+		::std::size_t written = 0;
+		::std::size_t first = 0;
+		while (first < records.size())
+		{
+			// Take as many records as fit into the current segment. An empty segment takes at least one.
+			::std::size_t last = first;
+			::std::size_t end = written;
+			for (; last < records.size(); ++last)
+			{
+				::std::size_t const record_end = last + 1 < records.size() ? records[last + 1] : batch.size();
+				if (m_offset + (record_end - written) > m_options.segment_size && (m_offset || last != first))
+					break;
+				end = record_end;
+			}
+
+			if (last == first)
+			{
+				// The segment is full and was synced by the previous write.
+				Header header;
+				::std::memcpy(&header, batch.data() + records[first], sizeof header);
+				create_segment(header.lsn);
+				continue;
+			}
+
+			m_file->pwrite_all(batch.data() + written, end - written, static_cast<::off_t>(m_offset));
+			m_file->fdatasync();
+			m_offset += end - written;
+			written = end;
+			first = last;
+		}
+	}
+
+	Wal::Lsn Wal::next_lsn() const
+	{
+		::std::lock_guard<::std::mutex> lock{m_mutex};
+		return m_next_lsn;
+	}
+
+	Wal::Lsn Wal::durable_lsn() const
+	{
+		::std::lock_guard<::std::mutex> lock{m_mutex};
+		return m_durable_lsn;
+	}
+
+	void Wal::replay(Lsn const first, ::std::function<void(Lsn, char const*, ::std::size_t)> const& function) const
+	{
+		::std::vector<Segment> segments;
+		Lsn durable;
+		{
+			::std::lock_guard<::std::mutex> lock{m_mutex};
+			segments = m_segments;
+			durable = m_durable_lsn;
+		}
+
+		for (::std::size_t i = 0; i < segments.size(); ++i)
+		{
+			if (i + 1 < segments.size() && segments[i + 1].first <= first)
+				continue;
+
+			FilePtr file;
+			file->open(segments[i].path.c_str(), O_RDONLY | O_CLOEXEC, 0);
+			BufferedReader reader{*file.operator->()};
+			Lsn next = segments[i].first;
+			::std::size_t offset = 0;
+			scan(reader, static_cast<::std::uint64_t>(file->size()), next, offset, durable, [&](Lsn const lsn, char const* const data, ::std::size_t const size)
+			{
+				if (lsn >= first)
+					function(lsn, data, size);
+			});
+			if (next >= durable)
+				break;
+		}
+	}
+
+	void Wal::remove_before(Lsn const lsn)
+	{
+		::std::lock_guard<::std::mutex> lock{m_mutex};
+		while (m_segments.size() > 1 && m_segments[1].first <= lsn)
+		{
+			if (::unlink(m_segments.front().path.c_str()) == -1 && errno != ENOENT)
+				throw ::std::system_error{errno, ::std::system_category(), u8"unlink"};
+			m_segments.erase(m_segments.begin());
+		}
+	}
+
+} // namespace ext
@@ -1,24 +1,1668 @@
 #include "ext/color.hpp"
+#include "ext/cores.h"
 #include "ext/vector2.hpp"
 #include "ext/vector3.hpp"
 #include "ext/vector4.hpp"
 #include "ext/matrix2.hpp"
+#include "ext/thread_pool.hpp"
+#include "ext/concurrent_queue.hpp"
+#include "ext/per_cpu.hpp"
+#include "ext/perf_event.hpp"
+#include "ext/async_file.hpp"
+#include "ext/file.hpp"
+#include "ext/buffered_file.hpp"
+#include "ext/aligned_buffer.hpp"
+#include "ext/chunked_reader.hpp"
+#include "ext/wal.hpp"
+#include "ext/file_cache.hpp"
+#include "ext/memory_map.hpp"
+#include "ext/prefault.hpp"
+#include "ext/growable_memory_map.hpp"
+#include "ext/span.hpp"
+#include "ext/column_file.hpp"
+#include "ext/mapped_writeback.hpp"
+#include "ext/ring_buffer.hpp"
+#include "ext/shared_memory.hpp"
+#include "ext/arena.hpp"
+#include "ext/memory_resource.hpp"
+#include "ext/hash_index.hpp"
+#include "ext/window_map.hpp"
+#include "ext/lazy_memory_map.hpp"
 
 #include <cassert>
+#include <climits>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <dirent.h>
 #include <iostream>
+#include <list>
+#include <memory>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
 
 #ifdef NDEBUG
 #error "Tests cannot be build with NDEBUG defined"
 #endif
 
+namespace
+{
+
+	// Path of a scratch file in /tmp that does not exist yet.
+	::std::string temp_path(char const* const name)
+	{
+		::std::string path = u8"/tmp/ext-tests-" + ::std::to_string(::getpid()) + u8"-" + name;
+		::unlink(path.c_str());
+		return path;
+	}
+
+	//--<<//>>--// cores //--<<//>>--//
+	void on_cores_changed(unsigned int, void*) {}
+
+	void test_cores()
+	{
+		unsigned int const installed = ::ext_num_cores();
+		unsigned int const effective = ::ext_num_effective_cores();
+		assert(effective >= 1);
+		assert(!installed || effective <= installed);
+		assert(::ext_poll_effective_cores() == effective);
+		assert(::ext_add_cores_listener(&on_cores_changed, nullptr) == 0);
+		::ext_remove_cores_listener(&on_cores_changed, nullptr);
+	}
+
+	//--<<//>>--// thread pool //--<<//>>--//
+	void test_thread_pool()
+	{
+		ext::ThreadPool pool{4};
+		assert(pool.size() == 4);
+
+		::std::vector<int> values(100000);
+		ext::parallel_for(pool, 0, values.size(), 0, [&](::std::size_t const first, ::std::size_t const last)
+		{
+			for (::std::size_t i = first; i < last; ++i)
+				values[i] = static_cast<int>(i % 7);
+		});
+		long const sum = ext::parallel_reduce(pool, 0, values.size(), 64, 0l, [&](::std::size_t const first, ::std::size_t const last)
+		{
+			long partial = 0;
+			for (::std::size_t i = first; i < last; ++i)
+				partial += values[i];
+			return partial;
+		}, [](long const a, long const b) { return a + b; });
+		assert(sum == ::std::accumulate(values.begin(), values.end(), 0l));
+
+		// bool partials are written by several workers at once.
+		bool const all_small = ext::parallel_reduce(pool, 0, values.size(), 1, true, [&](::std::size_t const first, ::std::size_t const last)
+		{
+			return ::std::all_of(values.begin() + static_cast<long>(first), values.begin() + static_cast<long>(last), [](int const value) { return value < 7; });
+		}, [](bool const a, bool const b) { return a && b; });
+		assert(all_small);
+
+		ext::TaskGroup group{pool};
+		::std::atomic<int> ran{0};
+		for (int i = 0; i < 100; ++i)
+			group.run([&ran] { ++ran; });
+		group.run([] { throw ::std::runtime_error{u8"task failed"}; });
+		bool caught = false;
+		try
+		{
+			group.wait();
+		}
+		catch (::std::runtime_error const&)
+		{
+			caught = true;
+		}
+		assert(caught && ran == 100);
+
+		ext::ThreadPool pinned{2, true};
+		ext::TaskGroup pinned_group{pinned};
+		pinned_group.run([&ran] { ++ran; });
+		pinned_group.wait();
+		assert(ran == 101);
+	}
+
+	//--<<//>>--// concurrent queues //--<<//>>--//
+	void test_concurrent_queues()
+	{
+		ext::SpscQueue<int> spsc{3};
+		assert(spsc.capacity() == 4);
+		for (int i = 0; i < 4; ++i)
+			assert(spsc.try_push(i));
+		assert(!spsc.try_push(4));
+		int batch[4];
+		assert(spsc.try_pop(batch, 4) == 4 && batch[0] == 0 && batch[3] == 3);
+		assert(spsc.empty());
+
+		// Blocking push and pop through a small ring exercise the EventCount sleep and wake paths.
+		long const items = 200000;
+		::std::thread producer{[&spsc, items]
+		{
+			for (long i = 0; i < items; ++i)
+				spsc.push(static_cast<int>(i));
+		}};
+		long sum = 0;
+		for (long i = 0; i < items; ++i)
+		{
+			int value;
+			spsc.pop(value);
+			assert(value == i);
+			sum += value;
+		}
+		producer.join();
+		assert(sum == items * (items - 1) / 2);
+
+		ext::MpmcQueue<long> mpmc{64};
+		::std::atomic<long> total{0};
+		::std::vector<::std::thread> threads;
+		for (int t = 0; t < 4; ++t)
+		{
+			threads.emplace_back([&mpmc, t]
+			{
+				for (long i = 0; i < 50000; ++i)
+					mpmc.push(t * 50000 + i);
+			});
+			threads.emplace_back([&mpmc, &total]
+			{
+				for (long i = 0; i < 50000; ++i)
+				{
+					long value;
+					mpmc.pop(value);
+					total += value;
+				}
+			});
+		}
+		for (auto& thread : threads)
+			thread.join();
+		assert(total == 200000l * 199999 / 2);
+		assert(mpmc.empty());
+	}
+
+	//--<<//>>--// per cpu //--<<//>>--//
+	void test_per_cpu()
+	{
+		ext::ShardedCounter counter;
+		ext::PerCpuBuffer<int> buffer;
+		::std::vector<::std::thread> threads;
+		for (int t = 0; t < 8; ++t)
+		{
+			threads.emplace_back([&counter, &buffer]
+			{
+				for (int i = 0; i < 10000; ++i)
+				{
+					counter.increment();
+					buffer.emplace(i);
+				}
+			});
+		}
+		for (auto& thread : threads)
+			thread.join();
+		assert(counter.load() == 80000);
+
+		::std::size_t records = 0;
+		buffer.drain([&records](::std::vector<int>& items) { records += items.size(); });
+		assert(records == 80000);
+
+		ext::PerCpuFreelist<int> freelist{2};
+		int objects[3] = {};
+		assert(freelist.push(&objects[0]) && freelist.push(&objects[1]));
+		int* const popped = freelist.pop();
+		assert(popped == &objects[0] || popped == &objects[1]);
+		::std::size_t drained = 0;
+		freelist.drain([&drained](int*) { ++drained; });
+		assert(drained == 1 && !freelist.pop());
+	}
+
+	//--<<//>>--// perf events //--<<//>>--//
+	void test_perf_event()
+	{
+		// Software counters work without a PMU; without perf_event_open at all the group still measures time.
+		ext::PerfCounterGroup group{{ext::PerfCounter::TaskClock, ext::PerfCounter::PageFaults}};
+		assert(group.available() || group.error());
+
+		ext::PerfReading reading;
+		{
+			ext::PerfScope scope{group, reading};
+			::std::vector<char> touched(16 * 1024 * 1024, 1);
+			assert(touched.back() == 1);
+		}
+		assert(reading.elapsed.count() > 0);
+
+		::std::uint64_t faults;
+		if (group.available())
+			assert(reading.get(ext::PerfCounter::PageFaults, faults) && faults > 0);
+		else
+			assert(!reading.get(ext::PerfCounter::PageFaults, faults));
+
+		// Hardware counters that cannot be opened, e.g. in a VM without a PMU, do not take the software ones down
+		// with them, even when they come first and would lead the group.
+		ext::PerfCounterGroup mixed{{ext::PerfCounter::Cycles, ext::PerfCounter::StalledCyclesFrontend, ext::PerfCounter::PageFaults}};
+		assert(!group.available() || mixed.available());
+		{
+			ext::PerfScope scope{mixed, reading};
+			::std::vector<char> touched(16 * 1024 * 1024, 1);
+			assert(touched.back() == 1);
+		}
+		if (group.available())
+			assert(reading.get(ext::PerfCounter::PageFaults, faults) && faults > 0);
+	}
+
+	//--<<//>>--// async io //--<<//>>--//
+	void test_io_uring_partial_submit()
+	{
+		::std::unique_ptr<ext::IoUring> ring;
+		try
+		{
+			ring.reset(new ext::IoUring{8});
+		}
+		catch (::std::system_error const&)
+		{
+			return; // io_uring disabled
+		}
+
+		// Unknown opcodes are never reported as supported; AsyncIo relies on probing READ and WRITE.
+		assert(!ring->supports(0xff));
+		assert(!ring->supports(IORING_OP_READ) || ring->supports(IORING_OP_NOP));
+
+		// The kernel stops consuming at an entry it cannot prepare; the entries behind it must still go out.
+		for (::std::uint8_t const opcode : {::std::uint8_t{IORING_OP_NOP}, ::std::uint8_t{0xff}, ::std::uint8_t{IORING_OP_NOP}})
+		{
+			::io_uring_sqe* const sqe = ring->get_sqe();
+			assert(sqe);
+			ext::IoUring::prepare(*sqe, opcode, -1, nullptr, 0, 0);
+			sqe->user_data = opcode;
+		}
+		assert(ring->submit(3) == 3);
+		assert(!ring->pending());
+
+		int nops = 0;
+		int invalid = 0;
+		assert(ring->for_each_completion([&](::io_uring_cqe const& cqe)
+		{
+			if (cqe.user_data == IORING_OP_NOP && cqe.res == 0)
+				++nops;
+			else if (cqe.res < 0)
+				++invalid;
+		}) == 3);
+		assert(nops == 2 && invalid == 1);
+	}
+
+	void test_async_io(ext::AsyncBackend const backend)
+	{
+		::std::string const path = temp_path(u8"async");
+		ext::FilePtr file;
+		file->open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+
+		ext::AsyncIo io{4, backend};
+		ext::AsyncFile async{io, file};
+		char blocks[8][512];
+		for (int i = 0; i < 8; ++i)
+			::std::memset(blocks[i], 'a' + i, sizeof blocks[i]);
+
+		// More operations than the queue depth: enqueueing fails until completions are harvested.
+		int written = 0;
+		ext::AsyncCompletion completions[8];
+		for (int i = 0; i < 8; )
+		{
+			if (async.pwrite(blocks[i], sizeof blocks[i], i * 512, static_cast<::std::uint64_t>(i)))
+			{
+				++i;
+				continue;
+			}
+			assert(io.in_flight() == io.queue_depth());
+			unsigned int const n = io.wait(completions, 8);
+			for (unsigned int j = 0; j < n; ++j)
+				assert(completions[j].result == 512);
+			written += static_cast<int>(n);
+		}
+		while (io.in_flight())
+			written += static_cast<int>(io.wait(completions, 8));
+		assert(written == 8);
+
+		assert(async.fdatasync(100));
+		assert(io.wait(completions, 8) == 1 && completions[0].user_data == 100 && completions[0].result == 0);
+
+		char in[512];
+		assert(async.pread(in, sizeof in, 3 * 512, 3));
+		assert(io.wait(completions, 8) == 1 && completions[0].result == 512);
+		assert(!::std::memcmp(in, blocks[3], sizeof in));
+
+		::unlink(path.c_str());
+	}
+
+	//--<<//>>--// vectored file I/O //--<<//>>--//
+	void test_vectored_io()
+	{
+		::std::string const path = temp_path(u8"vectored");
+		ext::FilePtr file;
+		file->open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+		::unlink(path.c_str());
+
+		char a[3] = {'a', 'b', 'c'}, b[2] = {'d', 'e'};
+		assert(file->pwritev_all({{a, sizeof a}, {b, sizeof b}}, 0) == 5);
+
+		// More buffers than fit the on-stack copy.
+		char bytes[20];
+		for (int i = 0; i < 20; ++i)
+			bytes[i] = static_cast<char>('A' + i);
+		assert(file->pwritev_all({
+			{bytes + 0, 1}, {bytes + 1, 1}, {bytes + 2, 1}, {bytes + 3, 1}, {bytes + 4, 1},
+			{bytes + 5, 1}, {bytes + 6, 1}, {bytes + 7, 1}, {bytes + 8, 1}, {bytes + 9, 1},
+			{bytes + 10, 1}, {bytes + 11, 1}, {bytes + 12, 1}, {bytes + 13, 1}, {bytes + 14, 1},
+			{bytes + 15, 1}, {bytes + 16, 1}, {bytes + 17, 1}, {bytes + 18, 1}, {bytes + 19, 1}}, 5) == 20);
+
+		char in[25] = {};
+		char* const p = in;
+		assert(file->preadv_all({
+			{p + 0, 2}, {p + 2, 1}, {p + 3, 1}, {p + 4, 1}, {p + 5, 1}, {p + 6, 1}, {p + 7, 1}, {p + 8, 1},
+			{p + 9, 1}, {p + 10, 1}, {p + 11, 1}, {p + 12, 1}, {p + 13, 1}, {p + 14, 1}, {p + 15, 1},
+			{p + 16, 1}, {p + 17, 8}}, 0) == 25);
+		assert(!::std::memcmp(in, u8"abcde", 5) && !::std::memcmp(in + 5, bytes, 20));
+
+		// Reads stop at the end of the file.
+		char tail[8];
+		assert(file->preadv_all({{tail, 4}, {tail + 4, 4}}, 20) == 5);
+	}
+
+	//--<<//>>--// sparse copy //--<<//>>--//
+	void test_sparse_copy()
+	{
+		::std::string const in_path = temp_path(u8"copy-in");
+		::std::string const out_path = temp_path(u8"copy-out");
+		ext::FilePtr in;
+		in->open(in_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+		ext::FilePtr out;
+		out->open(out_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+
+		// Source: data, hole, data, trailing hole.
+		::std::size_t const block = 64 * 1024;
+		::std::vector<char> data(block, 'd');
+		in->truncate(4 * block);
+		in->pwritev_all({{data.data(), block}}, 0);
+		in->pwritev_all({{data.data(), block}}, 2 * block);
+
+		// The destination already holds data where the source has holes.
+		::std::vector<char> old(5 * block, 'o');
+		out->pwritev_all({{old.data(), old.size()}}, 0);
+
+		assert(in->copy_to(*out.operator->(), 0, 0, 4 * block) == 4 * block);
+
+		::std::vector<char> result(5 * block);
+		assert(out->preadv_all({{result.data(), result.size()}}, 0) == result.size());
+		for (::std::size_t i = 0; i < result.size(); ++i)
+			assert(result[i] == (i < block || (i >= 2 * block && i < 3 * block) ? 'd' : i >= 4 * block ? 'o' : '\0'));
+
+		// A fresh destination gets extended over the trailing hole.
+		out->truncate(0);
+		assert(in->copy_to(*out.operator->(), block, 0, 3 * block) == 3 * block);
+		struct ::stat st;
+		assert(::fstat(out.get(), &st) == 0 && st.st_size == static_cast<::off_t>(3 * block));
+
+		// copy_file_range() may refuse to copy across file systems and sendfile() takes over; out's position stays.
+		ext::FilePtr memory;
+		memory->memfd_create(u8"copy-memory");
+		memory->pwritev_all({{data.data(), block}}, 0);
+		out->lseek(7, SEEK_SET);
+		assert(memory->copy_to(*out.operator->(), 0, 100, block) == block);
+		assert(out->lseek(0, SEEK_CUR) == 7);
+		assert(out->preadv_all({{result.data(), block}}, 100) == block && ::std::all_of(result.begin(), result.begin() + block, [](char const c) { return c == 'd'; }));
+
+		::unlink(in_path.c_str());
+		::unlink(out_path.c_str());
+	}
+
+	//--<<//>>--// buffered file //--<<//>>--//
+	void test_buffered_file()
+	{
+		::std::string const path = temp_path(u8"buffered");
+		ext::FilePtr file;
+		file->open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+		::unlink(path.c_str());
+
+		{
+			ext::BufferedWriter writer{*file.operator->(), 4096};
+			for (int i = 0; i < 1000; ++i)
+				writer.write(u8"line " + ::std::to_string(i) + u8"\n");
+			::std::string const big(10000, 'x');
+			writer.write(big.data(), big.size()); // bypasses the buffer
+			writer.put('\n');
+			writer.flush();
+		}
+
+		file->lseek(0, SEEK_SET);
+		ext::BufferedReader reader{*file.operator->(), 4096};
+		::std::string line;
+		for (int i = 0; i < 1000; ++i)
+		{
+			assert(reader.read_line(line));
+			assert(line == u8"line " + ::std::to_string(i));
+		}
+		// Longer than the buffer, which has to grow.
+		assert(reader.read_line(line) && line == ::std::string(10000, 'x'));
+		assert(!reader.read_line(line) && reader.eof());
+	}
+
+	// A write that fails half way must leave exactly the missing bytes buffered.
+	void test_buffered_writer_failure()
+	{
+		::std::string const path = temp_path(u8"buffered-failure");
+		ext::FilePtr file;
+		file->open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+
+		::signal(SIGXFSZ, SIG_IGN);
+		::rlimit original;
+		::getrlimit(RLIMIT_FSIZE, &original);
+		::rlimit limited = original;
+		limited.rlim_cur = 6000;
+		::setrlimit(RLIMIT_FSIZE, &limited);
+
+		::std::string expected;
+		for (int i = 0; expected.size() < 20000; ++i)
+			expected += u8"record " + ::std::to_string(i) + u8"\n";
+
+		ext::BufferedWriter writer{*file.operator->(), 4096};
+		bool failed = false;
+		::std::size_t done = 0;
+		while (done < expected.size() && !failed)
+		{
+			::std::size_t const count = ::std::min<::std::size_t>(3000, expected.size() - done);
+			try
+			{
+				writer.write(expected.data() + done, count);
+			}
+			catch (::std::system_error const& e)
+			{
+				assert(e.code().value() == EFBIG);
+				failed = true;
+			}
+			done += count;
+		}
+		assert(failed);
+
+		::setrlimit(RLIMIT_FSIZE, &original);
+		writer.write(expected.data() + done, expected.size() - done);
+		writer.flush();
+
+		::std::string actual(expected.size() + 1, '\0');
+		assert(file->preadv_all({{&actual[0], actual.size()}}, 0) == expected.size());
+		actual.resize(expected.size());
+		assert(actual == expected);
+
+		::unlink(path.c_str());
+	}
+
+	//--<<//>>--// error_code overloads //--<<//>>--//
+	void test_file_error_codes()
+	{
+		int fds[2];
+		assert(::pipe2(fds, O_CLOEXEC | O_NONBLOCK) == 0);
+		ext::FilePtr read_end{fds[0]};
+		ext::FilePtr write_end{fds[1]};
+
+		// An empty non-blocking pipe reports EAGAIN without throwing.
+		char buffer[16];
+		::iovec iov{buffer, sizeof buffer};
+		::std::error_code ec;
+		assert(read_end->readv(&iov, 1, ec) == 0 && ec.value() == EAGAIN);
+
+		char const message[] = u8"hello";
+		::iovec out{const_cast<char*>(message), 5};
+		assert(write_end->writev(&out, 1, ec) == 5 && !ec);
+		assert(read_end->readv(&iov, 1, ec) == 5 && !ec && !::std::memcmp(buffer, message, 5));
+
+		// Positional transfers on a pipe fail with ESPIPE.
+		assert(read_end->preadv(&iov, 1, 0, ec) == 0 && ec.value() == ESPIPE);
+		assert(write_end->pwritev(&out, 1, 0, ec) == 0 && ec.value() == ESPIPE);
+		assert(read_end->preadv2(&iov, 1, -1, RWF_NOWAIT, ec) == 0 && (ec.value() == EAGAIN || ec.value() == EOPNOTSUPP));
+		read_end->fallocate(0, 0, 4096, ec);
+		assert(ec);
+		read_end->fadvise(0, 0, POSIX_FADV_SEQUENTIAL, ec);
+		assert(ec.value() == ESPIPE);
+
+		::std::string const path = temp_path(u8"error-codes");
+		ext::FilePtr file;
+		file->open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+		::unlink(path.c_str());
+		assert(file->pwritev2(&out, 1, 0, 0, ec) == 5 && !ec);
+		assert(file->preadv(&iov, 1, 0, ec) == 5 && !ec);
+		file->fadvise(0, 0, POSIX_FADV_SEQUENTIAL, ec);
+		assert(!ec);
+		file->fallocate(0, 0, 4096, ec);
+		struct ::stat st;
+		assert(!ec && ::fstat(file.get(), &st) == 0 && st.st_size == 4096);
+
+		// Kernel side copies.
+		::off_t in_offset = 0;
+		assert(file->sendfile(*write_end.operator->(), &in_offset, 5, ec) == 5 && !ec && in_offset == 5);
+		::loff_t out_offset = 5;
+		assert(read_end->splice(nullptr, *file.operator->(), &out_offset, 5, 0, ec) == 5 && !ec && out_offset == 10);
+		assert(read_end->splice(nullptr, *file.operator->(), &out_offset, 5, SPLICE_F_NONBLOCK, ec) == 0 && ec.value() == EAGAIN);
+
+		::std::string const copy_path = temp_path(u8"error-codes-copy");
+		ext::FilePtr copy;
+		copy->open(copy_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+		::unlink(copy_path.c_str());
+		::off_t from = 0;
+		::off_t to = 0;
+		::std::size_t const copied = file->copy_file_range(&from, *copy.operator->(), &to, 10, 0, ec);
+		assert(ec ? ec.value() == EXDEV || ec.value() == EINVAL || ec.value() == ENOSYS : copied == 10);
+	}
+
+	//--<<//>>--// file space and cache hints //--<<//>>--//
+	void test_file_space()
+	{
+		::std::string const path = temp_path(u8"space");
+		ext::FilePtr file;
+		file->open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+		auto const size = [&file]
+		{
+			struct ::stat st;
+			assert(::fstat(file.get(), &st) == 0);
+			return st.st_size;
+		};
+
+		// Preallocating with KEEP_SIZE reserves blocks without changing the size.
+		file->preallocate(0, 1 << 20, true);
+		assert(size() == 0);
+		file->preallocate(0, 1 << 20);
+		assert(size() == 1 << 20);
+
+		::std::vector<char> data(1 << 20, 'x');
+		file->pwrite_all(data.data(), data.size(), 0);
+
+		// A punched hole reads back as zeros and keeps the size.
+		file->punch_hole(4096, 8192);
+		assert(size() == 1 << 20);
+		char page[4096];
+		file->pread_exact(page, sizeof page, 8192);
+		assert(::std::all_of(page, page + sizeof page, [](char const c) { return c == '\0'; }));
+		file->pread_exact(page, sizeof page, 0);
+		assert(::std::all_of(page, page + sizeof page, [](char const c) { return c == 'x'; }));
+		assert(file->seek_hole(0) == 4096);
+		assert(file->seek_data(4096) == 12288);
+
+		// zero_range past the end grows the file unless asked not to.
+		file->zero_range(1 << 20, 4096, true);
+		assert(size() == 1 << 20);
+		file->zero_range(1 << 20, 4096);
+		assert(size() == (1 << 20) + 4096);
+
+		// Hints and writeback control must be accepted on a regular file.
+		file->fadvise(0, 0, POSIX_FADV_SEQUENTIAL);
+		file->fadvise(0, 0, POSIX_FADV_WILLNEED);
+		file->readahead(0, 1 << 20);
+		file->sync_file_range(0, 0, SYNC_FILE_RANGE_WRITE);
+		file->sync_file_range(0, 0, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+		file->fdatasync();
+		file->fadvise(0, 0, POSIX_FADV_DONTNEED);
+
+		::unlink(path.c_str());
+	}
+
+	//--<<//>>--// direct I/O //--<<//>>--//
+	void test_direct_io()
+	{
+		ext::AlignedBuffer buffer{5000, 4096};
+		assert(buffer.size() == 8192 && buffer.alignment() == 4096);
+		assert(reinterpret_cast<::std::uintptr_t>(buffer.data()) % 4096 == 0);
+		assert(buffer.iov().iov_base == buffer.data() && buffer.iov().iov_len == 8192);
+
+		ext::DirectIoAlignment const alignment{512, 4096};
+		assert(alignment.fits(buffer.data(), 4096, 8192));
+		assert(!alignment.fits(buffer.data() + 256, 4096, 0));
+		assert(!alignment.fits(buffer.data(), 1000, 0));
+		assert(!alignment.fits(buffer.data(), 4096, 100));
+
+		::std::string const path = temp_path(u8"direct");
+		ext::FilePtr file;
+		file->open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+
+		// Misaligned transfers are refused before they reach the kernel.
+		try
+		{
+			file->pwrite_direct(buffer.data() + 1, 4096, 0, alignment);
+			assert(false);
+		}
+		catch (::std::system_error const& e)
+		{
+			assert(e.code().value() == EINVAL);
+		}
+
+		// Not every file system supports O_DIRECT (tmpfs only does on recent kernels).
+		ext::DirectIoAlignment actual;
+		try
+		{
+			actual = file->direct_io_alignment();
+			file->set_direct(true);
+		}
+		catch (::std::system_error const& e)
+		{
+			assert(e.code().value() == EINVAL);
+			::unlink(path.c_str());
+			return;
+		}
+		assert(file->direct());
+		assert(actual.memory && actual.offset && actual.memory <= 4096 && actual.offset <= 4096);
+
+		::std::memset(buffer.data(), 'q', buffer.size());
+		assert(file->pwrite_direct(buffer.data(), 4096, 4096, actual) == 4096);
+		ext::AlignedBuffer in{4096};
+		assert(file->pread_direct(in.data(), 4096, 4096, actual) == 4096);
+		assert(!::std::memcmp(in.data(), buffer.data(), 4096));
+
+		file->set_direct(false);
+		assert(!file->direct());
+		::unlink(path.c_str());
+	}
+
+	//--<<//>>--// chunked reader //--<<//>>--//
+	void test_chunked_reader()
+	{
+		::std::string contents;
+		for (int i = 0; contents.size() < 300000; ++i)
+			contents += ::std::string(static_cast<::std::size_t>(i % 97), 'r') + ::std::to_string(i) + u8"\n";
+		contents += u8"unterminated";
+
+		::std::string const path = temp_path(u8"chunked");
+		ext::FilePtr file;
+		file->open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+		::unlink(path.c_str());
+		file->pwrite_all(contents.data(), contents.size(), 0);
+		ext::File& f = *file.operator->();
+
+		ext::ThreadPool pool{4};
+		ext::ChunkedReadOptions options;
+		options.chunk_size = 8192;
+		options.delimiter = '\n';
+		options.ordered = true;
+
+		// In order: the chunks concatenate to the file and each ends on a record boundary.
+		::std::string joined;
+		::std::size_t next = 0;
+		ext::read_chunks(pool, f, options, [&](ext::FileChunk const& chunk)
+		{
+			assert(chunk.index == next++);
+			assert(chunk.offset == static_cast<::off_t>(joined.size()));
+			joined.append(chunk.data, chunk.size);
+			assert(joined.back() == '\n' || joined.size() == contents.size());
+		});
+		assert(joined == contents);
+
+		// Unordered, without a delimiter: every byte is delivered exactly once.
+		options.ordered = false;
+		options.delimiter = -1;
+		::std::atomic<::std::size_t> bytes{0};
+		::std::atomic<::std::size_t> checksum{0};
+		ext::read_chunks(pool, f, options, [&](ext::FileChunk const& chunk)
+		{
+			assert(chunk.offset % 8192 == 0);
+			::std::size_t sum = 0;
+			for (::std::size_t i = 0; i < chunk.size; ++i)
+				sum += static_cast<unsigned char>(chunk.data[i]) * (static_cast<::std::size_t>(chunk.offset) + i);
+			bytes += chunk.size;
+			checksum += sum;
+		});
+		::std::size_t expected = 0;
+		for (::std::size_t i = 0; i < contents.size(); ++i)
+			expected += static_cast<unsigned char>(contents[i]) * i;
+		assert(bytes == contents.size() && checksum == expected);
+
+		// The first exception of a callback is rethrown.
+		try
+		{
+			ext::read_chunks(pool, f, options, [](ext::FileChunk const& chunk)
+			{
+				if (chunk.index == 3)
+					throw ::std::runtime_error{u8"chunk"};
+			});
+			assert(false);
+		}
+		catch (::std::runtime_error const&)
+		{
+		}
+	}
+
+	//--<<//>>--// write-ahead log //--<<//>>--//
+	void test_wal()
+	{
+		::std::string const directory = temp_path(u8"wal");
+		ext::WalOptions options;
+		options.segment_size = 64 * 1024;
+
+		auto const record = [](ext::Wal::Lsn const lsn)
+		{
+			return u8"record " + ::std::to_string(lsn) + ::std::string(static_cast<::std::size_t>(lsn % 1000), '.');
+		};
+
+		auto const list = [&directory]
+		{
+			::std::vector<::std::string> segments;
+			::std::unique_ptr<DIR, int (*)(DIR*)> const dir{::opendir(directory.c_str()), ::closedir};
+			while (::dirent const* const entry = ::readdir(dir.get()))
+				if (entry->d_name[0] != '.')
+					segments.push_back(directory + u8"/" + entry->d_name);
+			::std::sort(segments.begin(), segments.end());
+			return segments;
+		};
+		{
+			ext::Wal wal{directory, options};
+			assert(wal.next_lsn() == 0);
+
+			// Concurrent commits, enough to span several segments.
+			::std::vector<::std::thread> threads;
+			::std::mutex mutex;
+			for (int t = 0; t < 4; ++t)
+				threads.emplace_back([&]
+				{
+					for (int i = 0; i < 100; ++i)
+					{
+						::std::lock_guard<::std::mutex> lock{mutex}; // keeps payloads matching their LSNs
+						ext::Wal::Lsn const lsn = wal.next_lsn();
+						::std::string const payload = record(lsn);
+						assert(wal.append(payload.data(), payload.size()) == lsn);
+					}
+				});
+			for (auto& thread : threads)
+				thread.join();
+			wal.sync(wal.next_lsn() - 1);
+			assert(wal.durable_lsn() == 400);
+
+			// Records of 4 GiB or more are refused before the payload is touched.
+			try
+			{
+				char byte = 0;
+				wal.append(&byte, ::std::size_t{UINT32_MAX} + 1);
+				assert(false);
+			}
+			catch (::std::length_error const&)
+			{
+			}
+
+			// Segments are written out in full, so appends do not change their size.
+			ext::FilePtr segment;
+			segment->open((directory + u8"/0000000000000000.wal").c_str(), O_RDONLY | O_CLOEXEC, 0);
+			assert(segment->size() == static_cast<::off_t>(options.segment_size));
+		}
+
+		// Simulate a crash that tore the record being written: garbage after the last complete record.
+		{
+			ext::Wal wal{directory, options};
+			assert(wal.next_lsn() == 400);
+			::std::string const payload = record(400);
+			wal.commit(payload.data(), payload.size());
+		}
+		::std::vector<::std::string> const segments = list();
+		assert(segments.size() > 1);
+		{
+			ext::FilePtr segment;
+			segment->open(segments.back().c_str(), O_RDWR | O_CLOEXEC, 0);
+			::std::vector<char> contents(static_cast<::std::size_t>(segment->size()));
+			segment->pread_exact(contents.data(), contents.size(), 0);
+			// The end of the valid records is followed by zeros; tear the last record in half.
+			auto const end = static_cast<::std::size_t>(::std::find_if(contents.rbegin(), contents.rend(), [](char const c) { return c; }).base() - contents.begin());
+			::std::string const payload = record(400);
+			::std::size_t const start = end - 16 - payload.size();
+			char const garbage[] = u8"torn write";
+			segment->pwrite_all(garbage, sizeof garbage, static_cast<::off_t>(start + 16 + payload.size() / 2));
+		}
+
+		// Recovery stops at the torn record and the log continues from there.
+		{
+			ext::Wal wal{directory, options};
+			assert(wal.next_lsn() == 400 && wal.durable_lsn() == 400);
+
+			ext::Wal::Lsn expected = 10;
+			wal.replay(10, [&](ext::Wal::Lsn const lsn, char const* const data, ::std::size_t const size)
+			{
+				assert(lsn == expected++);
+				assert(::std::string(data, size) == record(lsn));
+			});
+			assert(expected == 400);
+
+			::std::string const payload = record(400);
+			assert(wal.commit(payload.data(), payload.size()) == 400);
+			wal.remove_before(300);
+		}
+		{
+			ext::Wal wal{directory, options};
+			assert(wal.next_lsn() == 401);
+			ext::Wal::Lsn count = 0;
+			wal.replay(300, [&](ext::Wal::Lsn const lsn, char const* const data, ::std::size_t const size)
+			{
+				assert(lsn == 300 + count++ && ::std::string(data, size) == record(lsn));
+			});
+			assert(count == 101);
+		}
+
+		for (auto const& segment : list())
+			::unlink(segment.c_str());
+		::rmdir(directory.c_str());
+	}
+
+	//--<<//>>--// file cache //--<<//>>--//
+	void test_file_cache()
+	{
+		::std::string paths[3];
+		for (int i = 0; i < 3; ++i)
+		{
+			paths[i] = temp_path((u8"cache-" + ::std::to_string(i)).c_str());
+			ext::FilePtr file;
+			file->open(paths[i].c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+			file->pwrite_all(paths[i].data(), paths[i].size(), 0);
+		}
+
+		ext::FileCache cache{2, O_RDONLY | O_CLOEXEC, 0, ::std::chrono::milliseconds{0}};
+		assert(cache.capacity() == 2);
+
+		auto const a = cache.open(paths[0]);
+		assert(cache.open(paths[0]) == a);
+		auto const b = cache.open(paths[1]);
+		ext::FileCacheStats stats = cache.stats();
+		assert(stats.hits == 1 && stats.misses == 2 && stats.size == 2);
+
+		// paths[1] is the most recently used, so paths[0] goes. Its handle stays usable.
+		cache.open(paths[2]);
+		stats = cache.stats();
+		assert(stats.evictions == 1 && stats.size == 2);
+		char buffer[64];
+		assert(a->pread(buffer, sizeof buffer, 0) == paths[0].size());
+		assert(cache.open(paths[0]) != a);
+
+		// Replacing the file at a path is noticed on the next use.
+		::std::string const replacement = temp_path(u8"cache-new");
+		{
+			ext::FilePtr file;
+			file->open(replacement.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+			file->pwrite_all(u8"new", 3, 0);
+		}
+		assert(::rename(replacement.c_str(), paths[2].c_str()) == 0);
+		auto const c = cache.open(paths[2]);
+		assert(c->pread(buffer, sizeof buffer, 0) == 3);
+		assert(cache.stats().invalidations == 1);
+
+		cache.invalidate(paths[2]);
+		assert(cache.stats().size == 1);
+		cache.clear();
+		assert(cache.stats().size == 0);
+
+		// Files the cache creates get its mode.
+		ext::FileCache creating{1, O_RDWR | O_CREAT | O_CLOEXEC, 0600};
+		::std::string const created = temp_path(u8"cache-created");
+		::unlink(created.c_str());
+		creating.open(created);
+		struct ::stat st;
+		assert(::stat(created.c_str(), &st) == 0 && (st.st_mode & 0177) == 0);
+		::unlink(created.c_str());
+
+		for (auto const& path : paths)
+			::unlink(path.c_str());
+	}
+
+	//--<<//>>--// memory map advice and prefaulting //--<<//>>--//
+	::std::size_t resident_pages(void* const address, ::std::size_t const length)
+	{
+		::std::size_t const page = static_cast<::std::size_t>(::sysconf(_SC_PAGESIZE));
+		auto const first = reinterpret_cast<::std::uintptr_t>(address) & ~(page - 1);
+		::std::size_t const span = reinterpret_cast<::std::uintptr_t>(address) + length - first;
+		::std::vector<unsigned char> pages((span + page - 1) / page);
+		assert(::mincore(reinterpret_cast<void*>(first), span, pages.data()) == 0);
+		return static_cast<::std::size_t>(::std::count_if(pages.begin(), pages.end(), [](unsigned char const p) { return p & 1; }));
+	}
+
+	void test_memory_map_advice()
+	{
+		::std::size_t const page = static_cast<::std::size_t>(::sysconf(_SC_PAGESIZE));
+		::std::size_t const length = 1024 * page;
+
+		ext::MemoryMapPtr map;
+		map->map_anonymous(length);
+		assert(map->size() == length && resident_pages(map->data(), length) == 0);
+
+		map->populate(0, 16 * page, true);
+		assert(resident_pages(map->data(), length) >= 16);
+		map->madvise(MADV_DONTNEED);
+		assert(resident_pages(map->data(), length) == 0);
+
+		// Prefaulting from the pool touches every page exactly once.
+		ext::ThreadPool pool{4};
+		ext::prefault(pool, *map.operator->(), true);
+		assert(resident_pages(map->data(), length) == 1024);
+		assert(static_cast<char*>(map->data())[length - 1] == 0);
+
+		// Locking can be refused by RLIMIT_MEMLOCK; only a granted lock has to hold.
+		try
+		{
+			map->lock(0, 4 * page, true);
+			map->unlock(0, 4 * page);
+		}
+		catch (::std::system_error const& e)
+		{
+			assert(e.code().value() == EPERM || e.code().value() == ENOMEM || e.code().value() == EAGAIN);
+		}
+
+		// Transparent huge pages are a hint; Explicit fails cleanly without reserved huge pages.
+		ext::MemoryMapPtr huge;
+		huge->map_anonymous(4 * 1024 * 1024, PROT_READ | PROT_WRITE, ext::HugePages::Preferred, true);
+		assert(huge->size() == 4 * 1024 * 1024 && resident_pages(huge->data(), huge->size()) == huge->size() / page);
+		assert(ext::MemoryMap::huge_page_flags(2 * 1024 * 1024) == (MAP_HUGETLB | 21 << MAP_HUGE_SHIFT));
+	}
+
+	//--<<//>>--// growable memory map //--<<//>>--//
+	void test_growable_memory_map()
+	{
+		// Anonymous growth keeps the address stable.
+		{
+			ext::GrowableMemoryMap map{64 * 1024 * 1024};
+			char* const data = map.data();
+			for (int i = 0; i < 100000; ++i)
+				*map.append(1) = static_cast<char>(i);
+			assert(map.data() == data && map.size() == 100000 && map.capacity() >= 100000);
+			assert(data[99999] == static_cast<char>(99999));
+		}
+
+		::std::string const path = temp_path(u8"growable");
+		ext::FilePtr file;
+		file->open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+		::std::string expected;
+		{
+			ext::GrowableMemoryMap map{file, 64 * 1024 * 1024};
+			auto const append = [&](::std::size_t const count, char const c)
+			{
+				::std::string const chunk(count, c);
+				map.append(chunk.data(), chunk.size());
+				expected += chunk;
+			};
+
+			append(100001, 'a');
+			assert(file->size() >= 100001);
+			map.finish();
+			assert(file->size() == 100001 && map.capacity() == 100001);
+
+			// Appending after finish() grows the file again, both inside the last page and past it.
+			append(10, 'b');
+			append(300000, 'c');
+			map.sync();
+			map.finish();
+			assert(file->size() == static_cast<::off_t>(expected.size()));
+			assert(!::std::memcmp(map.data(), expected.data(), expected.size()));
+
+			// And again after a second finish().
+			append(5, 'd');
+			map.finish();
+		}
+
+		// Reopening maps the existing contents.
+		ext::GrowableMemoryMap map{file, 64 * 1024 * 1024};
+		assert(map.size() == expected.size() && !::std::memcmp(map.data(), expected.data(), expected.size()));
+		::std::string actual(expected.size(), '\0');
+		file->pread_exact(&actual[0], actual.size(), 0);
+		assert(actual == expected);
+
+		::unlink(path.c_str());
+	}
+
+	//--<<//>>--// span and column file //--<<//>>--//
+	void test_span()
+	{
+		int values[] = {1, 2, 3, 4, 5};
+		ext::Span<int> span{values};
+		assert(span.size() == 5 && span.size_bytes() == sizeof values && span.front() == 1 && span.back() == 5);
+		assert(span.first(2).size() == 2 && span.last(2)[0] == 4 && span.subspan(1, 3)[2] == 4 && span.subspan(5).empty());
+		ext::Span<int const> const view = span;
+		assert(::std::accumulate(view.begin(), view.end(), 0) == 15);
+
+		auto const throws_out_of_range = [](auto const& function)
+		{
+			try { function(); } catch (::std::out_of_range const&) { return true; }
+			return false;
+		};
+		assert(throws_out_of_range([&] { span.at(5); }));
+		assert(throws_out_of_range([&] { span.last(6); }));
+		assert(throws_out_of_range([&] { span.subspan(3, 3); }));
+
+		alignas(8) char bytes[16] = {};
+		assert(ext::span_cast<::std::uint32_t>(bytes, sizeof bytes).size() == 4);
+		try
+		{
+			ext::span_cast<::std::uint32_t>(bytes + 1, 8);
+			assert(false);
+		}
+		catch (::std::invalid_argument const&)
+		{
+		}
+	}
+
+	void test_column_file()
+	{
+		::std::string const path = temp_path(u8"columns");
+		::std::vector<::std::int64_t> ids(10000);
+		::std::vector<ext::Vector3f> positions(10000);
+		for (::std::size_t i = 0; i < ids.size(); ++i)
+		{
+			ids[i] = static_cast<::std::int64_t>(i * i);
+			positions[i] = {static_cast<float>(i), static_cast<float>(i) * 2, -static_cast<float>(i)};
+		}
+
+		{
+			ext::FilePtr file;
+			file->open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+			ext::ColumnFileWriter writer{*file.operator->()};
+			writer.add(u8"id", ids);
+			writer.add(u8"position", positions);
+			writer.add_soa(u8"velocity", positions);
+			try
+			{
+				writer.add(u8"id", ids);
+				assert(false);
+			}
+			catch (::std::invalid_argument const&)
+			{
+			}
+
+			// Unfinished files are rejected.
+			try
+			{
+				ext::ColumnFile unfinished{path.c_str()};
+				assert(false);
+			}
+			catch (::std::runtime_error const&)
+			{
+			}
+			writer.finish();
+		}
+
+		ext::ColumnFile columns{path.c_str()};
+		assert(columns.column_count() == 5 && columns.has_column(u8"velocity.y") && !columns.has_column(u8"velocity"));
+
+		auto const id = columns.column<::std::int64_t>(u8"id");
+		assert(id.size() == ids.size() && ::std::equal(id.begin(), id.end(), ids.begin()));
+		assert(reinterpret_cast<::std::uintptr_t>(id.data()) % 4096 == 0);
+
+		auto const position = columns.column<ext::Vector3f>(u8"position");
+		assert(position.size() == positions.size() && position[1234] == positions[1234]);
+
+		auto const velocity = columns.soa<ext::Vector3f>(u8"velocity");
+		assert(velocity.size() == positions.size() && velocity[9999] == positions[9999]);
+		assert(velocity.columns[2][7] == -7.0f);
+
+		try
+		{
+			columns.column<double>(u8"id");
+			assert(false);
+		}
+		catch (::std::invalid_argument const&)
+		{
+		}
+
+		::unlink(path.c_str());
+	}
+
+	//--<<//>>--// mapped writeback //--<<//>>--//
+	void test_mapped_writeback()
+	{
+		::std::string const path = temp_path(u8"writeback");
+		ext::FilePtr file;
+		file->open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+		::std::size_t const size = 1024 * 1024;
+		file->truncate(static_cast<::off_t>(size));
+
+		ext::MemoryMapPtr map;
+		map->map(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file.get(), 0);
+		auto* const data = static_cast<char*>(map->data());
+
+		ext::WritebackOptions options;
+		options.interval = ::std::chrono::milliseconds{1};
+		options.dirty_limit = 64 * 1024;
+		{
+			ext::MappedWriteback writeback{*map.operator->(), file, 0, options};
+
+			// Scattered writes from several threads, with checkpoints in between.
+			::std::vector<::std::thread> threads;
+			for (int t = 0; t < 4; ++t)
+				threads.emplace_back([&, t]
+				{
+					for (::std::size_t offset = static_cast<::std::size_t>(t) * 4096; offset < size; offset += 4 * 4096)
+					{
+						::std::memset(data + offset + 100, 'a' + t, 200);
+						writeback.mark_dirty(offset + 100, 200);
+						if (offset % (64 * 4096) == 0)
+							writeback.wait(writeback.checkpoint());
+					}
+				});
+			for (auto& thread : threads)
+				thread.join();
+			writeback.sync();
+			assert(writeback.dirty_bytes() == 0);
+		}
+
+		::std::vector<char> contents(size);
+		file->pread_exact(contents.data(), size, 0);
+		for (::std::size_t page = 0; page < size / 4096; ++page)
+			assert(contents[page * 4096 + 150] == static_cast<char>('a' + page % 4) && contents[page * 4096 + 50] == 0);
+
+		// Without the file, checkpoints fall back to msync().
+		{
+			ext::MappedWriteback writeback{*map.operator->()};
+			::std::memset(data, 'z', 10);
+			writeback.mark_dirty(0, 10);
+			writeback.sync();
+		}
+		char head[10];
+		file->pread_exact(head, sizeof head, 0);
+		assert(::std::all_of(head, head + sizeof head, [](char const c) { return c == 'z'; }));
+
+		::unlink(path.c_str());
+	}
+
+	//--<<//>>--// mirrored ring buffer //--<<//>>--//
+	void test_ring_buffer()
+	{
+		ext::MirroredRingBuffer ring{1};
+		::std::size_t const capacity = ring.capacity();
+		assert(capacity == static_cast<::std::size_t>(::sysconf(_SC_PAGESIZE)));
+
+		// Both views alias the same memory, so data that wraps stays contiguous.
+		::std::string const first(capacity - 10, 'a');
+		assert(ring.write(first.data(), first.size()) == first.size());
+		char sink[4096 * 16];
+		assert(ring.read(sink, capacity - 20) == capacity - 20);
+		::std::string const wrapping = u8"0123456789abcdefghij";
+		assert(ring.write(wrapping.data(), wrapping.size()) == wrapping.size());
+		assert(ring.readable() == 30 && ring.writable() == capacity - 30);
+		assert(::std::string(ring.read_pointer() + 10, 20) == wrapping);
+		ring.consume(30);
+
+		// Cannot overfill.
+		::std::string const full(capacity + 100, 'f');
+		assert(ring.write(full.data(), full.size()) == capacity && ring.writable() == 0);
+		ring.consume(capacity);
+
+		// A producer and a consumer thread stream bytes through a pipe pair.
+		int fds[2];
+		assert(::pipe2(fds, O_CLOEXEC) == 0);
+		ext::FilePtr read_end{fds[0]};
+		ext::FilePtr write_end{fds[1]};
+		::std::size_t const total = 1024 * 1024;
+		::std::thread producer{[&]
+		{
+			::std::vector<char> data(total);
+			for (::std::size_t i = 0; i < total; ++i)
+				data[i] = static_cast<char>(i % 251);
+			write_end->write_all(data.data(), data.size());
+			write_end.reset();
+		}};
+		::std::size_t received = 0;
+		::std::thread consumer{[&]
+		{
+			for (;;)
+			{
+				while (ring.readable())
+				{
+					char const* const data = ring.read_pointer();
+					::std::size_t const n = ring.readable();
+					for (::std::size_t i = 0; i < n; ++i)
+						assert(data[i] == static_cast<char>((received + i) % 251));
+					received += n;
+					ring.consume(n);
+				}
+				if (received == total)
+					return;
+				::std::this_thread::yield();
+			}
+		}};
+		for (;;)
+		{
+			if (!ring.writable())
+				::std::this_thread::yield();
+			else if (!ring.read_from(*read_end.operator->()))
+				break;
+		}
+		producer.join();
+		consumer.join();
+		assert(received == total);
+	}
+
+	//--<<//>>--// shared memory //--<<//>>--//
+	void test_shared_memory()
+	{
+		ext::SharedMemory shm{64 * 1024};
+		assert(shm.size() == 64 * 1024 && shm.file().seals() & F_SEAL_SHRINK);
+
+		// A second mapping of the descriptor, as another process would create it, sees the same bytes.
+		ext::MemoryMapPtr peer;
+		peer->map(nullptr, shm.size(), PROT_READ, MAP_SHARED, shm.fd(), 0);
+		::std::memcpy(shm.data() + 100, u8"shared", 6);
+		assert(!::std::memcmp(static_cast<char*>(peer->data()) + 100, u8"shared", 6));
+
+		// The segment cannot shrink under the peer, only grow.
+		try
+		{
+			shm.file().truncate(4096);
+			assert(false);
+		}
+		catch (::std::system_error const& e)
+		{
+			assert(e.code().value() == EPERM);
+		}
+
+		assert(shm.allocate(100) == 0);
+		assert(shm.allocate(10, 4096) == 4096);
+		assert(shm.allocate(1) == 4160);
+		try
+		{
+			shm.allocate(64 * 1024);
+			assert(false);
+		}
+		catch (::std::system_error const& e)
+		{
+			assert(e.code().value() == ENOMEM);
+		}
+
+		// Growing keeps the contents and the offsets handed out.
+		shm.resize(256 * 1024);
+		assert(shm.size() == 256 * 1024 && shm.file().size() == 256 * 1024);
+		assert(!::std::memcmp(shm.data() + 100, u8"shared", 6));
+		assert(shm.allocate(64 * 1024) == 4224);
+		shm.data()[shm.size() - 1] = 'x';
+
+		shm.seal(F_SEAL_GROW | F_SEAL_SEAL);
+		try
+		{
+			shm.resize(512 * 1024);
+			assert(false);
+		}
+		catch (::std::system_error const& e)
+		{
+			assert(e.code().value() == EPERM);
+		}
+
+		shm.reset();
+		assert(shm.allocate(1) == 0);
+	}
+
+	//--<<//>>--// arena and pool //--<<//>>--//
+	void test_arena()
+	{
+		ext::Arena arena{64 * 1024 * 1024};
+		assert(arena.reserved() >= 64 * 1024 * 1024 && arena.committed() == 0);
+
+		auto* const numbers = arena.allocate_array<::std::uint64_t>(1000);
+		assert(reinterpret_cast<::std::uintptr_t>(numbers) % alignof(::std::uint64_t) == 0 && arena.owns(numbers));
+		numbers[999] = 42;
+		void* const aligned = arena.allocate(1, 4096);
+		assert(reinterpret_cast<::std::uintptr_t>(aligned) % 4096 == 0);
+		assert(arena.committed() >= arena.used() && arena.committed() < arena.reserved());
+
+		// Scoped release.
+		ext::Arena::Marker const marker = arena.mark();
+		void* const scratch = arena.allocate(100000);
+		arena.rewind(marker);
+		assert(arena.allocate(100000) == scratch);
+
+		// Memory is committed lazily; trimming hands the pages back but keeps them accessible.
+		::std::memset(arena.allocate(16 * 1024 * 1024), 1, 16 * 1024 * 1024);
+		::std::size_t const committed = arena.committed();
+		::std::size_t const resident = resident_pages(numbers, committed);
+		arena.reset();
+		assert(arena.used() == 0 && arena.committed() == committed);
+		arena.trim();
+		assert(arena.committed() == committed && resident_pages(numbers, committed) < resident);
+		assert(numbers[999] == 0);
+
+		try
+		{
+			arena.allocate(arena.reserved() + 1);
+			assert(false);
+		}
+		catch (::std::system_error const& e)
+		{
+			assert(e.code().value() == ENOMEM);
+		}
+
+		// Standard containers on top of the arena.
+		arena.reset();
+		ext::ArenaResource resource{arena};
+		::std::vector<int, ext::pmr::polymorphic_allocator<int>> vector{ext::pmr::polymorphic_allocator<int>{&resource}};
+		for (int i = 0; i < 10000; ++i)
+			vector.push_back(i);
+		assert(arena.owns(vector.data()) && ::std::accumulate(vector.begin(), vector.end(), 0ll) == 49995000ll);
+	}
+
+	void test_pool()
+	{
+		ext::Pool pool{24, 1024 * 1024};
+		assert(pool.block_size() >= 24 && pool.block_size() % pool.alignment() == 0);
+
+		void* const a = pool.allocate();
+		void* const b = pool.allocate();
+		assert(a != b && pool.owns(a) && pool.live() == 2);
+		pool.deallocate(a);
+		assert(pool.allocate() == a); // freed blocks are reused first
+		pool.deallocate(a);
+		pool.deallocate(b);
+		assert(pool.live() == 0);
+
+		// Node based containers take their nodes from the pool, everything else from upstream.
+		ext::Pool nodes{64, 16 * 1024 * 1024};
+		ext::PoolResource resource{nodes};
+		{
+			using Allocator = ext::pmr::polymorphic_allocator<int>;
+			::std::list<int, Allocator> list{Allocator{&resource}};
+			for (int i = 0; i < 1000; ++i)
+				list.push_back(i);
+			assert(nodes.live() == 1000);
+			::std::vector<int, Allocator> vector(1000, 0, Allocator{&resource});
+			assert(!nodes.owns(vector.data()) && nodes.live() == 1000);
+		}
+		assert(nodes.live() == 0);
+		void* const first = nodes.allocate();
+		nodes.deallocate(first);
+		::std::size_t const resident = resident_pages(first, nodes.committed());
+		nodes.trim();
+		assert(resident_pages(first, nodes.committed()) < resident);
+
+		// The reservation is rounded up to whole commit granules; beyond it allocation fails cleanly.
+		ext::Pool tiny{4096, 8192};
+		::std::size_t const blocks = tiny.reserved() / tiny.block_size();
+		for (::std::size_t i = 0; i < blocks; ++i)
+			tiny.allocate();
+		try
+		{
+			tiny.allocate();
+			assert(false);
+		}
+		catch (::std::system_error const& e)
+		{
+			assert(e.code().value() == ENOMEM && tiny.live() == blocks);
+		}
+	}
+
+	//--<<//>>--// hash index //--<<//>>--//
+	void test_hash_index()
+	{
+		::std::string const path = temp_path(u8"hash-index");
+		using Index = ext::HashIndex<::std::uint64_t, ::std::uint64_t>;
+		{
+			Index index{path.c_str(), 16};
+			for (::std::uint64_t i = 0; i < 10000; ++i)
+				assert(index.insert(i, i * 3));
+			assert(!index.insert(5, 0) && index.size() == 10000 && index.capacity() >= 10000);
+			index.insert_or_assign(5, 55);
+			assert(index.erase(6) && !index.erase(6) && !index.contains(6));
+			index.sync();
+		}
+
+		// Reopening maps the table instead of rebuilding it.
+		{
+			Index index{path.c_str()};
+			assert(index.size() == 9999);
+			::std::uint64_t value;
+			assert(index.find(5, value) && value == 55);
+			assert(index.find(9999, value) && value == 29997);
+			assert(!index.find(6, value) && !index.find(10000, value));
+			::std::uint64_t sum = 0;
+			index.for_each([&](::std::uint64_t const key, ::std::uint64_t const) { sum += key; });
+			assert(sum == 9999 * 10000 / 2 - 6);
+		}
+
+		// Erase/insert churn at a steady size rehashes in place of tombstones without growing the file.
+		{
+			Index index{path.c_str()};
+			assert(index.insert(6, 18));
+			for (::std::uint64_t i = 10000; i < 14000; ++i)
+				assert(index.insert(i, i * 3));
+			ext::FilePtr file;
+			file->open(path.c_str(), O_RDONLY | O_CLOEXEC, 0);
+			::off_t bound = 0;
+			::std::uint64_t next = 14000;
+			for (int round = 0; round < 100; ++round)
+			{
+				for (::std::uint64_t i = 0; i < 5000; ++i)
+				{
+					assert(index.erase(next - 14000));
+					assert(index.insert(next, next * 3));
+					++next;
+				}
+				if (round == 10)
+					bound = file->size();
+				else if (round > 10)
+					assert(file->size() == bound);
+			}
+			assert(index.size() == 14000);
+			::std::uint64_t value;
+			assert(index.find(next - 1, value) && value == (next - 1) * 3 && !index.contains(next - 14001));
+		}
+
+		// Files of other key or value types are refused.
+		try
+		{
+			ext::HashIndex<::std::uint32_t, ::std::uint64_t> other{path.c_str()};
+			assert(false);
+		}
+		catch (::std::runtime_error const&)
+		{
+		}
+
+		::unlink(path.c_str());
+	}
+
+	//--<<//>>--// window map //--<<//>>--//
+	void test_window_map()
+	{
+		::std::string const path = temp_path(u8"window");
+		ext::FilePtr file;
+		file->open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+		::std::size_t const page = static_cast<::std::size_t>(::sysconf(_SC_PAGESIZE));
+		::std::vector<char> data(4 * page);
+		for (::std::size_t i = 0; i < data.size(); ++i)
+			data[i] = static_cast<char>(i * 7 + i / 251);
+		file->pwrite_all(data.data(), data.size(), 0);
+
+		ext::WindowMapOptions options;
+		options.window_size = page;
+		options.overlap = 16;
+		options.max_windows = 2;
+		ext::WindowMap map{file, options};
+		assert(map.size() == data.size());
+
+		// Views within a window and across its overlap; longer ones do not fit.
+		assert(!::std::memcmp(map.view(10, 100), data.data() + 10, 100));
+		assert(!::std::memcmp(map.view(page - 8, 24), data.data() + page - 8, 24));
+		assert(!map.view(page - 8, 32));
+		assert(map.mapped_windows() == 1);
+
+		// Empty views need no window, even at the end of a file that fills its last one.
+		assert(map.view(map.size(), 0));
+		assert(map.view(page, 0));
+		assert(map.mapped_windows() == 1);
+		bool threw = false;
+		try { map.view(map.size() - 4, 8); } catch (::std::out_of_range const&) { threw = true; }
+		assert(threw);
+
+		// Cursors read across windows while the map stays within max_windows.
+		{
+			auto cursor = map.cursor(100);
+			::std::vector<char> buffer(data.size());
+			assert(cursor.read(buffer.data(), buffer.size()) == data.size() - 100);
+			assert(!::std::memcmp(buffer.data(), data.data() + 100, data.size() - 100));
+			assert(cursor.eof() && !cursor.data() && cursor.peek(0));
+			cursor.seek(2 * page - 4);
+			assert(!::std::memcmp(cursor.peek(12), data.data() + 2 * page - 4, 12));
+			assert(map.mapped_windows() <= 2);
+		}
+
+		// A failing mmap() leaves the windows as they were: make the descriptor write-only for a moment.
+		assert(!::std::memcmp(map.view(0, 8), data.data(), 8));
+		assert(!::std::memcmp(map.view(page, 8), data.data() + page, 8));
+		int const saved = ::dup(file.get());
+		int const write_only = ::open(path.c_str(), O_WRONLY | O_CLOEXEC);
+		assert(saved >= 0 && write_only >= 0);
+		assert(::dup2(write_only, file.get()) == file.get());
+		threw = false;
+		try { map.view(3 * page, 8); } catch (::std::system_error const&) { threw = true; }
+		assert(threw);
+		assert(::dup2(saved, file.get()) == file.get());
+		::close(write_only);
+		::close(saved);
+		assert(map.mapped_windows() == 2);
+		assert(!::std::memcmp(map.view(3 * page, 8), data.data() + 3 * page, 8));
+		assert(!::std::memcmp(map.view(page + 8, 8), data.data() + page + 8, 8));
+		assert(!::std::memcmp(map.view(0, 8), data.data(), 8));
+
+		// The file grows; the window that ended at the old size is mapped again.
+		data.resize(5 * page, 'x');
+		file->pwrite_all(data.data() + 4 * page, page, static_cast<::off_t>(4 * page));
+		map.refresh_size();
+		assert(map.size() == data.size());
+		assert(!::std::memcmp(map.view(4 * page - 8, 16), data.data() + 4 * page - 8, 16));
+		assert(!::std::memcmp(map.view(5 * page - 8, 8), data.data() + 5 * page - 8, 8));
+
+		// A cursor holding the last window keeps its view across growth, then moves on to the new data.
+		file->truncate(static_cast<::off_t>(page + 100));
+		ext::WindowMap grown{file, options};
+		{
+			auto cursor = grown.cursor(page + 10);
+			char const* const held = cursor.data();
+			assert(held && cursor.available() == 90);
+			file->pwrite_all(data.data() + page + 100, 3 * page - 100, static_cast<::off_t>(page + 100));
+			grown.refresh_size();
+			assert(grown.size() == 4 * page && held[89] == data[page + 99]);
+
+			cursor.seek(page + 200);
+			assert(cursor.available() == page + 16 - 200);
+			assert(!::std::memcmp(cursor.data(), data.data() + page + 200, page - 200));
+
+			cursor.seek(2 * page + 50);
+			assert(cursor.available() == page + 16 - 50);
+			::std::vector<char> buffer(2 * page);
+			assert(cursor.read(buffer.data(), buffer.size()) == 2 * page - 50);
+			assert(!::std::memcmp(buffer.data(), data.data() + 2 * page + 50, 2 * page - 50));
+
+			cursor.seek(page + 10);
+			assert(cursor.available() == page + 16 - 10 && !::std::memcmp(cursor.data(), data.data() + page + 10, page));
+			assert(grown.mapped_windows() <= 2);
+		}
+
+		file.reset();
+		::unlink(path.c_str());
+	}
+
+	//--<<//>>--// lazy memory map //--<<//>>--//
+	void test_lazy_memory_map()
+	{
+		::std::size_t const page = static_cast<::std::size_t>(::sysconf(_SC_PAGESIZE));
+		::std::size_t const pages = 64;
+		auto const expected = [](::std::size_t const offset) { return static_cast<char>(offset * 13 + offset / 4093); };
+		::std::atomic<unsigned> calls{0};
+		ext::PageFiller const fill = [&](::std::size_t const offset, void* const buffer, ::std::size_t const length)
+		{
+			assert(offset % page == 0 && length % page == 0);
+			++calls;
+			if (offset <= 40 * page && 40 * page < offset + length)
+				throw ::std::runtime_error{u8"page 40"};
+			for (::std::size_t i = 0; i < length; ++i)
+				static_cast<char*>(buffer)[i] = expected(offset + i);
+		};
+
+		try
+		{
+			// Each fault fills the touched page and its prefill_pages neighbours.
+			ext::LazyMemoryMap map{pages * page, fill, 3};
+			assert(map.size() == pages * page && !map.filled_pages() && !calls);
+			// The faulting thread wakes before the handler counts the pages it installed.
+			auto const settle = [&map](::std::size_t const filled)
+			{
+				for (int i = 0; i < 10000 && map.filled_pages() < filled; ++i)
+					::std::this_thread::sleep_for(::std::chrono::microseconds{100});
+				return map.filled_pages();
+			};
+			assert(map.data()[5 * page + 7] == expected(5 * page + 7));
+			assert(settle(4) == 4 && calls == 1);
+			for (::std::size_t i = 5 * page; i < 9 * page; ++i)
+				assert(map.data()[i] == expected(i));
+			assert(map.filled_pages() == 4 && calls == 1);
+
+			// A fault stops prefilling at the first page that is already there.
+			assert(map.data()[3 * page] == expected(3 * page));
+			assert(settle(6) == 6 && calls == 2);
+
+			// prefill() skips the filled pages and covers the rest without faults.
+			map.prefill(0, 20 * page);
+			assert(map.filled_pages() == 20);
+			unsigned const before = calls;
+			for (::std::size_t i = 0; i < 20 * page; i += 997)
+				assert(map.data()[i] == expected(i));
+			assert(calls == before);
+			map.check();
+
+			// A failing fill leaves zeros behind and reports its error through check().
+			assert(map.data()[40 * page + 1] == 0);
+			assert(map.data()[43 * page] == 0);
+			bool threw = false;
+			try { map.check(); } catch (::std::runtime_error const&) { threw = true; }
+			assert(threw);
+			assert(map.data()[63 * page + page - 1] == expected(64 * page - 1));
+		}
+		catch (::std::system_error const& e)
+		{
+			// userfaultfd may be missing or forbidden.
+			assert(e.code().value() == ENOSYS || e.code().value() == EPERM);
+		}
+	}
+
+} // namespace
 
 int main()
 {
 	//--<<//>>--// color //--<<//>>--//
-	ext::colorf c1;
-	ext::colorf c2;
-	ext::colorf c3 = c1 * c2;
+	ext::Colorf c1;
+	ext::Colorf c2;
+	ext::Colorf c3 = c1;
+	c3 *= c2;
+
+	test_cores();
 
+	test_thread_pool();
+	test_concurrent_queues();
+	test_per_cpu();
+	test_perf_event();
+	test_io_uring_partial_submit();
+	test_async_io(ext::AsyncBackend::Auto);
+	test_async_io(ext::AsyncBackend::Threads);
+	test_vectored_io();
+	test_sparse_copy();
+	test_buffered_file();
+	test_buffered_writer_failure();
+	test_file_error_codes();
+	test_file_space();
+	test_direct_io();
+	test_chunked_reader();
+	test_wal();
+	test_file_cache();
+	test_memory_map_advice();
+	test_growable_memory_map();
+	test_span();
+	test_column_file();
+	test_mapped_writeback();
+	test_ring_buffer();
+	test_shared_memory();
+	test_arena();
+	test_pool();
+	test_hash_index();
+	test_window_map();
+	test_lazy_memory_map();
 	::std::cout << u8"Hello world!\n";
 }